@@ -0,0 +1,254 @@
+/**
+ * Benchmark suite: btree against std::set, written as JSON for comparing
+ * results between releases.
+ *
+ * Usage: bench_btree [number of keys] [output file]
+ *
+ * Each workload (random, sorted and reverse-sorted longs, and the words of
+ * twl.txt made into more keys by a suffix, in the order of the file) is loaded
+ * into std::set and into btree for several maxNodeElems in split mode, and in
+ * the default (overflow) mode for maxNodeElems 40. The operations timed are
+ * insert, find of keys in the set, find of keys not in it, iteration over all
+ * elements, copy, snapshot (btree only) and destroy. Each is run a few times
+ * and the fastest run is reported, in nanoseconds per element. The btrees use
+ * an allocator whose instances never compare equal, so that "copy" copies every
+ * node (on several threads for large trees) as std::set does, instead of
+ * sharing them; "snapshot" is the O(1) copy that shares the nodes (see
+ * btree::snapshot). "destroy" frees a tree that is not shared.
+ *
+ * The default mode degrades into long chains on ordered input, so it is only
+ * run on at most 50000 keys of the sorted and reverse-sorted workloads.
+ * Build with 'make bench', which compiles without sanitizers.
+ **/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "btree.h"
+
+namespace {
+
+const int Runs = 3;
+
+// std::allocator whose instances never compare equal, so that a copy of a btree cannot share the nodes of the
+// original and copies them instead
+template <typename T>
+struct Unshared_Allocator {
+  typedef T value_type;
+  typedef std::true_type propagate_on_container_move_assignment;
+  Unshared_Allocator() = default;
+  template <typename U>
+  Unshared_Allocator(const Unshared_Allocator<U> &) {}
+  T *allocate(size_t n) { return std::allocator<T>().allocate(n); }
+  void deallocate(T *p, size_t n) { std::allocator<T>().deallocate(p, n); }
+};
+template <typename T, typename U>
+bool operator==(const Unshared_Allocator<T> &, const Unshared_Allocator<U> &) { return false; }
+template <typename T, typename U>
+bool operator!=(const Unshared_Allocator<T> &, const Unshared_Allocator<U> &) { return true; }
+
+template <typename T>
+using bench_btree = btree<T, 0, std::less<T>, Unshared_Allocator<T>>;
+
+// keys to load, in the order they are inserted
+template <typename T>
+struct Workload {
+  std::string name;
+  std::vector<T> keys;
+};
+
+// one line of the results
+struct Result {
+  std::string container, workload, operation;
+  size_t node_max;
+  bool split;
+  size_t elements;
+  double ns_per_elem;
+};
+
+template <typename F>
+double best_ms(F f) {
+  double best = 0;
+  for (int run = 0; run < Runs; ++run) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    if (run == 0 || elapsed.count() < best)
+      best = elapsed.count();
+  }
+  return best;
+}
+
+// sum of the keys found and seen, printed at the end so that no loop is optimised away
+size_t checksum = 0;
+size_t weight(long key) { return static_cast<size_t>(key); }
+size_t weight(const std::string& key) { return key.size(); }
+// a key between 'key' and the next one of the workload
+long miss(long key) { return key + 1; }
+std::string miss(const std::string& key) { return key + "+"; }
+
+// time a snapshot of a btree, std::set has none
+// @Return: false if there is nothing to time
+template <typename T>
+bool snapshot_ms(const bench_btree<T>& set, double& ms) {
+  ms = best_ms([&] {
+    auto copy = set.snapshot();
+    checksum += copy.size();
+  });
+  return true;
+}
+template <typename T>
+bool snapshot_ms(const std::set<T>&, double&) { return false; }
+
+// time every operation on a set made by 'make', record one result per operation
+template <typename T, typename Make>
+void run(const Workload<T>& work, const std::string& container, size_t node_max, bool split, size_t count, Make make,
+         std::vector<Result>& results) {
+  auto record = [&](const char *operation, size_t elements, double ms) {
+    results.push_back(Result{container, work.name, operation, node_max, split, elements, ms * 1e6 / elements});
+    std::cerr << std::left << std::setw(10) << container << std::setw(6) << node_max << std::setw(10)
+              << (split ? "split" : (container == "std::set" ? "-" : "overflow")) << std::setw(10) << work.name
+              << std::setw(12) << operation << std::fixed << std::setprecision(1) << ms * 1e6 / elements << " ns"
+              << std::endl;
+  };
+  // lookups of the loaded keys in random order, and of keys next to them that are not in the set
+  std::vector<T> hits(work.keys.begin(), work.keys.begin() + count), misses;
+  std::shuffle(hits.begin(), hits.end(), std::mt19937_64(7));
+  for (const auto& key : hits)
+    misses.push_back(miss(key));
+  auto set = make();
+  record("insert", count, best_ms([&] {
+    set = make();
+    for (size_t i = 0; i < count; ++i)
+      set.insert(work.keys[i]);
+  }));
+  record("find_hit", count, best_ms([&] {
+    for (const auto& key : hits)
+      if (set.find(key) != set.end())
+        ++checksum;
+  }));
+  record("find_miss", count, best_ms([&] {
+    for (const auto& key : misses)
+      if (set.find(key) == set.end())
+        ++checksum;
+  }));
+  record("iterate", set.size(), best_ms([&] {
+    for (const auto& key : set)
+      checksum += weight(key);
+  }));
+  record("copy", set.size(), best_ms([&] {
+    auto copy = set;
+    checksum += copy.size();
+  }));
+  double snapshot;
+  if (snapshot_ms(set, snapshot))
+    record("snapshot", set.size(), snapshot);
+  // each run destroys a set of its own, made before the clock starts
+  double destroy = 0;
+  for (int run = 0; run < Runs; ++run) {
+    std::unique_ptr<decltype(set)> doomed(new decltype(set)(make()));
+    for (size_t i = 0; i < count; ++i)
+      doomed->insert(work.keys[i]);
+    auto start = std::chrono::steady_clock::now();
+    doomed.reset();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    if (run == 0 || elapsed.count() < destroy)
+      destroy = elapsed.count();
+  }
+  record("destroy", count, destroy);
+}
+
+template <typename T>
+void run_all(const Workload<T>& work, std::vector<Result>& results) {
+  size_t n = work.keys.size();
+  run(work, "std::set", 0, false, n, [] { return std::set<T>(); }, results);
+  for (size_t node_max : {8, 40, 128})
+    run(work, "btree", node_max, true, n, [node_max] { return bench_btree<T>(node_max, true); }, results);
+  size_t overflow = work.name == "sorted" || work.name == "reverse" ? std::min<size_t>(n, 50000) : n;
+  run(work, "btree", 40, false, overflow, [] { return bench_btree<T>(40, false); }, results);
+}
+
+std::string json_string(const std::string& text) {
+  std::string quoted = "\"";
+  for (char c : text) {
+    if (c == '"' || c == '\\')
+      quoted += '\\';
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+void write_json(std::ostream& os, size_t n, const std::vector<Result>& results) {
+  os << "{\n  \"benchmark\": \"btree vs std::set\",\n  \"keys\": " << n << ",\n  \"runs\": " << Runs
+     << ",\n  \"unit\": \"ns per element\",\n  \"results\": [\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    os << "    {\"container\": " << json_string(r.container) << ", \"node_max\": " << r.node_max
+       << ", \"split\": " << (r.split ? "true" : "false") << ", \"workload\": " << json_string(r.workload)
+       << ", \"operation\": " << json_string(r.operation) << ", \"elements\": " << r.elements
+       << ", \"ns_per_elem\": " << std::fixed << std::setprecision(2) << r.ns_per_elem << "}"
+       << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  os << "  ]\n}\n";
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  size_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+  std::mt19937_64 rng(42);
+
+  // longs: even keys, so that the odd ones are misses
+  std::vector<Workload<long>> numbers(3);
+  std::vector<long> sorted(n);
+  for (size_t i = 0; i < n; ++i)
+    sorted[i] = static_cast<long>(2 * i);
+  numbers[0].name = "random";
+  numbers[0].keys = sorted;
+  std::shuffle(numbers[0].keys.begin(), numbers[0].keys.end(), rng);
+  numbers[1].name = "sorted";
+  numbers[1].keys = sorted;
+  numbers[2].name = "reverse";
+  numbers[2].keys.assign(sorted.rbegin(), sorted.rend());
+
+  // strings: the words of twl.txt in the order of the file, each with suffixes to make n / 4 keys
+  Workload<std::string> words;
+  words.name = "twl";
+  std::ifstream file("twl.txt");
+  std::vector<std::string> dictionary;
+  std::string word;
+  while (file >> word)
+    dictionary.push_back(word);
+  if (dictionary.empty()) {
+    std::cerr << "twl.txt not found, run in the directory that holds it" << std::endl;
+    return 1;
+  }
+  size_t copies = std::max<size_t>(1, n / 4 / dictionary.size());
+  for (const auto& w : dictionary)
+    for (size_t k = 0; k < copies; ++k)
+      words.keys.push_back(w + "/" + std::to_string(k));
+
+  std::vector<Result> results;
+  for (const auto& work : numbers)
+    run_all(work, results);
+  run_all(words, results);
+
+  if (argc > 2) {
+    std::ofstream out(argv[2]);
+    write_json(out, n, results);
+  } else {
+    write_json(std::cout, n, results);
+  }
+  std::cerr << "checksum " << checksum << std::endl;
+  return 0;
+}
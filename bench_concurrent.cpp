@@ -0,0 +1,114 @@
+/**
+ * Concurrent throughput benchmark: each thread runs a mix of lookups and
+ * updates (by default 95% contains, 5% insert or erase) on random keys, for
+ * 1, 2, 4, ... up to the given number of threads. The optimistic lock coupling
+ * concurrent_btree is compared with a btree behind one std::mutex.
+ *
+ * Usage: bench_concurrent [max threads] [operations per thread] [read percent] [key range]
+ *
+ * Both trees are first loaded with half of the key range, so that the
+ * updates keep the size about the same. Throughput only scales with the
+ * number of threads up to the number of cores of the machine.
+ **/
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "btree.h"
+#include "btree_concurrent.h"
+
+namespace {
+
+struct Settings {
+  size_t operations;
+  unsigned read_percent;
+  long key_range;
+};
+
+// btree with one lock around every operation
+class locked_btree {
+public:
+  locked_btree() : tree_(btree_default_node_elems<long>(), true) {}
+  bool insert(long key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tree_.insert(key).second;
+  }
+  bool erase(long key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tree_.erase(key) == 1;
+  }
+  bool contains(long key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tree_.find(key) != tree_.end();
+  }
+private:
+  std::mutex mutex_;
+  btree<long> tree_;
+};
+
+// run the mix on 'threads' threads, return millions of operations per second
+template <typename Tree>
+double run(Tree &tree, unsigned threads, const Settings &settings) {
+  std::vector<std::thread> workers;
+  std::vector<size_t> found(threads);
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned t = 0; t < threads; ++t) {
+    workers.emplace_back([&tree, &settings, &found, t] {
+      std::mt19937_64 gen(t + 1);
+      size_t hits = 0;
+      for (size_t i = 0; i < settings.operations; ++i) {
+        long key = static_cast<long>(gen() % settings.key_range);
+        unsigned op = gen() % 100;
+        if (op < settings.read_percent)
+          hits += tree.contains(key);
+        else if (op % 2 == 0)
+          hits += tree.insert(key);
+        else
+          hits += tree.erase(key);
+      }
+      found[t] = hits;
+    });
+  }
+  for (auto &worker : workers)
+    worker.join();
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return threads * settings.operations / elapsed.count() / 1e6;
+}
+
+template <typename Tree>
+void load(Tree &tree, long key_range) {
+  for (long key = 0; key < key_range; key += 2)
+    tree.insert(key);
+}
+
+}  // namespace close
+
+int main(int argc, char *argv[]) {
+  unsigned max_threads = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 64;
+  Settings settings;
+  settings.operations = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 200000;
+  settings.read_percent = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 95;
+  settings.key_range = argc > 4 ? std::strtol(argv[4], nullptr, 10) : 1000000;
+
+  std::cout << "reads " << settings.read_percent << "%, " << settings.operations << " operations per thread, keys "
+            << settings.key_range << ", cores " << std::thread::hardware_concurrency() << std::endl;
+  std::cout << std::left << std::setw(10) << "threads" << std::setw(14) << "olc Mops/s" << "mutex Mops/s" << std::endl;
+  for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+    concurrent_btree<long> olc;
+    locked_btree locked;
+    load(olc, settings.key_range);
+    load(locked, settings.key_range);
+    double olc_rate = run(olc, threads, settings);
+    double locked_rate = run(locked, threads, settings);
+    std::cout << std::left << std::setw(10) << threads << std::fixed << std::setprecision(2) << std::setw(14)
+              << olc_rate << locked_rate << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,59 @@
+/**
+ * Insert order benchmark: loads sorted, reverse-sorted and random keys into
+ * a tree in each insert mode and reports the load time and resulting height.
+ *
+ * Usage: bench_depth [number of keys] [maxNodeElems]
+ *
+ * The default (overflow) mode degrades into long chains on ordered input,
+ * where each insert walks the whole chain, so it is only run on at most
+ * 50000 keys. The split mode should reach the same height for every order.
+ **/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "btree.h"
+
+namespace {
+
+void run(const std::string &order, const std::vector<long> &keys, size_t n, size_t maxNodeElems, bool split) {
+  auto start = std::chrono::steady_clock::now();
+  btree<long> b(maxNodeElems, split);
+  for (size_t i = 0; i < n; ++i)
+    b.insert(keys[i]);
+  std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << std::left << std::setw(10) << (split ? "split" : "overflow")
+            << std::setw(10) << order << std::setw(10) << n
+            << std::setw(8) << b.height() << std::fixed << std::setprecision(1) << elapsed.count() << std::endl;
+}
+
+}  // namespace close
+
+int main(int argc, char *argv[]) {
+  size_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+  size_t maxNodeElems = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 40;
+
+  std::vector<long> sorted(n);
+  for (size_t i = 0; i < n; ++i)
+    sorted[i] = static_cast<long>(i);
+  std::vector<long> reversed(sorted.rbegin(), sorted.rend());
+  std::vector<long> shuffled(sorted);
+  std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(42));
+
+  std::cout << "maxNodeElems " << maxNodeElems << std::endl;
+  std::cout << std::left << std::setw(10) << "mode" << std::setw(10) << "order" << std::setw(10) << "keys"
+            << std::setw(8) << "height" << "ms" << std::endl;
+  for (bool split : {false, true}) {
+    size_t count = split ? n : std::min<size_t>(n, 50000);
+    run("sorted", sorted, count, maxNodeElems, split);
+    run("reverse", reversed, count, maxNodeElems, split);
+    run("random", shuffled, count, maxNodeElems, split);
+  }
+  return 0;
+}
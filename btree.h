@@ -3,467 +3,2503 @@
 
 #include <iostream>
 #include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
 #include <utility>
 #include <vector>
 #include <deque>
+#include <iterator>
 #include <algorithm>
+#include <atomic>
+#include <exception>
+#include <system_error>
+#include <thread>
 
 #include "btree_iterator.h"
+#include "btree_search.h"
+#include "btree_instrument.h"
+#include "btree_mapped.h"
+
+// hint that the memory at 'addr' is read soon (the iterators fetch the node after the one they are in)
+#if defined(__GNUC__) || defined(__clang__)
+#define BTREE_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define BTREE_PREFETCH(addr) ((void)(addr))
+#endif
 
 // Declare of output operator <<
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+std::ostream& operator<<(std::ostream &os, const btree<T, N, Compare, Alloc, Mapped> &tree);
+// Declare of the set operations, see below the class
+template <typename T, size_t N, typename Compare, typename Alloc>
+btree<T, N, Compare, Alloc, void> set_union(const btree<T, N, Compare, Alloc, void>& a,
+                                            const btree<T, N, Compare, Alloc, void>& b, size_t threads = 1);
+template <typename T, size_t N, typename Compare, typename Alloc>
+btree<T, N, Compare, Alloc, void> set_intersection(const btree<T, N, Compare, Alloc, void>& a,
+                                                   const btree<T, N, Compare, Alloc, void>& b, size_t threads = 1);
+template <typename T, size_t N, typename Compare, typename Alloc>
+btree<T, N, Compare, Alloc, void> set_difference(const btree<T, N, Compare, Alloc, void>& a,
+                                                 const btree<T, N, Compare, Alloc, void>& b, size_t threads = 1);
+
+// Header of a B-Tree node, see btree::Node for the layout of the whole node
+// (M is the type of the values of a btree_map, the node is aligned for both arrays)
+template <typename T, typename M = T>
+struct alignas(alignof(T) > alignof(M) ? (alignof(T) > alignof(void*) ? alignof(T) : alignof(void*))
+                                       : (alignof(M) > alignof(void*) ? alignof(M) : alignof(void*))) btree_node {
+    // constructor and destructor
+    btree_node(bool leaf) : count_(0), leaf_(leaf), refs_(1), total_(0) {}
+    ~btree_node() {}
+    // get size of Node
+    size_t size() const { return count_; }
+
+    // number of elements stored in the node
+    unsigned count_;
+    // true if the node is allocated without child array
+    bool leaf_;
+    // number of trees and parent nodes that point to the node, a node with more than one is shared
+    // between copies of a tree and is copied before it is changed (see btree::own)
+    std::atomic<unsigned> refs_;
+    // number of elements in the sub-tree of the node (the node's own elements included)
+    size_t total_;
+};
+
+// Node capacity N for btree<T, N> that makes a leaf fill a whole number of 64 byte cache lines
+// (4 lines, or more if a leaf would not hold at least 4 elements)
+// It is not the default N of btree: that stays 0, the capacity chosen at run time, so that btree<T> and its
+// 'maxNodeElems' argument work as they always did. fixed_btree<T> is a btree with this capacity.
+template <typename T>
+constexpr size_t btree_default_node_elems() {
+    size_t header = sizeof(btree_node<T>), line = 64;
+    size_t bytes = (header + 4 * sizeof(T) + line - 1) / line * line;
+    if (bytes < 4 * line)
+        bytes = 4 * line;
+    // a node with capacity N allocates N + 1 element slots (see btree::node_capacity)
+    return (bytes - header) / sizeof(T) - 1;
+}
+
+// Copy and teardown of a large B-Tree handle its sub-trees on several threads, so copy constructors and
+// destructors of different elements can run at the same time. Specialise this to std::false_type for an
+// element type where that is not safe (one that counts its copies in a global without locking, say).
+template <typename T>
+struct btree_parallel_elems : std::true_type {};
+
+// What the iterators of a B-Tree hand out: the elements of a set (template argument Mapped of btree is void),
+// read-only; for a btree_map, pairs of references to a key and its value, which can be changed in place.
+// The keys and the values are kept in separate arrays of the node, so there is no std::pair in memory, and
+// operator-> of the iterators returns a pointer-like holder of the pair.
+template <typename T, typename Mapped>
+struct btree_slot_traits {
+    typedef std::pair<const T, Mapped> value_type;
+    typedef std::pair<const T&, Mapped&> reference;
+    typedef std::pair<const T&, const Mapped&> const_reference;
+    template <typename Reference>
+    struct arrow {
+        Reference ref;
+        const Reference* operator->() const { return &ref; }
+    };
+    typedef arrow<reference> pointer;
+    typedef arrow<const_reference> const_pointer;
+    static reference make(const T& key, Mapped *values, size_t pos) { return reference(key, values[pos]); }
+    static const_reference make_const(const T& key, const Mapped *values, size_t pos) {
+        return const_reference(key, values[pos]);
+    }
+    static pointer make_pointer(const T& key, Mapped *values, size_t pos) { return pointer{make(key, values, pos)}; }
+    static const_pointer make_const_pointer(const T& key, const Mapped *values, size_t pos) {
+        return const_pointer{make_const(key, values, pos)};
+    }
+};
 template <typename T>
-std::ostream& operator<<(std::ostream &os, const btree<T> &tree);
+struct btree_slot_traits<T, void> {
+    typedef T value_type;
+    typedef const T& reference;
+    typedef const T& const_reference;
+    typedef const T* pointer;
+    typedef const T* const_pointer;
+    static reference make(const T& key, const T*, size_t) { return key; }
+    static const_reference make_const(const T& key, const T*, size_t) { return key; }
+    static pointer make_pointer(const T& key, const T*, size_t) { return &key; }
+    static const_pointer make_const_pointer(const T& key, const T*, size_t) { return &key; }
+};
+
+// Shape and memory of a B-Tree, see btree::stats
+struct btree_stats {
+    // number of levels, and of nodes on each level from root down
+    size_t height;
+    std::vector<size_t> level_nodes;
+    // nodes and elements in all
+    size_t nodes, elements;
+    // nodes by how full they are: bucket i counts the nodes holding at least i/10 and less than (i+1)/10 of
+    // maxNodeElems elements, full nodes are in the last bucket
+    std::vector<size_t> fill_histogram;
+    // nodes that a copy of the tree points to as well (see btree::snapshot), the nodes below them are shared
+    // through them and not counted
+    size_t shared_nodes;
+    // bytes allocated for the nodes; of those, bytes of the elements (and values of a btree_map) and bytes of
+    // the element slots that are not used, the rest holds node headers and child pointers (memory that the
+    // elements themselves allocate, like the characters of a long std::string, is not counted)
+    size_t node_bytes, element_bytes, slack_bytes;
+};
 
-template <typename T> class btree {
+// Whether emplace can look up its argument as it is and make the element only once the argument is known to be
+// new: an element, or any argument the element can be made of if the comparator is transparent
+template <typename Compare, typename = void>
+struct btree_is_transparent : std::false_type {};
+template <typename Compare>
+struct btree_is_transparent<Compare, typename std::conditional<true, void, typename Compare::is_transparent>::type>
+        : std::true_type {};
+template <typename T, typename Compare, typename... Args>
+struct btree_emplace_key : std::false_type {};
+template <typename T, typename Compare, typename Arg>
+struct btree_emplace_key<T, Compare, Arg> : std::integral_constant<bool,
+        std::is_same<typename std::decay<Arg>::type, T>::value ||
+        (btree_is_transparent<Compare>::value && std::is_constructible<T, Arg&&>::value)> {};
+
+template <typename K, typename V, size_t N, typename Compare, typename Alloc> class btree_map;
+
+template <typename T, size_t N = 0, typename Compare = std::less<T>, typename Alloc = std::allocator<T>,
+          typename Mapped = void> class btree {
 public:
     // Friend iterator classes
-    friend class btree_Iterator<T>;
-    friend class btree_Reverse_Iterator<T>;
-    friend class btree_Const_Iterator<T>;
-    friend class btree_Const_Reverse_Iterator<T>;
+    friend class btree_Iterator<btree>;
+    friend class btree_Reverse_Iterator<btree>;
+    friend class btree_Const_Iterator<btree>;
+    friend class btree_Const_Reverse_Iterator<btree>;
+    // a B-Tree with values (template argument Mapped) is used through btree_map, see btree_map.h
+    friend class btree_map<T, Mapped, N, Compare, Alloc>;
 
     // Iterator typedefs
-    typedef btree_Iterator<T> iterator;
-    typedef btree_Reverse_Iterator<T> reverse_iterator;
-    typedef btree_Const_Iterator<T> const_iterator;
-    typedef btree_Const_Reverse_Iterator<T> const_reverse_iterator;
+    typedef btree_Iterator<btree> iterator;
+    typedef btree_Reverse_Iterator<btree> reverse_iterator;
+    typedef btree_Const_Iterator<btree> const_iterator;
+    typedef btree_Const_Reverse_Iterator<btree> const_reverse_iterator;
+
+    // Container typedefs
+    typedef btree_slot_traits<T, Mapped> slot_traits;
+    typedef typename slot_traits::value_type value_type;
+    typedef typename slot_traits::reference reference;
+    typedef typename slot_traits::const_reference const_reference;
+    typedef typename slot_traits::pointer pointer;
+    typedef typename slot_traits::const_pointer const_pointer;
+    typedef T key_type;
+    typedef Compare key_compare;
+    typedef Alloc allocator_type;
 
     // Constructs of btree
     // argument 'maxNodeElems' is maximum number of element that can be stored in each B-Tree node
-    btree(size_t maxNodeElems = 40) : Node_Max(maxNodeElems), root(new Node()), head_(nullptr), tail_(nullptr) {}
+    // argument 'splitNodes' selects the insert mode: if false (default), a full node gets a new child node
+    // hung off the element where the key would go; if true, a full node is split and its middle element is
+    // promoted to the parent, so the tree grows from the root and all leaves stay at the same depth
+    // (a split needs at least 2 elements per node, so in that mode 'maxNodeElems' is at least 2)
+    // argument 'alloc' is the allocator that nodes are allocated from (see btree_allocator.h for an arena)
+    // argument 'comp' orders the elements (a strict weak order, like operator< which is the default)
+    // If template argument N is not 0, it is the maximum number of elements of each node and 'maxNodeElems' is
+    // ignored. The node size is then a constant expression, fixed_btree<T> picks N with btree_default_node_elems().
+    btree(size_t maxNodeElems = 40, bool splitNodes = false, const Alloc& alloc = Alloc())
+            : btree(maxNodeElems, splitNodes, Compare(), alloc) {}
+    btree(size_t maxNodeElems, bool splitNodes, const Compare& comp, const Alloc& alloc = Alloc())
+            : Node_Max(N != 0 ? N : std::max<size_t>(maxNodeElems, splitNodes ? 2 : 1)), Split_Mode(splitNodes),
+              root(nullptr), comp_(comp), alloc_(alloc) {}
+
+    // Construct from the elements in [first, last), see bulk_load
+    // other arguments are the same as above
+    template <typename InputIt, typename = typename std::enable_if<!std::is_integral<InputIt>::value>::type>
+    btree(InputIt first, InputIt last, size_t maxNodeElems = 40, bool splitNodes = false, const Alloc& alloc = Alloc())
+            : btree(maxNodeElems, splitNodes, alloc) {
+        bulk_load(first, last);
+    }
 
     // Copy constructor
-    btree(const btree<T>& original);
+    // O(1): the copy shares the nodes of the original, each node counts the trees and nodes that point to
+    // it. An insert or erase on either tree first copies the shared nodes on the path it changes, so
+    // the other tree is never affected. The nodes are only copied at once if the allocator of the copy
+    // is not equal to the original's (btree_arena_allocator gives a copy its own arena).
+    btree(const btree<T, N, Compare, Alloc, Mapped>& original);
 
     // Move constructor
-    btree(btree<T>&& original);
+    btree(btree<T, N, Compare, Alloc, Mapped>&& original);
 
-    // Copy assignment
-    btree<T>& operator=(const btree<T>& rhs);
+    // Copy assignment, shares the nodes of 'rhs' like the copy constructor
+    btree<T, N, Compare, Alloc, Mapped>& operator=(const btree<T, N, Compare, Alloc, Mapped>& rhs);
 
     // Move assignment
-    btree<T>& operator=(btree<T>&& rhs);
+    btree<T, N, Compare, Alloc, Mapped>& operator=(btree<T, N, Compare, Alloc, Mapped>&& rhs);
 
     // Overload of operator '<<'
     // Puts a breadth-first traversal of the B-Tree onto the output stream os.
-    friend std::ostream& operator<< <T> (std::ostream& os, const btree<T>& tree);
+    friend std::ostream& operator<< <T, N, Compare, Alloc, Mapped> (std::ostream& os, const btree<T, N, Compare, Alloc, Mapped>& tree);
+    // set operations of two trees, see below the class
+    friend btree<T, N, Compare, Alloc, void> set_union<T, N, Compare, Alloc>(const btree<T, N, Compare, Alloc, void>& a,
+            const btree<T, N, Compare, Alloc, void>& b, size_t threads);
+    friend btree<T, N, Compare, Alloc, void> set_intersection<T, N, Compare, Alloc>(const btree<T, N, Compare, Alloc, void>& a,
+            const btree<T, N, Compare, Alloc, void>& b, size_t threads);
+    friend btree<T, N, Compare, Alloc, void> set_difference<T, N, Compare, Alloc>(const btree<T, N, Compare, Alloc, void>& a,
+            const btree<T, N, Compare, Alloc, void>& b, size_t threads);
 
     // begin()/end()
-    iterator begin() { return iterator(head_, tail_); }
-    iterator end() { return iterator(nullptr, tail_); }
-    const_iterator begin() const { return const_iterator(head_, tail_); }
-    const_iterator end() const { return const_iterator(nullptr, tail_); }
+    // iterators refer to a slot in a node, so inserting into the tree invalidates them
+    iterator begin() { return iterator(this, first_node(), 0); }
+    iterator end() { return iterator(this); }
+    const_iterator begin() const { return const_iterator(this, first_node(), 0); }
+    const_iterator end() const { return const_iterator(this); }
     // rbegin()/rend()
-    reverse_iterator rbegin() { return reverse_iterator(tail_, head_); }
-    reverse_iterator rend() { return reverse_iterator(nullptr, head_); }
-    const_reverse_iterator rbegin() const { return const_reverse_iterator(tail_, head_); }
-    const_reverse_iterator rend() const { return const_reverse_iterator(nullptr, head_); }
+    reverse_iterator rbegin() { auto last = last_node(); return reverse_iterator(this, last, last ? last->size() - 1 : 0); }
+    reverse_iterator rend() { return reverse_iterator(this); }
+    const_reverse_iterator rbegin() const { auto last = last_node(); return const_reverse_iterator(this, last, last ? last->size() - 1 : 0); }
+    const_reverse_iterator rend() const { return const_reverse_iterator(this); }
     // cbegin()/cend()
-    const_iterator cbegin() const { return const_iterator(head_, tail_); }
-    const_iterator cend() const { return const_iterator(nullptr, tail_); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
     // crbegin()/crend()
-    const_reverse_iterator crbegin() const { return const_reverse_iterator(tail_, head_); }
-    const_reverse_iterator crend() const { return const_reverse_iterator(nullptr, head_); }
+    const_reverse_iterator crbegin() const { return rbegin(); }
+    const_reverse_iterator crend() const { return rend(); }
 
     // Function for find the elements in the B-Tree
     iterator find(const T& elem);
 
     //Identical in functionality to the non-const version of find.
     const_iterator find(const T& elem) const;
-    
-    // Insert elements into the B-Tree
-    std::pair<iterator, bool> insert(const T& elem);
+
+    // Ordered lookups, each is one descent from root
+    // lower_bound: first element not less than 'elem'; upper_bound: first element greater than 'elem'
+    // (end() if there is none); equal_range: pair of both, an empty range if 'elem' is not in the tree
+    iterator lower_bound(const T& elem);
+    const_iterator lower_bound(const T& elem) const;
+    iterator upper_bound(const T& elem);
+    const_iterator upper_bound(const T& elem) const;
+    std::pair<iterator, iterator> equal_range(const T& elem) { return std::make_pair(lower_bound(elem), upper_bound(elem)); }
+    std::pair<const_iterator, const_iterator> equal_range(const T& elem) const {
+        return std::make_pair(lower_bound(elem), upper_bound(elem));
+    }
+
+    // Heterogeneous lookups, for a transparent comparator (one with a member type 'is_transparent', like
+    // std::less<>): 'key' is compared with the elements as it is, so find("word") on a
+    // btree<std::string, 0, std::less<>> does not build a std::string. Same results as the lookups above.
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key) { auto location = find_location(key); return iterator(this, location.first, location.second); }
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator find(const K& key) const {
+        auto location = find_location(key);
+        return const_iterator(this, location.first, location.second);
+    }
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator lower_bound(const K& key) {
+        auto location = lower_bound_location(key);
+        return iterator(this, location.first, location.second);
+    }
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator lower_bound(const K& key) const {
+        auto location = lower_bound_location(key);
+        return const_iterator(this, location.first, location.second);
+    }
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator upper_bound(const K& key) {
+        auto location = upper_bound_location(key);
+        return iterator(this, location.first, location.second);
+    }
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator upper_bound(const K& key) const {
+        auto location = upper_bound_location(key);
+        return const_iterator(this, location.first, location.second);
+    }
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    std::pair<iterator, iterator> equal_range(const K& key) { return std::make_pair(lower_bound(key), upper_bound(key)); }
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    std::pair<const_iterator, const_iterator> equal_range(const K& key) const {
+        return std::make_pair(lower_bound(key), upper_bound(key));
+    }
+
+    // Call 'f(elem)' on each element in [lo, hi), in order
+    // The nodes are walked directly instead of through iterators, and the sub-trees that lie inside the
+    // range are visited without comparing their elements.
+    // @Return: number of elements visited
+    template <typename F>
+    size_t scan(const T& lo, const T& hi, F f) const;
+
+    // Insert elements into the B-Tree, an element that is moved in is left as it is if it is in the tree already
+    // An insert starts from the path of the one before (the finger) and climbs it only as far as the element
+    // requires, so elements that come in order, like increasing timestamps, or close to each other take a
+    // search of one or two nodes instead of one per level (the sub-tree sizes on the path are still updated).
+    std::pair<iterator, bool> insert(const T& elem) { return insert_unique(elem); }
+    std::pair<iterator, bool> insert(T&& elem) { return insert_unique(std::move(elem)); }
+    // Insert with a hint, as for std::set: the element's place is just before 'hint' (end() to append). If
+    // 'hint' is in a node on the path of the last insert, like the iterator that insert returned, the search
+    // starts from that node; a wrong hint costs the climb to a node where the element belongs.
+    // @Return: iterator to the inserted element, or to the element that prevented the insert
+    iterator insert(const_iterator hint, const T& elem) { use_hint(hint); return insert_unique(elem).first; }
+    iterator insert(const_iterator hint, T&& elem) { use_hint(hint); return insert_unique(std::move(elem)).first; }
+    // Insert an element made of 'args', in place: an element, or with a transparent comparator any single
+    // argument that an element can be made of (like a string literal for btree<std::string, 0, std::less<>>),
+    // is looked up as it is and the element is only made if it is inserted; other arguments make an element
+    // that is looked up and then moved into the tree
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args) {
+        return emplace_unique(btree_emplace_key<T, Compare, Args...>(), std::forward<Args>(args)...);
+    }
+    // same as emplace, with a hint as for insert
+    // @Return: iterator to the inserted element, or to the element that prevented the insert
+    template <typename... Args>
+    iterator emplace_hint(const_iterator hint, Args&&... args) {
+        use_hint(hint);
+        return emplace(std::forward<Args>(args)...).first;
+    }
+
+    // Insert the elements of [first, last) / of the array [elems, elems + count) into the B-Tree
+    // The batch is sorted first and merged into the tree in order: each insert starts from the path of
+    // the one before and climbs only as far as the next element requires, so a sub-tree is descended
+    // once for all the elements that go into it. Elements already in the tree or repeated in the batch
+    // are not inserted.
+    // @Return: a pair, first is number of elements inserted, second number of duplicates skipped
+    template <typename InputIt, typename = typename std::enable_if<!std::is_integral<InputIt>::value>::type>
+    std::pair<size_t, size_t> insert(InputIt first, InputIt last);
+    std::pair<size_t, size_t> insert_batch(const T* elems, size_t count) { return insert(elems, elems + count); }
+
+    // Replace the contents of the B-Tree by the elements in [first, last)
+    // Sorted input (strictly increasing) is built into packed nodes in O(n), children before their parent,
+    // without searching for each element. Other input is sorted first and duplicates are dropped, as 'insert' would.
+    // The result has all leaves at the same depth, in either insert mode.
+    template <typename InputIt>
+    void bulk_load(InputIt first, InputIt last);
+
+    // Add the elements of 'other' that are not in the B-Tree, in O(n + m): the two sorted sequences are walked
+    // together and the tree is rebuilt from the result into packed nodes, as bulk_load does, instead of an
+    // insert with a descent for each element. 'threads' above 1 builds on several threads, see set_union.
+    // (When 'other' is much smaller than the tree, insert(other.begin(), other.end()) does less work.)
+    void merge(const btree& other, size_t threads = 1);
+
+    // Erase elements from the B-Tree, erasing invalidates all iterators of the tree
+    // In split mode a node that falls below half full borrows elements from a sibling or is merged with it,
+    // so erasing does not leave sparse nodes and all leaves stay at the same depth. In the default mode an
+    // erased element is replaced by the nearest element of a sub-tree below it, and a node left empty is
+    // replaced by its sub-tree.
+    // @Return: number of elements erased (0 or 1)
+    size_t erase(const T& elem);
+    // @Return: iterator to the element after the erased one
+    iterator erase(const_iterator pos);
+    // Erase the elements in [first, last), the sub-trees that lie inside the range are freed whole
+    // instead of erasing their elements one by one
+    // @Return: iterator to the element that 'last' referred to
+    iterator erase(const_iterator first, const_iterator last);
+
+    // Number of levels in the B-Tree (0 for an empty tree)
+    size_t height() const;
+    // Shape and memory of the B-Tree (see btree_stats), in one walk over the nodes that reads no element,
+    // for checking how the insert order shaped the tree and for memory budgets
+    btree_stats stats() const;
+
+    // Number of elements in the B-Tree, each node keeps the number of elements in its sub-tree
+    size_t size() const { return root != nullptr ? root->total_ : 0; }
+    bool empty() const { return root == nullptr; }
+
+    // Order statistics through the sub-tree sizes, one descent from root each
+    // rank: number of elements less than 'elem'
+    size_t rank(const T& elem) const { return rank_of(elem); }
+    template <typename K, typename C = Compare, typename = typename C::is_transparent>
+    size_t rank(const K& key) const { return rank_of(key); }
+    // select: iterator to the element that has 'i' elements before it, end() if 'i' is not less than size()
+    iterator select(size_t i);
+    const_iterator select(size_t i) const;
+    // count: number of elements in [lo, hi)
+    size_t count(const T& lo, const T& hi) const { return comp_(lo, hi) ? rank(hi) - rank(lo) : 0; }
+
+    // copy of the allocator and of the comparator
+    allocator_type get_allocator() const { return allocator_type(alloc_); }
+    key_compare key_comp() const { return comp_; }
+
+    // Write the tree to file 'path' as a read-only image, in pages that open_mapped() maps as they are
+    // (see btree_mapped.h for the format), elements must be trivially copyable or std::string
+    // throws std::system_error if the file cannot be written
+    void save(const std::string& path) const {
+        static_assert(btree_is_less<Compare, T>::value, "an image is searched with operator<, the tree must be ordered by it");
+        static_assert(!Has_Mapped, "an image holds keys only");
+        btree_mapped<T>::save(path, begin(), end());
+    }
+    // Open an image written by save(): the file is mapped and lookups and iteration read it in place,
+    // so opening takes no time whatever the size, and processes that open the same image share its memory
+    static btree_mapped<T> open_mapped(const std::string& path) { return btree_mapped<T>(path); }
+
+    // Copy of the tree as it is now, for readers that need a consistent view while the tree changes
+    // O(1) for every allocator: the snapshot shares the nodes and the allocator of the tree (with
+    // btree_arena_allocator that is the same arena, which is not thread-safe, so then the snapshot must
+    // be used on the same thread as the tree). Snapshots and the tree can be read and freed on different
+    // threads, the counts of the shared nodes are atomic.
+    btree<T, N, Compare, Alloc, Mapped> snapshot() const;
 
     // Destructor part
     ~btree() {
-        // use funciton destructor_helper to free all Nodes and Elements in B-Tree
-        destructor_helper(root);
+        // use funciton clear_nodes to free all Nodes and Elements in B-Tree
+        clear_nodes();
     };
 private:
-    // Declare two struct Node and Elem
-    struct Node;
-    struct Elem;
+    // true for a btree_map: each element (key) has a value of type Mapped
+    static const bool Has_Mapped = !std::is_void<Mapped>::value;
+    // type of the values, T stands in for a set (which has no value array)
+    typedef typename std::conditional<Has_Mapped, Mapped, T>::type Mapped_Slot;
+
+    // Node, represent the Nodes in B-Tree
+    // Node is only the header: the node's elements follow it as one contiguous array of 'node_capacity()'
+    // slots, and an internal node also carries 'node_capacity() + 1' child pointers after the elements.
+    // A leaf is allocated without the child array. For a btree_map the values are an array of the same
+    // size between the elements and the child pointers, so searching a node reads only the keys.
+    typedef btree_node<T, Mapped_Slot> Node;
 
+    // Private functions of copy and teardown
+    // The tree is walked with an explicit stack instead of recursion, so a deep tree (the default insert
+    // mode builds chains of nodes from sorted input) cannot overflow the call stack. A large tree is split
+    // into sub-trees that are copied or freed on several threads, see parallel_threads().
     // Private function that make copy of Node.
-    // @Param: nd is the copy target node, pre is the parent element of this node (for root is nullptr)
-    // @Return: return a pair, first is copied node, second is tail of tree(including copied node and its child node)
-    std::pair<typename btree<T>::Node*,typename btree<T>::Elem*> copy_node(const Node* nd, Elem* pre);
+    // @Param: nd is the copy target node
+    // @Return: copied node (including copies of all its child nodes)
+    Node* copy_tree(const Node* nd);
     // Private function that free the Node
     // @Param: nd is the Node that will be free.(if nd is root, whole B-Tree will be freed)
-    void destructor_helper(Node*& nd);
+    void destroy_tree(Node*& nd);
+    // copy node 'nd' into '*slot' and add its children with the slots of their copies to 'pending'
+    template <typename Pending>
+    void copy_one(const Node *nd, Node **slot, Pending& pending);
+    // copy or free a sub-tree on the calling thread
+    void copy_subtree(const Node *nd, Node **slot);
+    void destroy_subtree(Node *nd);
+    // number of threads to copy or free the sub-tree of 'nd' with: 1 for small trees, for allocators
+    // other than std::allocator, which need not be thread-safe (like btree_arena_allocator), and for
+    // elements that opt out through btree_parallel_elems
+    size_t parallel_threads(const Node *nd) const;
+    // true if the nodes and elements of the tree can be made and freed on several threads
+    static bool parallel_elems() {
+        return std::is_same<Node_Alloc, std::allocator<Node>>::value && btree_parallel_elems<T>::value &&
+               btree_parallel_elems<Mapped_Slot>::value;
+    }
+    // call f(i) for each i in [0, count) on 'threads' threads (the calling thread is one of them),
+    // the first exception thrown by f is rethrown after all threads are done
+    template <typename F>
+    static void run_parallel(size_t threads, size_t count, F f);
+    // trees with fewer elements are copied and freed on one thread
+    static const size_t Parallel_Min = 1 << 16;
+    // Private function that free the whole B-Tree, leaving it empty
+    // if the allocator can drop all of its memory at once, the nodes are not visited one by one
+    void clear_nodes();
+    // allocators that can free everything they handed out at once (like btree_arena_allocator)
+    // provide 'bool release_if_unique()', other allocators free the nodes one by one
+    template <typename A>
+    static auto release_nodes(A& alloc, int) -> decltype(alloc.release_if_unique()) { return alloc.release_if_unique(); }
+    template <typename A>
+    static bool release_nodes(A&, long) { return false; }
+    // Private functions of the order statistics
+    // node and location of the element that has 'i' elements before it, (nullptr, 0) if there is none
+    std::pair<Node*, size_t> select_location(size_t i) const;
+    // number of elements less than 'key'
+    template <typename K>
+    size_t rank_of(const K& key) const;
+    // number of elements before location (nd, pos), size() for end()
+    size_t location_rank(const Node *nd, size_t pos) const;
+    // move location (nd, pos) by n elements (used by iterator '+=')
+    void advance_location(Node*& nd, size_t& pos, std::ptrdiff_t n) const;
+    // number of elements in the sub-tree of 'nd', 0 for an empty location
+    size_t sub_tree_size(const Node *nd) const { return nd != nullptr ? nd->total_ : 0; }
+    // number of elements in the sub-tree of 'nd' computed from the sizes of its children
+    size_t count_total(const Node *nd) const;
+
     // Private function that find the element location in the node(use binary search)
-    // @Param: nd is the Node for search, ele is the element value
-    // @Return: a pair, fist is element location in Node(iterator), second bool(true if find)
-    std::pair<typename std::vector<typename btree<T>::Elem*>::iterator, bool> find_ele_location(Node* nd, const T& elem) const;
-    // struct Node, represent the Nodes in B-Tree
-    struct Node {
-
-        // constructor and destructor
-        Node() : child_(nullptr) {}
-        ~Node() {}
-        // get size of Node
-        size_t size() { return Elems_list.size(); }
-        // set the pointer child_ point to Node's last child
-        void setChild(Node *nd) { child_ = nd; }
-        // Elems_list store the pointers point to elements in Node
-        std::vector<Elem*> Elems_list;
-        // a pointer point to the Node's last child
-        Node *child_;
+    // @Param: nd is the Node for search, ele is the element value (or a key of another type that the
+    // comparator takes, see the heterogeneous lookups)
+    // @Return: a pair, first is the location of the first element not less than 'elem' (so also the
+    // location to insert 'elem' at, and the child to descend into), second bool(true if find)
+    template <typename K>
+    std::pair<size_t, bool> find_ele_location(const Node* nd, const K& elem) const {
+        // the search is picked by btree_node_search from the comparator and the element type: SIMD for
+        // numbers, one three-way comparison per probe for strings (see btree_search.h)
+        BTREE_COUNT(nodes, 1);
+        return btree_node_search<T, K, Compare>::find(elems(nd), nd->size(), elem, comp_);
+    }
+    // same as find_ele_location, but first tries the neighbours of the element at location 'slot' (the last one
+    // inserted): an element just after or before it, or equal to it, is placed with two comparisons
+    template <typename K>
+    std::pair<size_t, bool> find_ele_near(const Node* nd, size_t slot, const K& elem) const {
+        BTREE_COUNT(nodes, 1);
+        if (slot < nd->size()) {
+            auto array = elems(nd);
+            if (less(array[slot], elem)) {
+                if (slot + 1 == nd->size() || less(elem, array[slot + 1]))
+                    return std::make_pair(slot + 1, false);
+            } else if (!less(elem, array[slot])) {
+                return std::make_pair(slot, true);
+            } else if (slot == 0 || less(array[slot - 1], elem)) {
+                return std::make_pair(slot, false);
+            }
+        }
+        return btree_node_search<T, K, Compare>::find(elems(nd), nd->size(), elem, comp_);
+    }
+    // comp_(a, b), counted as a comparison of the operation (see btree_instrument.h)
+    template <typename A, typename B>
+    bool less(const A& a, const B& b) const {
+        BTREE_COUNT(comparisons, 1);
+        return comp_(a, b);
+    }
+    // node and location of the element equal to 'key', (nullptr, 0) if there is none
+    template <typename K>
+    std::pair<Node*, size_t> find_location(const K& key) const;
+    // Private function that insert element, 'value' are the arguments of the constructor of its value for a
+    // btree_map (the value is only made if the element is inserted)
+    // @Param: elem is the element, or a key that the comparator orders among the elements and that an element
+    // is made of, it is copied or moved into the tree only if it is inserted
+    // @Return: same as 'insert'
+    template <typename K, typename... Args>
+    std::pair<iterator, bool> insert_unique(K&& elem, Args&&... value);
+    // Private function that cut the finger back to the deepest node whose sub-tree 'elem' belongs to
+    // (empty if there is no finger, or if a copy shares its nodes)
+    // @Return: true if the whole finger is kept, its last location is then next to the place of 'elem'
+    template <typename K>
+    bool climb_finger(const K& elem);
+    // Private function that cut the finger back to the node of 'hint', if that node is on it
+    void use_hint(const const_iterator& hint) {
+        for (size_t i = 0; i < finger_.size(); ++i)
+            if (finger_[i].first == hint.node_) {
+                finger_.resize(i + 1);
+                return;
+            }
+    }
+    // Private function that insert element when 'Split_Mode' is set
+    // descends to a leaf, inserts there and splits every overflowing node on the way back up
+    // @Param: elem is the element value (tree must be non-empty)
+    // @Return: same as 'insert'
+    template <typename K, typename... Args>
+    std::pair<iterator, bool> insert_split(K&& elem, Args&&... value);
+    // emplace of an argument that is looked up as it is, and of arguments that make an element first
+    template <typename Arg>
+    std::pair<iterator, bool> emplace_unique(std::true_type, Arg&& arg) { return insert_unique(std::forward<Arg>(arg)); }
+    template <typename... Args>
+    std::pair<iterator, bool> emplace_unique(std::false_type, Args&&... args) {
+        return insert_unique(T(std::forward<Args>(args)...));
+    }
+    // Private function that split the overflowing nodes on the path, from the bottom up
+    // @Param: path is the nodes from root to leaf, each paired with the slot that the descent went through
+    // (for the leaf, the slot is where the new element was inserted)
+    // the new nodes are allocated before any element moves, if that fails the inserted element is removed
+    // and the sub-tree sizes on the path are put back before the exception is passed on
+    // @Return: node and location of the inserted element after the splits
+    std::pair<Node*, size_t> split_path(std::vector<std::pair<Node*, size_t>>& path);
+
+    // Private functions of erase
+    // path from root to the first element not less than 'elem', each node paired with the slot that the
+    // descent went through (for the last node, the location of that element); empty if there is none
+    void lower_bound_path(const T& elem, std::vector<std::pair<Node*, size_t>>& path) const;
+    // node and location of the first element not less than 'elem', (nullptr, 0) if there is none
+    template <typename K>
+    std::pair<Node*, size_t> lower_bound_location(const K& elem) const;
+    // node and location of the first element greater than 'elem', (nullptr, 0) if there is none
+    template <typename K>
+    std::pair<Node*, size_t> upper_bound_location(const K& elem) const;
+    // Private function of scan: visit the elements of the sub-tree in [*lo, *hi), a bound that is
+    // nullptr does not limit the range (the sub-tree lies inside the range on that side)
+    template <typename F>
+    void scan_node(const Node *nd, const T *lo, const T *hi, F& f, size_t& count) const;
+    // erase the element at the end of the path (see lower_bound_path) and restore the node invariants
+    // of the insert mode on the way back up
+    // @Return: the erased element
+    T erase_path(std::vector<std::pair<Node*, size_t>>& path);
+    // split mode: child i of 'parent' is below half full, merge it with a sibling if both fit in one
+    // node, otherwise move elements over from the sibling through the parent until it is half full
+    void rebalance_child(Node *parent, size_t i);
+    // move one element from child l + 1 of 'parent' to child l (rotate_left) or back (rotate_right),
+    // the separator l of the parent goes down and the sibling's nearest element takes its place
+    void rotate_left(Node *parent, size_t l);
+    void rotate_right(Node *parent, size_t l);
+    // merge child l + 1 of 'parent' and separator l into child l
+    void merge_children(Node *parent, size_t l);
+    // remove elements [from, to) of the node with the child sub-trees [from, to) before them,
+    // which are freed whole
+    // @Return: number of elements removed, the caller updates the sub-tree sizes of the ancestors
+    size_t drop_elems(Node *nd, size_t from, size_t to);
+
+    // Private function that insert a sorted range without duplicates, starting each insert from the
+    // path of the one before (see 'insert(first, last)')
+    // @Return: number of elements inserted
+    template <typename ForwardIt>
+    size_t insert_sorted(ForwardIt first, ForwardIt last);
+
+    // Private functions of bulk_load
+    // multi-pass input is checked for order in place, single pass input is copied first
+    template <typename ForwardIt>
+    void bulk_load_range(ForwardIt first, ForwardIt last, std::forward_iterator_tag);
+    template <typename InputIt>
+    void bulk_load_range(InputIt first, InputIt last, std::input_iterator_tag);
+    // @Param: first, last is a sorted range without duplicates
+    template <typename ForwardIt>
+    void bulk_load_sorted(ForwardIt first, ForwardIt last);
+    // build a sub-tree of the given height from 'count' elements starting at 'it', which is advanced
+    // past them; 'capacity' is the maximum number of elements of a sub-tree for each height
+    // @Return: root of the sub-tree
+    template <typename ForwardIt>
+    Node* build_subtree(ForwardIt& it, size_t count, size_t height, const std::vector<size_t>& capacity);
+    // build the tree from the 'count' elements starting at 'first', a sorted range without duplicates
+    // with 'threads' above 1, the sub-trees of root are built on that many threads
+    template <typename ForwardIt>
+    void build_tree(ForwardIt first, size_t count, size_t threads);
+
+    // Private functions of the set operations
+    // which elements of the two trees a set operation keeps
+    enum class Set_Op { Union, Intersection, Difference };
+    // Forward iterator over the elements that a set operation keeps from the sorted sequences [a, a_end) and
+    // [b, b_end), in order; an element that is in both is read from 'a'
+    class Merge_Iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef T value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const T* pointer;
+        typedef const T& reference;
+
+        Merge_Iterator(const_iterator a, const_iterator a_end, const_iterator b, const_iterator b_end, Set_Op op,
+                       const Compare& less)
+                : a_(a), a_end_(a_end), b_(b), b_end_(b_end), op_(op), less_(&less), from_b_(false), both_(false) {
+            settle();
+        }
+        const T& operator*() const { return from_b_ ? *b_ : *a_; }
+        Merge_Iterator& operator++() {
+            if (from_b_) {
+                ++b_;
+            } else {
+                ++a_;
+                if (both_)
+                    ++b_;
+            }
+            settle();
+            return *this;
+        }
+        Merge_Iterator operator++(int) { auto copy = *this; operator++(); return copy; }
+        bool operator==(const Merge_Iterator& other) const { return a_ == other.a_ && b_ == other.b_; }
+        bool operator!=(const Merge_Iterator& other) const { return !operator==(other); }
+    private:
+        // move on to the next element that the operation keeps, or to the end of both sequences
+        void settle();
+        const_iterator a_, a_end_, b_, b_end_;
+        Set_Op op_;
+        const Compare *less_;
+        // the element is read from 'b' / it is in both sequences
+        bool from_b_, both_;
     };
-    // struct Elem, represent the Elements in B-Tree
-    struct Elem {
-        // constructor and destructor
-        Elem(const T& t, Elem *pre, Elem *next) : elem_(t), pre_(pre), next_(next), child_(nullptr) {}
-        ~Elem() {}
-        // get value of element
-        const T& value() const { return elem_; }
-        // set pointer 'pre_' to previous element
-        void setPre(Elem *ele) { pre_ = ele;}
-        // set pointer 'next_' to next element
-        void setNext(Elem *ele) { next_ = ele; }
-        // set pointer 'child_' point to child of Node in the location of this element
-        void setChild(Node *nd) { child_ = nd; }
-
-        // 'elem_' store the value of element
-        T elem_;
-        // pointers point to previous and next elements
-        Elem *pre_, *next_;
-        // pointer point to the child of Node in the location of this element
-        Node *child_;
+    // forward iterator over the elements that an array of pointers points to
+    class Deref_Iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef T value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const T* pointer;
+        typedef const T& reference;
+
+        explicit Deref_Iterator(const T* const *at) : at_(at) {}
+        const T& operator*() const { return **at_; }
+        Deref_Iterator& operator++() { ++at_; return *this; }
+        Deref_Iterator operator++(int) { auto copy = *this; ++at_; return copy; }
+        bool operator==(const Deref_Iterator& other) const { return at_ == other.at_; }
+        bool operator!=(const Deref_Iterator& other) const { return at_ != other.at_; }
+    private:
+        const T* const *at_;
     };
+    // tree of the elements of 'a' and 'b' that 'op' keeps, with the node size, insert mode, comparator and
+    // allocator of 'a'; 'threads' is the number of parts the key range is split into (see set_union)
+    static btree set_operation(const btree& a, const btree& b, Set_Op op, size_t threads);
+
+    // Node layout helpers
+    // maximum number of elements of a node, a constant expression if N is not 0
+    size_t max_node_elems() const { return N != 0 ? N : Node_Max; }
+    // number of elements a split mode node keeps when elements are erased
+    size_t min_node_elems() const { return max_node_elems() / 2; }
+    // number of element slots allocated in each node, split mode needs one spare slot because a node
+    // overflows by one element before it is split (a fixed size node always has the spare slot, so that
+    // its size does not depend on the insert mode)
+    size_t node_capacity() const { return N != 0 ? N + 1 : Node_Max + (Split_Mode ? 1 : 0); }
+    // byte offset of the value array of a btree_map node, and the end of it (the end of the elements for a set)
+    size_t values_offset() const {
+        return (sizeof(Node) + node_capacity() * sizeof(T) + alignof(Mapped_Slot) - 1) & ~(alignof(Mapped_Slot) - 1);
+    }
+    size_t values_end() const {
+        return Has_Mapped ? values_offset() + node_capacity() * sizeof(Mapped_Slot) : sizeof(Node) + node_capacity() * sizeof(T);
+    }
+    // byte offset of the child pointer array in an internal node
+    size_t child_offset() const { return (values_end() + alignof(Node*) - 1) & ~(alignof(Node*) - 1); }
+    // element array of the node
+    T* elems(Node *nd) const { return reinterpret_cast<T*>(nd + 1); }
+    const T* elems(const Node *nd) const { return reinterpret_cast<const T*>(nd + 1); }
+    // value array of a btree_map node (not to be used for a set)
+    Mapped_Slot* values(const Node *nd) const {
+        return reinterpret_cast<Mapped_Slot*>(reinterpret_cast<char*>(const_cast<Node*>(nd)) + values_offset());
+    }
+    // what the iterators hand out for location (nd, pos), see btree_slot_traits
+    reference reference_at(Node *nd, size_t pos) const { return slot_traits::make(elems(nd)[pos], values(nd), pos); }
+    const_reference const_reference_at(const Node *nd, size_t pos) const {
+        return slot_traits::make_const(elems(nd)[pos], values(nd), pos);
+    }
+    pointer pointer_at(Node *nd, size_t pos) const { return slot_traits::make_pointer(elems(nd)[pos], values(nd), pos); }
+    const_pointer const_pointer_at(const Node *nd, size_t pos) const {
+        return slot_traits::make_const_pointer(elems(nd)[pos], values(nd), pos);
+    }
+    // element an iterator refers to
+    const T& key_of(const const_iterator& it) const { return elems(it.node_)[it.pos_]; }
+    // child pointer array of an internal node (child i holds the elements before element i,
+    // the last child 'size()' holds the elements after the last element)
+    Node** children(const Node *nd) const {
+        return reinterpret_cast<Node**>(reinterpret_cast<char*>(const_cast<Node*>(nd)) + child_offset());
+    }
+    // child in location i of the node, nullptr for leaves and empty locations
+    Node* child(const Node *nd, size_t i) const { return nd->leaf_ ? nullptr : children(nd)[i]; }
+    // allocate an empty leaf or internal node (all child pointers of an internal node are nullptr)
+    Node* new_node(bool leaf);
+    // destroy the elements of the node and free it (child nodes are not touched)
+    void delete_node(Node *nd);
+    // Private functions of copy-on-write
+    // new node with copies of the elements, count and sub-tree size of 'nd', and no children
+    Node* clone_node(const Node *nd);
+    // copy the values of 'nd' into 'copy' (nothing for a set; the nodes of a map are only cloned by
+    // copy_tree, which requires copyable values)
+    void copy_values(const Node *nd, Node *copy, std::true_type) {
+        std::uninitialized_copy(values(nd), values(nd) + nd->size(), values(copy));
+    }
+    void copy_values(const Node*, Node*, std::false_type) {}
+    // make the node that '*link' points to belong to this tree only, so it can be changed: a shared node
+    // is replaced by a copy that shares its children (the node holding 'link' must not be shared)
+    // @Return: the node now in '*link'
+    Node* own(Node **link);
+    // own() each node of a path from root (see lower_bound_path), top down
+    void own_path(std::vector<std::pair<Node*, size_t>>& path);
+    // add a reference to the sub-tree of 'nd' (nullptr for an empty tree)
+    // the values of a map are written in place through its iterators, so a map never shares its nodes
+    bool can_share(const btree& other) const { return !Has_Mapped && alloc_ == other.alloc_; }
+    static Node* share(Node *nd) {
+        if (nd != nullptr)
+            nd->refs_.fetch_add(1, std::memory_order_relaxed);
+        return nd;
+    }
+    // drop a reference to 'nd'
+    // @Return: true if it was the last one, the caller frees the node (a node with one reference
+    // belongs to one tree, so its count cannot be raised by another thread at the same time)
+    static bool drop_ref(Node *nd) {
+        return nd->refs_.load(std::memory_order_acquire) == 1 || nd->refs_.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+    // insert 'elem' (copied or moved) at location pos of the node, later elements are moved back by one,
+    // the caller makes room in the child array of internal nodes
+    // for a btree_map, 'value' are the arguments of the constructor of the element's value
+    template <typename V, typename... Args> void insert_elem(Node *nd, size_t pos, V&& elem, Args&&... value) {
+        insert_elem(nd, pos, std::forward<V>(elem), std::integral_constant<bool, Has_Mapped>(), std::forward<Args>(value)...);
+    }
+    template <typename V> void insert_elem(Node *nd, size_t pos, V&& elem, std::false_type);
+    template <typename V, typename... Args> void insert_elem(Node *nd, size_t pos, V&& elem, std::true_type, Args&&... value);
+    // erase the element at location pos of the node, later elements are moved forward by one,
+    // the caller removes a location from the child array of internal nodes
+    void erase_elem(Node *nd, size_t pos);
+    // Element moves between nodes, the value of a btree_map goes along with its element
+    // insert element 'from' of node 'src' at location pos of 'nd', moved (the moved-from element stays in 'src')
+    void insert_moved(Node *nd, size_t pos, Node *src, size_t from) {
+        move_insert_elem(nd, pos, src, from, std::integral_constant<bool, Has_Mapped>());
+    }
+    void move_insert_elem(Node *nd, size_t pos, Node *src, size_t from, std::true_type) {
+        insert_elem(nd, pos, std::move(elems(src)[from]), std::move(values(src)[from]));
+    }
+    void move_insert_elem(Node *nd, size_t pos, Node *src, size_t from, std::false_type) {
+        insert_elem(nd, pos, std::move(elems(src)[from]));
+    }
+    // move element 'from' of node 'src' over element pos of 'nd'
+    void assign_moved(Node *nd, size_t pos, Node *src, size_t from) {
+        elems(nd)[pos] = std::move(elems(src)[from]);
+        if (Has_Mapped)
+            values(nd)[pos] = std::move(values(src)[from]);
+    }
+    // swap element pos of 'nd' with element 'other_pos' of 'other'
+    void swap_elems(Node *nd, size_t pos, Node *other, size_t other_pos) {
+        using std::swap;
+        swap(elems(nd)[pos], elems(other)[other_pos]);
+        if (Has_Mapped)
+            swap(values(nd)[pos], values(other)[other_pos]);
+    }
+    // destroy element pos of the node (the caller updates the count)
+    void destroy_elem(Node *nd, size_t pos) {
+        elems(nd)[pos].~T();
+        if (Has_Mapped)
+            values(nd)[pos].~Mapped_Slot();
+    }
+    // move elements [from, nd->size()) of node 'nd' to the end of node 'dest'
+    void move_elems(Node *nd, size_t from, Node *dest);
+    // replace the leaf '*link' by an internal node holding the same elements (used by the default
+    // insert mode when it hangs the first child off a leaf)
+    Node* make_internal(Node **link);
+
+    // Iterator helpers
+    // leftmost and rightmost nodes that hold elements (nullptr for an empty tree)
+    Node* first_node() const;
+    Node* last_node() const;
+    // ancestors of the node of an iterator, see btree_iter_path
+    typedef btree_iter_path<Node> Iter_Path;
+    // move location (nd, pos) to the next/previous element in order, nd becomes nullptr past the end
+    // 'path' holds the ancestors of 'nd' and is kept up to date, it is found if it is not known
+    void next_location(Node*& nd, size_t& pos, Iter_Path& path) const;
+    void prev_location(Node*& nd, size_t& pos, Iter_Path& path) const;
+    // move location (nd, pos) from the last (forward) or first element of a node without children there to
+    // the next or previous element, which is in an ancestor
+    void climb_location(Node*& nd, size_t& pos, Iter_Path& path, bool forward) const;
+    // location of 'nd' in the child array of 'parent'
+    size_t child_slot(const Node *parent, const Node *nd) const {
+        return std::find(children(parent), children(parent) + parent->size() + 1, nd) - children(parent);
+    }
+    // fetch the first cache lines of node 'nd' (nothing for nullptr) ahead of an iterator reaching it
+    void prefetch_node(const Node *nd) const {
+        if (nd == nullptr)
+            return;
+        auto bytes = reinterpret_cast<const char*>(nd);
+        for (size_t line = 0; line < values_end() && line < 4 * 64; line += 64)
+            BTREE_PREFETCH(bytes + line);
+    }
+
+    static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned element types are not supported");
+    static_assert(N != 1, "a fixed node capacity must be at least 2");
+
     // maximum number of element that can be stored in each B-Tree node
     size_t Node_Max;
-    // pointer point to the root node of B-Tree
+    // true if full nodes are split on insert (see constructor)
+    bool Split_Mode;
+    // pointer point to the root node of B-Tree (nullptr for an empty tree)
     Node *root;
-    // pointers point to the head and tail elements
-    Elem *head_, *tail_;
+    // the order of the elements
+    Compare comp_;
+
+    // nodes are allocated as arrays of Node, which has the alignment of both elements and child pointers
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<Node> Node_Alloc;
+    typedef std::allocator_traits<Node_Alloc> Node_Alloc_Traits;
+    // number of Node units allocated for a leaf or internal node
+    size_t node_units(bool leaf) const {
+        size_t bytes = leaf ? values_end() : child_offset() + (node_capacity() + 1) * sizeof(Node*);
+        return (bytes + sizeof(Node) - 1) / sizeof(Node);
+    }
+    // allocator for the nodes
+    Node_Alloc alloc_;
+    // Finger: the path from root to the node of the last insert, each node paired with the slot that the
+    // descent went through. The next insert climbs it only as far as its element requires, so inserts in
+    // order (or near the last one) search a node or two instead of one per level. Operations other than
+    // insert that change the nodes clear it, and a path that a copy of the tree shares is not used.
+    std::vector<std::pair<Node*, size_t>> finger_;
 };
 
+// B-Tree whose node capacity is fixed at compile time to fill whole cache lines (see btree_default_node_elems)
+template <typename T, typename Compare = std::less<T>, typename Alloc = std::allocator<T>>
+using fixed_btree = btree<T, btree_default_node_elems<T>(), Compare, Alloc>;
+
 // Copy constructor
-template <typename T>
-btree<T>::btree(const btree<T>& original) {
-    // use function copy_node to get copy of original's root
-    auto copy = copy_node(original.root, nullptr);
-    Node_Max = original.Node_Max;
-    root = copy.first;
-    tail_ = copy.second;
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+btree<T, N, Compare, Alloc, Mapped>::btree(const btree<T, N, Compare, Alloc, Mapped>& original)
+        : Node_Max(original.Node_Max), Split_Mode(original.Split_Mode), root(nullptr), comp_(original.comp_),
+          alloc_(Node_Alloc_Traits::select_on_container_copy_construction(original.alloc_)) {
+    BTREE_OP(btree_op::copy);
+    // share the nodes if this allocator can free them, otherwise copy them
+    root = can_share(original) ? share(original.root) : copy_tree(original.root);
 }
 
 // Move constructor
-template <typename T>
-btree<T>::btree(btree<T>&& original) {
-    Node_Max = std::move(original.Node_Max);
-    root = std::move(original.root);
-    head_ = std::move(original.head_);
-    tail_ = std::move(original.tail_);
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+btree<T, N, Compare, Alloc, Mapped>::btree(btree<T, N, Compare, Alloc, Mapped>&& original)
+        : comp_(original.comp_), alloc_(std::move(original.alloc_)) {
+    Node_Max = original.Node_Max;
+    Split_Mode = original.Split_Mode;
+    root = original.root;
     // set original to empty
-    original.Node_Max = 0;
-    original.root = new Node();
-    original.head_ = nullptr;
-    original.tail_ = nullptr;
+    original.root = nullptr;
+    original.finger_.clear();
 }
 
-template <typename T>
-btree<T>& btree<T>::operator=(const btree<T>& rhs) {
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+btree<T, N, Compare, Alloc, Mapped>& btree<T, N, Compare, Alloc, Mapped>::operator=(const btree<T, N, Compare, Alloc, Mapped>& rhs) {
     if (this != &rhs) {
-        // delete 'root' and 'head_' to avoid memory leak
-        destructor_helper(root);
-        // use function copy_node to get copy of original's root
-        auto copy = copy_node(rhs.root, nullptr);
+        BTREE_OP(btree_op::copy);
+        // delete 'root' to avoid memory leak
+        clear_nodes();
+        if (Node_Alloc_Traits::propagate_on_container_copy_assignment::value)
+            alloc_ = rhs.alloc_;
+        // share the nodes of 'rhs' if this allocator can free them, otherwise copy them
         Node_Max = rhs.Node_Max;
-        root = copy.first;
-        tail_ = copy.second;
+        Split_Mode = rhs.Split_Mode;
+        comp_ = rhs.comp_;
+        root = can_share(rhs) ? share(rhs.root) : copy_tree(rhs.root);
     }
     return *this;
 }
 
-template <typename T>
-btree<T>& btree<T>::operator=(btree<T>&& rhs) {
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+btree<T, N, Compare, Alloc, Mapped>& btree<T, N, Compare, Alloc, Mapped>::operator=(btree<T, N, Compare, Alloc, Mapped>&& rhs) {
     if (this != &rhs) {
-        // delete 'root' and 'head_' to avoid memory leak
-        destructor_helper(root);
-        Node_Max = std::move(rhs.Node_Max);
-        root = std::move(rhs.root);
-        head_ = std::move(rhs.head_);
-        tail_ = std::move(rhs.tail_);
+        // delete 'root' to avoid memory leak
+        clear_nodes();
+        Node_Max = rhs.Node_Max;
+        Split_Mode = rhs.Split_Mode;
+        comp_ = rhs.comp_;
+        if (!Node_Alloc_Traits::propagate_on_container_move_assignment::value && alloc_ != rhs.alloc_) {
+            // the nodes cannot be freed by this allocator, copy them
+            root = copy_tree(rhs.root);
+            return *this;
+        }
+        if (Node_Alloc_Traits::propagate_on_container_move_assignment::value)
+            alloc_ = std::move(rhs.alloc_);
+        root = rhs.root;
         // set original to empty
-        rhs.Node_Max = 0;
-        rhs.root = new Node();
-        rhs.head_ = nullptr;
-        rhs.tail_ = nullptr;
+        rhs.root = nullptr;
+        rhs.finger_.clear();
     }
     return *this;
 }
 
-template <typename T>
-std::ostream& operator<<(std::ostream &os, const btree<T> &tree) {
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+btree<T, N, Compare, Alloc, Mapped> btree<T, N, Compare, Alloc, Mapped>::snapshot() const {
+    BTREE_OP(btree_op::copy);
+    btree<T, N, Compare, Alloc, Mapped> copy(Node_Max, Split_Mode, comp_, get_allocator());
+    copy.root = Has_Mapped ? copy.copy_tree(root) : share(root);
+    return copy;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+std::ostream& operator<<(std::ostream &os, const btree<T, N, Compare, Alloc, Mapped> &tree) {
     // use a deque to store each nodes, start from root
-    std::deque<typename btree<T>::Node*> node_list;
-    node_list.push_back(tree.root);
+    std::deque<const typename btree<T, N, Compare, Alloc, Mapped>::Node*> node_list;
+    if (tree.root != nullptr)
+        node_list.push_back(tree.root);
     while (!node_list.empty()) {
         // get first node in deque
         auto cur_node = node_list.front();
         node_list.pop_front();
         // output node's element value and push back child nodes at end of deque
-        std::for_each (cur_node->Elems_list.begin(), cur_node->Elems_list.end(), [&os, &node_list] (const auto& i) {
-            os << (*i).value() << " ";
-            if (i->child_ != nullptr)
-                node_list.push_back(i->child_);
+        auto elems = tree.elems(cur_node);
+        std::for_each (elems, elems + cur_node->size(), [&os] (const T& i) {
+            os << i << " ";
         });
-        // push back last child node to deque if exists
-        if (cur_node->child_ != nullptr)
-            node_list.push_back(cur_node->child_);
+        for (size_t i = 0; i <= cur_node->size(); ++i)
+            if (tree.child(cur_node, i) != nullptr)
+                node_list.push_back(tree.child(cur_node, i));
     }
     // delete last space
     os << '\b';
     return os;
 }
 
-template <typename T>
-typename btree<T>::iterator btree<T>::find(const T &elem) {
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+typename btree<T, N, Compare, Alloc, Mapped>::iterator btree<T, N, Compare, Alloc, Mapped>::find(const T &elem) {
+    auto location = find_location(elem);
+    return iterator(this, location.first, location.second);
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+typename btree<T, N, Compare, Alloc, Mapped>::const_iterator btree<T, N, Compare, Alloc, Mapped>::find(const T& elem) const {
+    // function body is quite similar to non-const 'find', but return type is const_iterator
+    auto location = find_location(elem);
+    return const_iterator(this, location.first, location.second);
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+template <typename K>
+std::pair<typename btree<T, N, Compare, Alloc, Mapped>::Node*, size_t> btree<T, N, Compare, Alloc, Mapped>::find_location(const K& key) const {
+    BTREE_OP(btree_op::find);
     // start with root
-    if (!head_)
-        return end();
     auto current_node = root;
-    do {
+    while (current_node != nullptr) {
         // use binary research to find the proper location of element in current node
+        auto pair = find_ele_location(current_node, key);
+        // if the element in that location, return the location of that element
+        if (pair.second == true)
+            return std::make_pair(current_node, pair.first);
+        // if the element is not in that location, continue with the child node in that location
+        // if there is no child, the element is not in the tree and the loop ends
+        current_node = child(current_node, pair.first);
+    }
+    return std::make_pair(nullptr, 0);
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+typename btree<T, N, Compare, Alloc, Mapped>::iterator btree<T, N, Compare, Alloc, Mapped>::lower_bound(const T& elem) {
+    auto location = lower_bound_location(elem);
+    return iterator(this, location.first, location.second);
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+typename btree<T, N, Compare, Alloc, Mapped>::const_iterator btree<T, N, Compare, Alloc, Mapped>::lower_bound(const T& elem) const {
+    auto location = lower_bound_location(elem);
+    return const_iterator(this, location.first, location.second);
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+typename btree<T, N, Compare, Alloc, Mapped>::iterator btree<T, N, Compare, Alloc, Mapped>::upper_bound(const T& elem) {
+    auto location = upper_bound_location(elem);
+    return iterator(this, location.first, location.second);
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+typename btree<T, N, Compare, Alloc, Mapped>::const_iterator btree<T, N, Compare, Alloc, Mapped>::upper_bound(const T& elem) const {
+    auto location = upper_bound_location(elem);
+    return const_iterator(this, location.first, location.second);
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+template <typename F>
+size_t btree<T, N, Compare, Alloc, Mapped>::scan(const T& lo, const T& hi, F f) const {
+    size_t count = 0;
+    if (root != nullptr && comp_(lo, hi))
+        scan_node(root, &lo, &hi, f, count);
+    return count;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+template <typename F>
+void btree<T, N, Compare, Alloc, Mapped>::scan_node(const Node *nd, const T *lo, const T *hi, F& f, size_t& count) const {
+    // elements [from, to) of the node are in the range, the children between them lie inside it,
+    // only the children at both ends need the bounds
+    size_t from = lo != nullptr ? find_ele_location(nd, *lo).first : 0;
+    size_t to = hi != nullptr ? find_ele_location(nd, *hi).first : nd->size();
+    auto array = elems(nd);
+    for (size_t i = from; i <= to; ++i) {
+        if (auto c = child(nd, i))
+            scan_node(c, i == from ? lo : nullptr, i == to ? hi : nullptr, f, count);
+        if (i < to) {
+            f(array[i]);
+            ++count;
+        }
+    }
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+template <typename K>
+size_t btree<T, N, Compare, Alloc, Mapped>::rank_of(const K& elem) const {
+    // the elements before the location in each node and the sub-trees before them are less than 'elem'
+    size_t less = 0;
+    for (const Node *current_node = root; current_node != nullptr; ) {
         auto pair = find_ele_location(current_node, elem);
-        auto it = pair.first;
-        // if the element in that location, return the iterator of that element
-        if (pair.second == true) {
-            return iterator(*(it));
-        } else {
-            // if the element is not in that location, check if that location has a child node
-            // if has a child, change current node to that child node for next loop
-            // if not, means element not in the tree, return end()
-            if ((*it)->value() < elem)
-                ++it;
-            if (it != current_node->Elems_list.end()) {
-                if ((*it)->child_ != nullptr) {
-                    current_node = (*it)->child_;
-                } else {
-                    return end();
-                }
-            } else {
-                if (current_node->child_ != nullptr) {
-                    current_node = current_node->child_;
-                } else {
-                    return end();
-                }
+        less += pair.first;
+        for (size_t i = 0; i < pair.first; ++i)
+            less += sub_tree_size(child(current_node, i));
+        // the sub-tree before an equal element is less than it as a whole
+        if (pair.second)
+            return less + sub_tree_size(child(current_node, pair.first));
+        current_node = child(current_node, pair.first);
+    }
+    return less;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+typename btree<T, N, Compare, Alloc, Mapped>::iterator btree<T, N, Compare, Alloc, Mapped>::select(size_t i) {
+    auto location = select_location(i);
+    return iterator(this, location.first, location.second);
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+typename btree<T, N, Compare, Alloc, Mapped>::const_iterator btree<T, N, Compare, Alloc, Mapped>::select(size_t i) const {
+    auto location = select_location(i);
+    return const_iterator(this, location.first, location.second);
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+std::pair<typename btree<T, N, Compare, Alloc, Mapped>::Node*, size_t> btree<T, N, Compare, Alloc, Mapped>::select_location(size_t i) const {
+    if (i >= size())
+        return std::make_pair(nullptr, 0);
+    Node *current_node = root;
+    while (true) {
+        // skip the children and elements before the one that holds the i-th element
+        size_t pos = 0;
+        for (; pos < current_node->size(); ++pos) {
+            size_t before = sub_tree_size(child(current_node, pos));
+            if (i < before)
+                break;
+            if (i == before)
+                return std::make_pair(current_node, pos);
+            i -= before + 1;
+        }
+        current_node = child(current_node, pos);
+    }
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+size_t btree<T, N, Compare, Alloc, Mapped>::location_rank(const Node *nd, size_t pos) const {
+    return nd != nullptr ? rank(elems(nd)[pos]) : size();
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+void btree<T, N, Compare, Alloc, Mapped>::advance_location(Node*& nd, size_t& pos, std::ptrdiff_t n) const {
+    auto location = select_location(location_rank(nd, pos) + n);
+    nd = location.first;
+    pos = location.second;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+size_t btree<T, N, Compare, Alloc, Mapped>::count_total(const Node *nd) const {
+    size_t total = nd->size();
+    for (size_t i = 0; i <= nd->size(); ++i)
+        total += sub_tree_size(child(nd, i));
+    return total;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+template <typename K>
+bool btree<T, N, Compare, Alloc, Mapped>::climb_finger(const K& elem) {
+    auto& path = finger_;
+    // nodes that are shared with a copy are copied on the way down, see 'own'
+    for (size_t i = 0; i < path.size(); ++i)
+        if (path[i].first->refs_.load(std::memory_order_acquire) != 1) {
+            path.clear();
+            return false;
+        }
+    if (path.size() <= 1)
+        return !path.empty();
+    // the sub-tree of the last node is bounded by the elements around the slot of its parent, or if the slot
+    // is at the start or end of the parent, by those of an ancestor; an element in order passes this check
+    const T *lower = nullptr, *upper = nullptr;
+    for (size_t i = path.size() - 1; i-- > 0 && (lower == nullptr || upper == nullptr); ) {
+        if (lower == nullptr && path[i].second > 0)
+            lower = &elems(path[i].first)[path[i].second - 1];
+        if (upper == nullptr && path[i].second < path[i].first->size())
+            upper = &elems(path[i].first)[path[i].second];
+    }
+    if ((lower == nullptr || less(*lower, elem)) && (upper == nullptr || less(elem, *upper)))
+        return true;
+    // otherwise keep the nodes from root down whose slot on the path has the element between its neighbours,
+    // an element far from the last one leaves the path at root after a comparison or two
+    size_t keep = 1;
+    for (; keep < path.size() - 1; ++keep) {
+        Node *nd = path[keep - 1].first;
+        size_t slot = path[keep - 1].second;
+        if ((slot > 0 && !less(elems(nd)[slot - 1], elem)) || (slot < nd->size() && !less(elem, elems(nd)[slot])))
+            break;
+    }
+    path.resize(keep);
+    return false;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+template <typename K, typename... Args>
+std::pair<typename btree<T, N, Compare, Alloc, Mapped>::iterator, bool> btree<T, N, Compare, Alloc, Mapped>::insert_unique(K&& elem, Args&&... value) {
+    BTREE_OP(btree_op::insert);
+    // if the tree is empty, add param element to a new root node
+    if (root == nullptr) {
+        Node *first = new_node(true);
+        try {
+            insert_elem(first, 0, std::forward<K>(elem), std::forward<Args>(value)...);
+        } catch (...) {
+            delete_node(first);
+            throw;
+        }
+        root = first;
+        root->total_ = 1;
+        return std::make_pair(iterator(this, root, 0), true);
+    }
+    if (Split_Mode)
+        return insert_split(std::forward<K>(elem), std::forward<Args>(value)...);
+    // start from the path of the last insert, climbed as far as 'elem' requires
+    auto& path = finger_;
+    bool near = climb_finger(elem);
+    if (path.empty())
+        path.push_back(std::make_pair(own(&root), 0));
+    // descend while there is a child in the location of the element, the nodes on the way are made this
+    // tree's own (see 'own'), so that a leaf can be replaced by an internal node
+    Node *current_node = path.back().first;
+    auto pair = near ? find_ele_near(current_node, path.back().second, elem) : find_ele_location(current_node, elem);
+    while (!pair.second && child(current_node, pair.first) != nullptr) {
+        path.back().second = pair.first;
+        current_node = own(&children(current_node)[pair.first]);
+        path.push_back(std::make_pair(current_node, 0));
+        pair = find_ele_location(current_node, elem);
+    }
+    size_t pos = pair.first;
+    path.back().second = pos;
+    // if element already in that location, cannot insert return pair(itearator, false)
+    if (pair.second)
+        return std::make_pair(iterator(this, current_node, pos), false);
+    // the element goes into the sub-trees of all nodes on the path (room for a new node on the path is
+    // made first, so nothing throws once the element is in)
+    path.reserve(path.size() + 1);
+    for (auto& entry : path)
+        ++entry.first->total_;
+    try {
+        // if current node is not full, insert element into current node
+        if (current_node->size() < max_node_elems()) {
+            insert_elem(current_node, pos, std::forward<K>(elem), std::forward<Args>(value)...);
+            // the location has no child, so it becomes two empty locations around the new element
+            if (!current_node->leaf_) {
+                auto child_array = children(current_node);
+                std::copy_backward(child_array + pos + 1, child_array + current_node->size(),
+                                   child_array + current_node->size() + 1);
+                child_array[pos + 1] = nullptr;
             }
+            return std::make_pair(iterator(this, current_node, pos), true);
         }
-    } while (1);
+        // if current node is full and has no child in that location, create a child node
+        // in that location and insert the param element into it
+        Node *newNode = new_node(true);
+        try {
+            insert_elem(newNode, 0, std::forward<K>(elem), std::forward<Args>(value)...);
+        } catch (...) {
+            delete_node(newNode);
+            throw;
+        }
+        if (current_node->leaf_) {
+            Node **link = path.size() > 1 ? &children(path[path.size() - 2].first)[path[path.size() - 2].second] : &root;
+            try {
+                current_node = make_internal(link);
+            } catch (...) {
+                delete_node(newNode);
+                throw;
+            }
+            path.back().first = current_node;
+        }
+        newNode->total_ = 1;
+        children(current_node)[pos] = newNode;
+        // the next element in order goes into the new node
+        path.push_back(std::make_pair(newNode, 0));
+        return std::make_pair(iterator(this, newNode, 0), true);
+    } catch (...) {
+        for (auto& entry : path)
+            --entry.first->total_;
+        throw;
+    }
 }
 
-template <typename T>
-typename btree<T>::const_iterator btree<T>::find(const T& elem) const {
-    // function body is quite similar to non-const 'find', but return type is const_iterator
-    if (!head_)
-        return cend();
-    auto current_node = root;
-    do {
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+template <typename InputIt, typename>
+std::pair<size_t, size_t> btree<T, N, Compare, Alloc, Mapped>::insert(InputIt first, InputIt last) {
+    // sort the batch and drop the duplicates inside it
+    std::vector<T> batch(first, last);
+    size_t count = batch.size();
+    std::sort(batch.begin(), batch.end(), comp_);
+    batch.erase(std::unique(batch.begin(), batch.end(), [this] (const T& a, const T& b) { return !comp_(a, b); }),
+                batch.end());
+    // an empty tree is built from the batch directly
+    if (root == nullptr) {
+        bulk_load_sorted(std::make_move_iterator(batch.begin()), std::make_move_iterator(batch.end()));
+        return std::make_pair(batch.size(), count - batch.size());
+    }
+    size_t inserted = insert_sorted(std::make_move_iterator(batch.begin()), std::make_move_iterator(batch.end()));
+    return std::make_pair(inserted, count - inserted);
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+template <typename ForwardIt>
+size_t btree<T, N, Compare, Alloc, Mapped>::insert_sorted(ForwardIt first, ForwardIt last) {
+    // the path from root to the node of the last insert, each node paired with the slot that the descent
+    // went through, and for each node the element above its sub-tree (nullptr if there is none);
+    // the elements come in increasing order, so the next one belongs to the deepest sub-tree on the
+    // path whose bound it is below
+    std::vector<std::pair<Node*, size_t>> path;
+    std::vector<const T*> bound;
+    size_t inserted = 0;
+    finger_.clear();
+    for (; first != last; ++first) {
+        const T& elem = *first;
+        while (path.size() > 1 && bound.back() != nullptr && !comp_(elem, *bound.back())) {
+            path.pop_back();
+            bound.pop_back();
+        }
+        if (path.empty()) {
+            path.push_back(std::make_pair(own(&root), 0));
+            bound.push_back(nullptr);
+        }
+        // descend from there while there is a child in the location of the element, the same way
+        // as 'insert' for the insert mode
+        Node *current_node = path.back().first;
         auto pair = find_ele_location(current_node, elem);
-        auto it = pair.first;
-        if (pair.second == true) {
-            return const_iterator(*(it));
+        while (!pair.second && child(current_node, pair.first) != nullptr) {
+            path.back().second = pair.first;
+            bound.push_back(pair.first < current_node->size() ? &elems(current_node)[pair.first] : bound.back());
+            current_node = own(&children(current_node)[pair.first]);
+            path.push_back(std::make_pair(current_node, 0));
+            pair = find_ele_location(current_node, elem);
+        }
+        path.back().second = pair.first;
+        if (pair.second)
+            continue;
+        if (Split_Mode) {
+            // a leaf, split below if it overflows
+            insert_elem(current_node, pair.first, *first);
+        } else if (current_node->size() < max_node_elems()) {
+            // not full: the location has no child, so it becomes two empty locations around the new element
+            // (the children are moved once the element is in, so a copy that throws leaves the node as it was)
+            insert_elem(current_node, pair.first, *first);
+            if (!current_node->leaf_) {
+                auto child_array = children(current_node);
+                std::copy_backward(child_array + pair.first + 1, child_array + current_node->size(),
+                                   child_array + current_node->size() + 1);
+                child_array[pair.first + 1] = nullptr;
+            }
         } else {
-            if ((*it)->value() < elem)
-                ++it;
-            if (it != current_node->Elems_list.end()) {
-                if ((*it)->child_ != nullptr) {
-                    current_node = (*it)->child_;
-                } else {
-                    return cend();
-                }
-            } else {
-                if (current_node->child_ != nullptr) {
-                    current_node = current_node->child_;
-                } else {
-                    return cend();
+            // full: hang a new child node off the location, freed if the element or the internal node
+            // cannot be made
+            Node *newNode = new_node(true);
+            try {
+                insert_elem(newNode, 0, *first);
+                if (current_node->leaf_) {
+                    Node **link = path.size() > 1 ? &children(path[path.size() - 2].first)[path[path.size() - 2].second] : &root;
+                    current_node = make_internal(link);
+                    path.back().first = current_node;
                 }
+            } catch (...) {
+                delete_node(newNode);
+                throw;
             }
+            newNode->total_ = 1;
+            children(current_node)[pair.first] = newNode;
         }
-    } while (1);
+        // the sub-tree sizes on the path count the element once it is in, so one that throws leaves them right
+        ++inserted;
+        for (auto& entry : path)
+            ++entry.first->total_;
+        // the splits change the nodes on the path, so start from root next time
+        if (Split_Mode && current_node->size() > max_node_elems()) {
+            split_path(path);
+            path.clear();
+            bound.clear();
+        }
+    }
+    return inserted;
 }
 
-template <typename T>
-std::pair<typename btree<T>::iterator, bool> btree<T>::insert(const T &elem) {
-    // if the tree is empty, set head_ and add param element to the root node
-    if (!head_) {
-        Elem *newElem = new Elem(elem, nullptr, nullptr);
-        head_ = newElem;
-        tail_ = newElem;
-        root->Elems_list.push_back(newElem);
-        return std::make_pair(iterator(head_, tail_), true);
-    }
-    // if tree is not empty, start with root node
-    auto current_node = root;
-    do {
-        // find the proper location in current node (use binary search function 'find_ele_location')
-        auto pair = find_ele_location(current_node, elem);
-        auto insert_it = pair.first;
-        // if element already in that location, cannot insert return pair(itearator, false)
-        if (pair.second == true)
-            return std::make_pair(iterator(*insert_it, tail_), false);
-        if ((*insert_it)->value() < elem)
-            ++insert_it;
-        // if current node is not full, insert element into current node
-        if (current_node->size() < Node_Max) {
-            // if location is not at end of Node
-            if (insert_it != current_node->Elems_list.end()) {
-                // insert the param element before the found element (adjust link state before insert)
-                Elem *newElem = new Elem(elem, (*insert_it)->pre_, *insert_it);
-                (*insert_it)->setPre(newElem);
-                if (newElem->pre_ != nullptr) {
-                    newElem->pre_->setNext(newElem);
-                } else {
-                    head_ = newElem;
-                }
-                current_node->Elems_list.insert(insert_it, newElem);
-                return std::make_pair(iterator(newElem, tail_), true);
-            } else {
-                // if location is at end of Node
-                // insert the param element at end of current node (adjust link state before insert)
-                --insert_it;
-                Elem *newElem = new Elem(elem, *insert_it, (*insert_it)->next_);
-                (*insert_it)->setNext(newElem);
-                if (newElem->next_ != nullptr) {
-                    newElem->next_->setPre(newElem);
-                } else {
-                    tail_ = newElem;
-                }
-                current_node->Elems_list.push_back(newElem);
-                return std::make_pair(iterator(newElem, tail_), true);
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+template <typename InputIt>
+void btree<T, N, Compare, Alloc, Mapped>::bulk_load(InputIt first, InputIt last) {
+    bulk_load_range(first, last, typename std::iterator_traits<InputIt>::iterator_category());
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+template <typename ForwardIt>
+void btree<T, N, Compare, Alloc, Mapped>::bulk_load_range(ForwardIt first, ForwardIt last, std::forward_iterator_tag) {
+    // sorted input is used as it is
+    if (std::adjacent_find(first, last, [this] (const T& a, const T& b) { return !comp_(a, b); }) == last) {
+        bulk_load_sorted(first, last);
+        return;
+    }
+    // otherwise copy the elements, sort them and drop duplicates (equal elements are neither less than the other)
+    std::vector<T> sorted(first, last);
+    std::sort(sorted.begin(), sorted.end(), comp_);
+    sorted.erase(std::unique(sorted.begin(), sorted.end(), [this] (const T& a, const T& b) { return !comp_(a, b); }),
+                 sorted.end());
+    bulk_load_sorted(std::make_move_iterator(sorted.begin()), std::make_move_iterator(sorted.end()));
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+template <typename InputIt>
+void btree<T, N, Compare, Alloc, Mapped>::bulk_load_range(InputIt first, InputIt last, std::input_iterator_tag) {
+    // single pass input is read into a vector first
+    std::vector<T> elements(first, last);
+    bulk_load_range(std::make_move_iterator(elements.begin()), std::make_move_iterator(elements.end()),
+                    std::random_access_iterator_tag());
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+template <typename ForwardIt>
+void btree<T, N, Compare, Alloc, Mapped>::bulk_load_sorted(ForwardIt first, ForwardIt last) {
+    clear_nodes();
+    build_tree(first, std::distance(first, last), 1);
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+template <typename ForwardIt>
+void btree<T, N, Compare, Alloc, Mapped>::build_tree(ForwardIt first, size_t count, size_t threads) {
+    if (count == 0)
+        return;
+    // capacity[h] is the maximum number of elements of a sub-tree of height h, the tree gets the
+    // smallest height that can hold all elements
+    std::vector<size_t> capacity{0, max_node_elems()};
+    while (capacity.back() < count)
+        capacity.push_back(capacity.back() * (max_node_elems() + 1) + max_node_elems());
+    size_t height = capacity.size() - 1;
+    if (threads <= 1 || height == 1) {
+        root = build_subtree(first, count, height, capacity);
+        return;
+    }
+    // root is made here, with its elements placed the same way as build_subtree does, and each thread
+    // builds whole sub-trees of root from their part of the range
+    size_t children_count = std::max<size_t>(2, (count + capacity[height - 1] + 1) / (capacity[height - 1] + 1));
+    size_t in_children = count - (children_count - 1);
+    std::vector<ForwardIt> starts;
+    std::vector<size_t> counts;
+    Node *nd = new_node(false);
+    nd->total_ = count;
+    try {
+        for (size_t i = 0; i < children_count; ++i) {
+            starts.push_back(first);
+            counts.push_back(in_children / children_count + (i < in_children % children_count ? 1 : 0));
+            std::advance(first, counts.back());
+            if (i + 1 < children_count) {
+                insert_elem(nd, i, *first);
+                ++first;
+            }
+        }
+        run_parallel(threads, children_count, [&] (size_t i) {
+            if (counts[i] > 0)
+                children(nd)[i] = build_subtree(starts[i], counts[i], height - 1, capacity);
+        });
+    } catch (...) {
+        destroy_tree(nd);
+        throw;
+    }
+    root = nd;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+void btree<T, N, Compare, Alloc, Mapped>::merge(const btree& other, size_t threads) {
+    // the result is built apart, 'other' may be this tree
+    *this = set_operation(*this, other, Set_Op::Union, threads);
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+void btree<T, N, Compare, Alloc, Mapped>::Merge_Iterator::settle() {
+    from_b_ = both_ = false;
+    while (a_ != a_end_ && b_ != b_end_) {
+        if ((*less_)(*a_, *b_)) {
+            if (op_ != Set_Op::Intersection)
+                return;
+            ++a_;
+        } else if ((*less_)(*b_, *a_)) {
+            if (op_ == Set_Op::Union) {
+                from_b_ = true;
+                return;
             }
+            ++b_;
         } else {
-            // if current node is full, need insert into sub-tree of this location
-            // if location is not at end of Node
-            if (insert_it != current_node->Elems_list.end()) {
-                // check if has a child node, if so, set current node to child node for next loop
-                if ((*insert_it)->child_ != nullptr) {
-                    current_node = (*insert_it)->child_;
-                } else {
-                    // if has no child node, create a child node and insert the param element
-                    // (adjust link state before insert)
-                    Node *newNode = new Node();
-                    Elem *newElem = new Elem(elem, (*insert_it)->pre_, *insert_it);
-                    (*insert_it)->setChild(newNode);
-                    (*insert_it)->setPre(newElem);
-                    newNode->Elems_list.push_back(newElem);
-                    if (newElem->pre_ != nullptr) {
-                        (newElem->pre_)->setNext(newElem);
-                    } else {
-                        head_ = newElem;
-                    }
-                    return std::make_pair(iterator(newElem, tail_), true);
-                }
-            } else {
-                // if location is at end of Node
-                // check if last child node exists, if so, set current node to last child node for next loop
-                if (current_node->child_ != nullptr) {
-                    current_node = current_node->child_;
-                } else {
-                    // if no last child node, create a child node for current node
-                    // then insert param element to child node (adjust link state before insert)
-                    --insert_it;
-                    Node *newNode = new Node();
-                    Elem *newElem = new Elem(elem, *insert_it, (*insert_it)->next_);
-                    newNode->Elems_list.push_back(newElem);
-                    current_node->setChild(newNode);
-                    (*insert_it)->setNext(newElem);
-                    if (newElem->next_ != nullptr) {
-                        (newElem->next_)->setPre(newElem);
-                    } else {
-                        tail_ = newElem;
-                    }
-                    return std::make_pair(iterator(newElem, tail_), true);
-                }
+            if (op_ != Set_Op::Difference) {
+                both_ = true;
+                return;
             }
+            ++a_;
+            ++b_;
         }
-    } while (1);
+    }
+    // one of the sequences is done: the union goes on with the rest of the other one, the difference with
+    // the rest of 'a', and the intersection is done
+    if (a_ == a_end_) {
+        if (op_ == Set_Op::Union)
+            from_b_ = true;
+        else
+            b_ = b_end_;
+    } else if (op_ == Set_Op::Intersection) {
+        a_ = a_end_;
+    }
 }
 
-// A recursion function for copy the node
-// In this class used for copy root node, so usually start with the root node and nullptr
-template <typename T>
-std::pair<typename btree<T>::Node*,typename btree<T>::Elem*> btree<T>::copy_node(const Node* nd, Elem* pre) {
-    // create Node 'resultNode' which is first element of return pair
-    Node *resultNode = new Node();
-    // go through each element in param node
-    for (auto i : nd->Elems_list) {
-        // create new Elem which has same value of original node
-        Elem *copy_i = new Elem(i->value(), nullptr, nullptr);
-        if (i->child_ != nullptr) {
-            // if original node has a child
-            // use 'copy_node' function to get copy of child node
-            auto Nd_Ele = copy_node(i->child_, pre);
-            // then update copied Elem's link(including child node) and the it's previous node's link state
-            copy_i->setChild(Nd_Ele.first);
-            copy_i->setPre(Nd_Ele.second);
-            copy_i->pre_->setNext(copy_i);
-        } else {
-            // if original node has no child
-            // update copied Elem's link state and the it's previous node's link state
-            copy_i->setPre(pre);
-            if (copy_i->pre_ != nullptr) {
-                copy_i->pre_->setNext(copy_i);
-            } else {
-                head_ = copy_i;
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+btree<T, N, Compare, Alloc, Mapped> btree<T, N, Compare, Alloc, Mapped>::set_operation(const btree& a, const btree& b,
+                                                                                       Set_Op op, size_t threads) {
+    static_assert(!Has_Mapped, "set operations are for a btree of elements only");
+    btree result(a.Node_Max, a.Split_Mode, a.comp_, a.get_allocator());
+    // the key range is split into parts at elements of the larger tree, if it is large enough and the nodes and
+    // elements can be made on several threads (as for a copy, see parallel_threads)
+    const btree& larger = a.size() >= b.size() ? a : b;
+    size_t parts = threads > 1 && parallel_elems() && larger.size() >= Parallel_Min ? threads : 1;
+    std::vector<const_iterator> a_cuts{a.cbegin()}, b_cuts{b.cbegin()};
+    for (size_t i = 1; i < parts; ++i) {
+        const T& key = *larger.select(i * larger.size() / parts);
+        a_cuts.push_back(a.lower_bound(key));
+        b_cuts.push_back(b.lower_bound(key));
+    }
+    a_cuts.push_back(a.cend());
+    b_cuts.push_back(b.cend());
+    // one pass over each part lists the elements kept, in order (an element and the element equal to it in
+    // the other tree are in the same part), then the nodes are built from the list, copying each element
+    // once from its tree
+    std::vector<std::vector<const T*>> kept(parts);
+    auto merge_part = [&] (size_t i) {
+        Merge_Iterator it(a_cuts[i], a_cuts[i + 1], b_cuts[i], b_cuts[i + 1], op, a.comp_);
+        Merge_Iterator end(a_cuts[i + 1], a_cuts[i + 1], b_cuts[i + 1], b_cuts[i + 1], op, a.comp_);
+        for (; it != end; ++it)
+            kept[i].push_back(&*it);
+    };
+    if (parts == 1)
+        merge_part(0);
+    else
+        run_parallel(parts, parts, merge_part);
+    for (size_t i = 1; i < parts; ++i) {
+        kept[0].insert(kept[0].end(), kept[i].begin(), kept[i].end());
+        std::vector<const T*>().swap(kept[i]);
+    }
+    result.build_tree(Deref_Iterator(kept[0].data()), kept[0].size(), parts);
+    return result;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+template <typename ForwardIt>
+typename btree<T, N, Compare, Alloc, Mapped>::Node* btree<T, N, Compare, Alloc, Mapped>::build_subtree(ForwardIt& it, size_t count, size_t height,
+                                                                     const std::vector<size_t>& capacity) {
+    // a leaf takes all elements (the caller makes sure that they fit)
+    // (a node that throws part way is freed with the elements and the sub-trees it has so far)
+    if (height == 1) {
+        Node *leaf = new_node(true);
+        try {
+            for (size_t i = 0; i < count; ++i, ++it)
+                insert_elem(leaf, i, *it);
+        } catch (...) {
+            delete_node(leaf);
+            throw;
+        }
+        leaf->total_ = count;
+        return leaf;
+    }
+    // use as few children as can hold the elements, and spread the elements evenly over them,
+    // one element goes between each two children (at least two children, so the node has an element
+    // even when all of them would fit in one child, which happens with one element per node)
+    size_t children_count = std::max<size_t>(2, (count + capacity[height - 1] + 1) / (capacity[height - 1] + 1));
+    size_t in_children = count - (children_count - 1);
+    Node *nd = new_node(false);
+    nd->total_ = count;
+    try {
+        for (size_t i = 0; i < children_count; ++i) {
+            size_t child_count = in_children / children_count + (i < in_children % children_count ? 1 : 0);
+            // a child can only end up empty with one element per node, which is the default insert mode,
+            // where a missing child is fine
+            if (child_count > 0)
+                children(nd)[i] = build_subtree(it, child_count, height - 1, capacity);
+            if (i + 1 < children_count) {
+                insert_elem(nd, i, *it);
+                ++it;
             }
         }
-        // update the 'pre' to copied Elem and push back copied Elem to 'resultNode'
-        pre = copy_i;
-        resultNode->Elems_list.push_back(copy_i);
+    } catch (...) {
+        // the children built so far are in locations 0 to the node's size, which destroy_tree walks
+        destroy_tree(nd);
+        throw;
     }
-    // check if param node has last child node, if so, get copy of it and update 'resultNode'
-    if (nd->child_ != nullptr) {
-        auto Nd_Ele = copy_node(nd->child_, pre);
-        resultNode->setChild(Nd_Ele.first);
-        pre = Nd_Ele.second;
+    return nd;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+size_t btree<T, N, Compare, Alloc, Mapped>::height() const {
+    if (root == nullptr)
+        return 0;
+    // walk the tree level by level, count the levels
+    size_t levels = 0;
+    std::vector<const Node*> level{root}, next_level;
+    while (!level.empty()) {
+        ++levels;
+        next_level.clear();
+        for (auto nd : level)
+            for (size_t i = 0; i <= nd->size(); ++i)
+                if (child(nd, i) != nullptr)
+                    next_level.push_back(child(nd, i));
+        level.swap(next_level);
     }
-    // return the pair, first is copied node 'resultNode'
-    // second is 'pre', which is the tail element for tree(including 'resultNode' and its child node)
-    return std::make_pair(resultNode, pre);
+    return levels;
 }
 
-// A recursion function to free the Node
-// In this class, use for free whole B-Tree, so usually start with the root node
-template <typename T>
-void btree<T>::destructor_helper(Node*& nd) {
-    // go through each element in param node
-    for (auto& i : nd->Elems_list) {
-        // if Element has a child Node, use child Node as param to do recursion
-        if (i->child_ != nullptr)
-            destructor_helper(i->child_);
-        // free the Elem
-        delete i;
-        i = 0;
-    }
-    // if param node has last child Node, use child Node as param to do recursion
-    if (nd->child_ != nullptr)
-        destructor_helper(nd->child_);
-    // free the Node
-    delete nd;
-    nd = 0;
-}
-
-// use binary search to find the element location in the node
-template <typename T>
-std::pair<typename std::vector<typename btree<T>::Elem*>::iterator, bool>  btree<T>::find_ele_location(Node* nd, const T& elem) const {
-    int lower(0), upper(nd->Elems_list.size() - 1), current((lower + upper) / 2);
-    bool find_flag = false;
-    while (lower <= upper) {
-        if (elem < nd->Elems_list[current]->value()) {
-            upper = current - 1;
-        } else if (elem > nd->Elems_list[current]->value()) {
-            lower = current + 1;
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+btree_stats btree<T, N, Compare, Alloc, Mapped>::stats() const {
+    btree_stats result{0, {}, 0, size(), std::vector<size_t>(10), 0, 0, 0, 0};
+    size_t slot_bytes = sizeof(T) + (Has_Mapped ? sizeof(Mapped_Slot) : 0);
+    result.element_bytes = result.elements * slot_bytes;
+    // walk the tree level by level, as 'height' does
+    std::vector<const Node*> level, next_level;
+    if (root != nullptr)
+        level.push_back(root);
+    while (!level.empty()) {
+        ++result.height;
+        result.level_nodes.push_back(level.size());
+        next_level.clear();
+        for (auto nd : level) {
+            ++result.nodes;
+            result.fill_histogram[std::min<size_t>(nd->size() * 10 / max_node_elems(), 9)]++;
+            if (nd->refs_.load(std::memory_order_relaxed) > 1)
+                ++result.shared_nodes;
+            result.node_bytes += node_units(nd->leaf_) * sizeof(Node);
+            result.slack_bytes += (node_capacity() - nd->size()) * slot_bytes;
+            for (size_t i = 0; i <= nd->size(); ++i)
+                if (child(nd, i) != nullptr)
+                    next_level.push_back(child(nd, i));
+        }
+        level.swap(next_level);
+    }
+    return result;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+template <typename K, typename... Args>
+std::pair<typename btree<T, N, Compare, Alloc, Mapped>::iterator, bool> btree<T, N, Compare, Alloc, Mapped>::insert_split(K&& elem, Args&&... value) {
+    // descend to a leaf from the path of the last insert, climbed as far as 'elem' requires, remember each
+    // node and the slot that the descent went through
+    auto& path = finger_;
+    bool near = climb_finger(elem);
+    if (path.empty())
+        path.push_back(std::make_pair(root, 0));
+    auto current_node = path.back().first;
+    do {
+        auto pair = near ? find_ele_near(current_node, path.back().second, elem) : find_ele_location(current_node, elem);
+        near = false;
+        // if element already in the tree, cannot insert return pair(itearator, false)
+        if (pair.second == true)
+            return std::make_pair(iterator(this, current_node, pair.first), false);
+        path.back().second = pair.first;
+        // in split mode a node either has a child in every location or is a leaf
+        if (current_node->leaf_)
+            break;
+        current_node = children(current_node)[pair.first];
+        path.push_back(std::make_pair(current_node, 0));
+    } while (1);
+    try {
+        // the nodes on the path are changed, copy the ones shared with copies of the tree
+        own_path(path);
+        current_node = path.back().first;
+        // insert the param element into the leaf, the spare slot holds it if the leaf is full
+        insert_elem(current_node, path.back().second, std::forward<K>(elem), std::forward<Args>(value)...);
+    } catch (...) {
+        path.clear();
+        throw;
+    }
+    for (auto& entry : path)
+        ++entry.first->total_;
+    if (current_node->size() <= max_node_elems())
+        return std::make_pair(iterator(this, current_node, path.back().second), true);
+    // the splits change the nodes on the path, so the next insert starts from root
+    std::pair<Node*, size_t> location;
+    try {
+        location = split_path(path);
+    } catch (...) {
+        path.clear();
+        throw;
+    }
+    path.clear();
+    return std::make_pair(iterator(this, location.first, location.second), true);
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+std::pair<typename btree<T, N, Compare, Alloc, Mapped>::Node*, size_t> btree<T, N, Compare, Alloc, Mapped>::split_path(std::vector<std::pair<Node*, size_t>>& path) {
+    // the leaf splits, and each full node above it that gets a median from below, and a new root if they all
+    // do: allocate those nodes first, so a split never fails half way
+    std::vector<Node*> spare;
+    try {
+        spare.reserve(path.size() + 1);
+        size_t splits = 1;
+        while (splits < path.size() && path[path.size() - 1 - splits].first->size() == max_node_elems())
+            ++splits;
+        for (size_t i = 0; i < splits; ++i)
+            spare.push_back(new_node(path[path.size() - 1 - i].first->leaf_));
+        if (splits == path.size())
+            spare.push_back(new_node(false));
+    } catch (...) {
+        for (auto nd : spare)
+            delete_node(nd);
+        // undo the insert: the element leaves the leaf (split mode leaves have no children), and the
+        // sub-tree sizes on the path no longer count it
+        erase_elem(path.back().first, path.back().second);
+        for (auto& entry : path)
+            --entry.first->total_;
+        throw;
+    }
+    std::reverse(spare.begin(), spare.end());
+    // track the location of the inserted element while its node is split
+    auto location = path.back();
+    while (path.back().first->size() > max_node_elems()) {
+        Node *nd = path.back().first;
+        size_t pos = path.back().second;
+        path.pop_back();
+        // choose the element to promote, the middle one unless the node is at the right (left) end of the
+        // tree and the insert is at its end (start): then the left (right) node keeps all but one of the
+        // elements and the other node starts with the new one, so sorted and reverse-sorted loads produce
+        // packed nodes instead of half-full ones; anywhere else that would leave a node of one element
+        size_t size = nd->size(), mid = size / 2;
+        auto on_edge = [&path](bool right_edge) {
+            return std::all_of(path.begin(), path.end(), [right_edge](const std::pair<Node*, size_t>& entry) {
+                return entry.second == (right_edge ? entry.first->size() : 0);
+            });
+        };
+        if (pos == size - 1 && on_edge(true))
+            mid = size - 2;
+        else if (pos == 0 && on_edge(false))
+            mid = 1;
+        // elements after the median move to a new right node, 'nd' keeps the elements before it
+        Node *right = spare.back();
+        spare.pop_back();
+        move_elems(nd, mid + 1, right);
+        if (!nd->leaf_)
+            std::copy(children(nd) + mid + 1, children(nd) + size + 1, children(right));
+        // the median goes up, the parent's sub-tree size stays the same
+        right->total_ = count_total(right);
+        nd->total_ -= right->total_ + 1;
+        if (location.first == nd && location.second > mid)
+            location = std::make_pair(right, location.second - mid - 1);
+        if (path.empty()) {
+            // root is split, create a new root holding only the median
+            root = spare.back();
+            spare.pop_back();
+            root->total_ = nd->total_ + right->total_ + 1;
+            children(root)[0] = nd;
+            children(root)[1] = right;
+            path.push_back(std::make_pair(root, 0));
         } else {
-            find_flag = true;
+            // make room in the parent's child array, 'right' goes after 'nd'
+            Node *parent = path.back().first;
+            auto child_array = children(parent);
+            std::copy_backward(child_array + path.back().second + 1, child_array + parent->size() + 1,
+                               child_array + parent->size() + 2);
+            child_array[path.back().second + 1] = right;
+        }
+        // put median into parent in front of the slot 'nd' hung off
+        Node *parent = path.back().first;
+        insert_moved(parent, path.back().second, nd, mid);
+        destroy_elem(nd, mid);
+        nd->count_ = mid;
+        if (location.first == nd && location.second == mid)
+            location = path.back();
+    }
+    return location;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+size_t btree<T, N, Compare, Alloc, Mapped>::erase(const T& elem) {
+    std::vector<std::pair<Node*, size_t>> path;
+    lower_bound_path(elem, path);
+    // the first element not less than 'elem' must also not be greater
+    if (path.empty() || comp_(elem, elems(path.back().first)[path.back().second]))
+        return 0;
+    own_path(path);
+    erase_path(path);
+    return 1;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+typename btree<T, N, Compare, Alloc, Mapped>::iterator btree<T, N, Compare, Alloc, Mapped>::erase(const_iterator pos) {
+    std::vector<std::pair<Node*, size_t>> path;
+    lower_bound_path(key_of(pos), path);
+    own_path(path);
+    T erased = erase_path(path);
+    // the nodes have changed, search for the element after the erased one
+    auto location = lower_bound_location(erased);
+    return iterator(this, location.first, location.second);
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+typename btree<T, N, Compare, Alloc, Mapped>::iterator btree<T, N, Compare, Alloc, Mapped>::erase(const_iterator first, const_iterator last) {
+    if (first == last)
+        return last == cend() ? end() : lower_bound(key_of(last));
+    if (first == cbegin() && last == cend()) {
+        clear_nodes();
+        return end();
+    }
+    // copies of the bounds, the elements move between nodes while the range is erased
+    std::vector<T> bounds{key_of(first)};
+    if (last != cend())
+        bounds.push_back(key_of(last));
+    const T *upper = bounds.size() > 1 ? &bounds[1] : nullptr;
+    std::vector<std::pair<Node*, size_t>> path;
+    while (true) {
+        // the first element left in the range
+        lower_bound_path(bounds[0], path);
+        if (path.empty() || (upper != nullptr && !comp_(elems(path.back().first)[path.back().second], *upper)))
+            break;
+        own_path(path);
+        // the elements after it in the same node that are in the range are dropped together with the
+        // sub-trees between them, then the element itself is erased, which rebalances the path
+        Node *nd = path.back().first;
+        size_t pos = path.back().second;
+        size_t range_end = upper != nullptr ? find_ele_location(nd, *upper).first : nd->size();
+        if (range_end > pos + 1) {
+            size_t dropped = drop_elems(nd, pos + 1, range_end);
+            for (auto& entry : path)
+                entry.first->total_ -= dropped;
+        }
+        erase_path(path);
+    }
+    return upper != nullptr ? lower_bound(*upper) : end();
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+void btree<T, N, Compare, Alloc, Mapped>::lower_bound_path(const T& elem, std::vector<std::pair<Node*, size_t>>& path) const {
+    path.clear();
+    // number of nodes on the path up to the last one that has an element not less than 'elem'
+    size_t depth = 0;
+    for (Node *current_node = root; current_node != nullptr; ) {
+        auto pair = find_ele_location(current_node, elem);
+        path.push_back(std::make_pair(current_node, pair.first));
+        if (pair.first < current_node->size())
+            depth = path.size();
+        if (pair.second)
             break;
+        current_node = child(current_node, pair.first);
+    }
+    path.resize(depth);
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+template <typename K>
+std::pair<typename btree<T, N, Compare, Alloc, Mapped>::Node*, size_t> btree<T, N, Compare, Alloc, Mapped>::lower_bound_location(const K& elem) const {
+    Node *found = nullptr;
+    size_t found_pos = 0;
+    for (Node *current_node = root; current_node != nullptr; ) {
+        auto pair = find_ele_location(current_node, elem);
+        if (pair.first < current_node->size()) {
+            found = current_node;
+            found_pos = pair.first;
+            if (pair.second)
+                break;
+        }
+        current_node = child(current_node, pair.first);
+    }
+    return std::make_pair(found, found_pos);
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+template <typename K>
+std::pair<typename btree<T, N, Compare, Alloc, Mapped>::Node*, size_t> btree<T, N, Compare, Alloc, Mapped>::upper_bound_location(const K& elem) const {
+    Node *found = nullptr;
+    size_t found_pos = 0;
+    for (Node *current_node = root; current_node != nullptr; ) {
+        // skip an equal element, the elements after it and its right sub-tree are greater
+        auto pair = find_ele_location(current_node, elem);
+        size_t pos = pair.first + (pair.second ? 1 : 0);
+        if (pos < current_node->size()) {
+            found = current_node;
+            found_pos = pos;
+        }
+        current_node = child(current_node, pos);
+    }
+    return std::make_pair(found, found_pos);
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+T btree<T, N, Compare, Alloc, Mapped>::erase_path(std::vector<std::pair<Node*, size_t>>& path) {
+    // the nodes are merged and freed, the next insert starts from root
+    finger_.clear();
+    Node *nd = path.back().first;
+    size_t pos = path.back().second;
+    // the element is swapped into the node it is removed from and taken out there, so it is still in
+    // the tree if copying a shared node on the way down throws
+    if (Split_Mode) {
+        // an element of an internal node is replaced by its predecessor, the last element of the
+        // rightmost leaf of the sub-tree before it
+        if (!nd->leaf_) {
+            Node *leaf = own(&children(nd)[pos]);
+            while (!leaf->leaf_) {
+                path.push_back(std::make_pair(leaf, leaf->size()));
+                leaf = own(&children(leaf)[leaf->size()]);
+            }
+            path.push_back(std::make_pair(leaf, leaf->size() - 1));
+            swap_elems(nd, pos, leaf, leaf->size() - 1);
+            nd = leaf;
+            pos = leaf->size() - 1;
+        }
+        for (auto& entry : path)
+            --entry.first->total_;
+        T erased(std::move(elems(nd)[pos]));
+        erase_elem(nd, pos);
+        // rebalance the nodes on the path from the bottom up, all of them are checked because a range
+        // erase may have left an ancestor short of elements as well
+        for (size_t i = path.size() - 1; i > 0; --i)
+            if (path[i].first->size() < min_node_elems())
+                rebalance_child(path[i - 1].first, path[i - 1].second);
+        // a root without elements is replaced by its only child, the tree gets one level lower
+        if (root->size() == 0) {
+            Node *old_root = root;
+            root = child(old_root, 0);
+            delete_node(old_root);
+        }
+        return erased;
+    }
+    // default mode: the element is removed with an empty child location next to it ('gap'), if it has
+    // a child sub-tree it is replaced by the predecessor or successor from there, which has an empty
+    // location on the side away from it
+    size_t gap = pos;
+    if (child(nd, pos) != nullptr) {
+        Node *left = own(&children(nd)[pos]);
+        while (child(left, left->size()) != nullptr) {
+            path.push_back(std::make_pair(left, left->size()));
+            left = own(&children(left)[left->size()]);
+        }
+        path.push_back(std::make_pair(left, left->size() - 1));
+        swap_elems(nd, pos, left, left->size() - 1);
+        nd = left;
+        pos = left->size() - 1;
+        gap = pos + 1;
+    } else if (child(nd, pos + 1) != nullptr) {
+        path.back().second = pos + 1;
+        Node *right = own(&children(nd)[pos + 1]);
+        while (child(right, 0) != nullptr) {
+            path.push_back(std::make_pair(right, 0));
+            right = own(&children(right)[0]);
+        }
+        path.push_back(std::make_pair(right, 0));
+        swap_elems(nd, pos, right, 0);
+        nd = right;
+        pos = 0;
+        gap = 0;
+    }
+    for (auto& entry : path)
+        --entry.first->total_;
+    T erased(std::move(elems(nd)[pos]));
+    size_t size = nd->size();
+    erase_elem(nd, pos);
+    if (!nd->leaf_) {
+        auto child_array = children(nd);
+        std::copy(child_array + gap + 1, child_array + size + 1, child_array + gap);
+        child_array[size] = nullptr;
+    }
+    // a node left empty is replaced by the sub-tree in its only location (or removed if there is none)
+    if (nd->size() == 0) {
+        Node **link = path.size() > 1 ? &children(path[path.size() - 2].first)[path[path.size() - 2].second] : &root;
+        *link = child(nd, 0);
+        delete_node(nd);
+    }
+    return erased;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+void btree<T, N, Compare, Alloc, Mapped>::rebalance_child(Node *parent, size_t i) {
+    // the pair of children (l, l + 1) holds child i and its left sibling, or its right one for the first child
+    size_t l = i > 0 ? i - 1 : 0;
+    // the sibling is changed as well
+    Node *left = own(&children(parent)[l]), *right = own(&children(parent)[l + 1]);
+    if (left->size() + right->size() < max_node_elems()) {
+        merge_children(parent, l);
+        return;
+    }
+    // the two hold at least 'max_node_elems()' elements, so the sibling stays half full
+    while (children(parent)[i]->size() < min_node_elems()) {
+        if (i == l)
+            rotate_left(parent, l);
+        else
+            rotate_right(parent, l);
+    }
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+void btree<T, N, Compare, Alloc, Mapped>::rotate_left(Node *parent, size_t l) {
+    Node *left = children(parent)[l], *right = children(parent)[l + 1];
+    size_t left_size = left->size(), right_size = right->size();
+    insert_moved(left, left_size, parent, l);
+    assign_moved(parent, l, right, 0);
+    erase_elem(right, 0);
+    // the first child of the right node becomes the last child of the left node
+    size_t moved = 1 + sub_tree_size(child(right, 0));
+    left->total_ += moved;
+    right->total_ -= moved;
+    if (!left->leaf_) {
+        auto right_children = children(right);
+        children(left)[left_size + 1] = right_children[0];
+        std::copy(right_children + 1, right_children + right_size + 1, right_children);
+        right_children[right_size] = nullptr;
+    }
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+void btree<T, N, Compare, Alloc, Mapped>::rotate_right(Node *parent, size_t l) {
+    Node *left = children(parent)[l], *right = children(parent)[l + 1];
+    size_t left_size = left->size(), right_size = right->size();
+    insert_moved(right, 0, parent, l);
+    assign_moved(parent, l, left, left_size - 1);
+    erase_elem(left, left_size - 1);
+    // the last child of the left node becomes the first child of the right node
+    size_t moved = 1 + sub_tree_size(child(left, left_size));
+    left->total_ -= moved;
+    right->total_ += moved;
+    if (!right->leaf_) {
+        auto right_children = children(right);
+        std::copy_backward(right_children, right_children + right_size + 1, right_children + right_size + 2);
+        right_children[0] = children(left)[left_size];
+        children(left)[left_size] = nullptr;
+    }
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+void btree<T, N, Compare, Alloc, Mapped>::merge_children(Node *parent, size_t l) {
+    Node *left = children(parent)[l], *right = children(parent)[l + 1];
+    left->total_ += 1 + right->total_;
+    insert_moved(left, left->size(), parent, l);
+    if (!left->leaf_)
+        std::copy(children(right), children(right) + right->size() + 1, children(left) + left->size());
+    move_elems(right, 0, left);
+    delete_node(right);
+    // remove the separator and the location of the right node from the parent
+    size_t size = parent->size();
+    erase_elem(parent, l);
+    auto child_array = children(parent);
+    std::copy(child_array + l + 2, child_array + size + 1, child_array + l + 1);
+    child_array[size] = nullptr;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+size_t btree<T, N, Compare, Alloc, Mapped>::drop_elems(Node *nd, size_t from, size_t to) {
+    size_t size = nd->size(), count = to - from, dropped = count;
+    if (!nd->leaf_) {
+        auto child_array = children(nd);
+        for (size_t i = from; i < to; ++i) {
+            dropped += sub_tree_size(child_array[i]);
+            destroy_tree(child_array[i]);
+        }
+        std::copy(child_array + to, child_array + size + 1, child_array + from);
+        std::fill(child_array + size + 1 - count, child_array + size + 1, nullptr);
+    }
+    auto array = elems(nd);
+    std::move(array + to, array + size, array + from);
+    if (Has_Mapped) {
+        auto vals = values(nd);
+        std::move(vals + to, vals + size, vals + from);
+    }
+    for (size_t i = size - count; i < size; ++i)
+        destroy_elem(nd, i);
+    nd->count_ -= count;
+    return dropped;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+typename btree<T, N, Compare, Alloc, Mapped>::Node* btree<T, N, Compare, Alloc, Mapped>::copy_tree(const Node* nd) {
+    static_assert(!Has_Mapped || std::is_copy_constructible<Mapped_Slot>::value, "the values of a copied map must be copyable");
+    Node *result = nullptr;
+    if (nd == nullptr)
+        return result;
+    // each copied node is linked into the copy at once and its children start as nullptr, so the
+    // partial copy is a valid tree that can be freed if copying an element throws
+    try {
+        size_t threads = parallel_threads(nd);
+        if (threads == 1) {
+            copy_subtree(nd, &result);
+            return result;
+        }
+        // copy the top of the tree breadth first until there are enough sub-trees to share among the threads
+        std::deque<std::pair<const Node*, Node**>> pending{std::make_pair(nd, &result)};
+        while (!pending.empty() && pending.size() < 4 * threads) {
+            auto next = pending.front();
+            pending.pop_front();
+            copy_one(next.first, next.second, pending);
+        }
+#ifdef BTREE_INSTRUMENT
+        // the counts of the other threads go to the operation that copies
+        btree_counts_tally tally;
+        run_parallel(threads, pending.size(), [this, &pending, &tally] (size_t i) {
+            btree_worker_scope worker(tally);
+            copy_subtree(pending[i].first, pending[i].second);
+        });
+        tally.collect();
+#else
+        run_parallel(threads, pending.size(), [this, &pending] (size_t i) {
+            copy_subtree(pending[i].first, pending[i].second);
+        });
+#endif
+    } catch (...) {
+        destroy_tree(result);
+        throw;
+    }
+    return result;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+template <typename Pending>
+void btree<T, N, Compare, Alloc, Mapped>::copy_one(const Node *nd, Node **slot, Pending& pending) {
+    // create Node of the same type, copy the elements and then queue the child nodes
+    Node *resultNode = clone_node(nd);
+    *slot = resultNode;
+    if (!nd->leaf_)
+        for (size_t i = 0; i <= nd->size(); ++i)
+            if (children(nd)[i] != nullptr)
+                pending.push_back(std::make_pair(children(nd)[i], &children(resultNode)[i]));
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+void btree<T, N, Compare, Alloc, Mapped>::copy_subtree(const Node *nd, Node **slot) {
+    std::vector<std::pair<const Node*, Node**>> stack{std::make_pair(nd, slot)};
+    while (!stack.empty()) {
+        auto next = stack.back();
+        stack.pop_back();
+        copy_one(next.first, next.second, stack);
+    }
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+void btree<T, N, Compare, Alloc, Mapped>::destroy_tree(Node*& nd) {
+    if (nd == nullptr)
+        return;
+    size_t threads = parallel_threads(nd);
+    if (threads == 1) {
+        destroy_subtree(nd);
+    } else {
+        // split off the top of the tree breadth first, free the sub-trees below it on the threads,
+        // then the top
+        // (a node shared with another tree only loses a reference, its sub-tree is left alone)
+        std::deque<Node*> pending{nd};
+        std::vector<Node*> top;
+        while (!pending.empty() && pending.size() < 4 * threads) {
+            Node *next = pending.front();
+            pending.pop_front();
+            if (!drop_ref(next))
+                continue;
+            top.push_back(next);
+            for (size_t i = 0; i <= next->size(); ++i)
+                if (child(next, i) != nullptr)
+                    pending.push_back(child(next, i));
+        }
+        if (!pending.empty())
+            run_parallel(threads, pending.size(), [this, &pending] (size_t i) { destroy_subtree(pending[i]); });
+        for (auto top_node : top)
+            delete_node(top_node);
+    }
+    nd = nullptr;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+void btree<T, N, Compare, Alloc, Mapped>::destroy_subtree(Node *nd) {
+    std::vector<Node*> stack{nd};
+    while (!stack.empty()) {
+        Node *next = stack.back();
+        stack.pop_back();
+        if (!drop_ref(next))
+            continue;
+        // queue the child nodes, then free the Node and its Elements
+        for (size_t i = 0; i <= next->size(); ++i)
+            if (child(next, i) != nullptr)
+                stack.push_back(child(next, i));
+        delete_node(next);
+    }
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+size_t btree<T, N, Compare, Alloc, Mapped>::parallel_threads(const Node *nd) const {
+    if (!parallel_elems() || nd->total_ < Parallel_Min)
+        return 1;
+    // hardware_concurrency() is 0 if it is not known
+    return std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), 8));
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+template <typename F>
+void btree<T, N, Compare, Alloc, Mapped>::run_parallel(size_t threads, size_t count, F f) {
+    std::atomic<size_t> next(0);
+    std::vector<std::exception_ptr> errors(threads);
+    auto worker = [&] (size_t t) {
+        try {
+            for (size_t i = next++; i < count; i = next++)
+                f(i);
+        } catch (...) {
+            errors[t] = std::current_exception();
+            // skip the tasks that are left
+            next = count;
+        }
+    };
+    std::vector<std::thread> pool;
+    try {
+        for (size_t t = 1; t < threads; ++t)
+            pool.emplace_back(worker, t);
+    } catch (const std::system_error&) {
+        // no more threads can be started, go on with the ones that are running
+    }
+    worker(0);
+    for (auto& thread : pool)
+        thread.join();
+    for (auto& error : errors)
+        if (error)
+            std::rethrow_exception(error);
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+void btree<T, N, Compare, Alloc, Mapped>::clear_nodes() {
+    finger_.clear();
+    // the arena way skips element (and value) destructors, so it is only taken when those are trivial
+    if (root != nullptr && std::is_trivially_destructible<T>::value &&
+        std::is_trivially_destructible<Mapped_Slot>::value && release_nodes(alloc_, 0))
+        root = nullptr;
+    destroy_tree(root);
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+typename btree<T, N, Compare, Alloc, Mapped>::Node* btree<T, N, Compare, Alloc, Mapped>::new_node(bool leaf) {
+    BTREE_COUNT(allocations, 1);
+    Node *nd = new (Node_Alloc_Traits::allocate(alloc_, node_units(leaf))) Node(leaf);
+    if (!leaf)
+        std::fill(children(nd), children(nd) + node_capacity() + 1, nullptr);
+    return nd;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+void btree<T, N, Compare, Alloc, Mapped>::delete_node(Node *nd) {
+    for (size_t i = 0; i < nd->size(); ++i)
+        destroy_elem(nd, i);
+    bool leaf = nd->leaf_;
+    nd->~Node();
+    Node_Alloc_Traits::deallocate(alloc_, nd, node_units(leaf));
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+typename btree<T, N, Compare, Alloc, Mapped>::Node* btree<T, N, Compare, Alloc, Mapped>::clone_node(const Node *nd) {
+    BTREE_COUNT(nodes, 1);
+    Node *copy = new_node(nd->leaf_);
+    try {
+        std::uninitialized_copy(elems(nd), elems(nd) + nd->size(), elems(copy));
+    } catch (...) {
+        delete_node(copy);
+        throw;
+    }
+    try {
+        copy_values(nd, copy, std::integral_constant<bool, Has_Mapped && std::is_copy_constructible<Mapped_Slot>::value>());
+    } catch (...) {
+        for (size_t i = 0; i < nd->size(); ++i)
+            elems(copy)[i].~T();
+        delete_node(copy);
+        throw;
+    }
+    copy->count_ = nd->count_;
+    copy->total_ = nd->total_;
+    return copy;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+typename btree<T, N, Compare, Alloc, Mapped>::Node* btree<T, N, Compare, Alloc, Mapped>::own(Node **link) {
+    Node *nd = *link;
+    if (nd->refs_.load(std::memory_order_acquire) == 1)
+        return nd;
+    // the copy takes this tree's reference to the node, and adds one to each child
+    Node *copy = clone_node(nd);
+    if (!nd->leaf_)
+        for (size_t i = 0; i <= nd->size(); ++i)
+            children(copy)[i] = share(children(nd)[i]);
+    *link = copy;
+    // the other trees may have dropped their references since the check
+    destroy_subtree(nd);
+    return copy;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+void btree<T, N, Compare, Alloc, Mapped>::own_path(std::vector<std::pair<Node*, size_t>>& path) {
+    for (size_t i = 0; i < path.size(); ++i)
+        path[i].first = own(i > 0 ? &children(path[i - 1].first)[path[i - 1].second] : &root);
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+template <typename V>
+void btree<T, N, Compare, Alloc, Mapped>::insert_elem(Node *nd, size_t pos, V&& elem, std::false_type) {
+    auto array = elems(nd);
+    size_t size = nd->size();
+    if (pos == size) {
+        new (array + size) T(std::forward<V>(elem));
+    } else {
+        // copy first, so the node is unchanged if copying the element throws
+        T copy(std::forward<V>(elem));
+        new (array + size) T(std::move(array[size - 1]));
+        std::move_backward(array + pos, array + size - 1, array + size);
+        array[pos] = std::move(copy);
+    }
+    ++nd->count_;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+template <typename V, typename... Args>
+void btree<T, N, Compare, Alloc, Mapped>::insert_elem(Node *nd, size_t pos, V&& elem, std::true_type, Args&&... value) {
+    // the value is made first, so the node is unchanged if that throws (values are moved without throwing)
+    Mapped_Slot held(std::forward<Args>(value)...);
+    insert_elem(nd, pos, std::forward<V>(elem), std::false_type());
+    auto vals = values(nd);
+    size_t size = nd->size() - 1;
+    if (pos == size) {
+        new (vals + size) Mapped_Slot(std::move(held));
+    } else {
+        new (vals + size) Mapped_Slot(std::move(vals[size - 1]));
+        std::move_backward(vals + pos, vals + size - 1, vals + size);
+        vals[pos] = std::move(held);
+    }
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+void btree<T, N, Compare, Alloc, Mapped>::erase_elem(Node *nd, size_t pos) {
+    auto array = elems(nd);
+    std::move(array + pos + 1, array + nd->size(), array + pos);
+    if (Has_Mapped) {
+        auto vals = values(nd);
+        std::move(vals + pos + 1, vals + nd->size(), vals + pos);
+    }
+    destroy_elem(nd, nd->size() - 1);
+    --nd->count_;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+void btree<T, N, Compare, Alloc, Mapped>::move_elems(Node *nd, size_t from, Node *dest) {
+    auto src = elems(nd), dst = elems(dest) + dest->size();
+    for (size_t i = from; i < nd->size(); ++i, ++dst)
+        new (dst) T(std::move(src[i]));
+    if (Has_Mapped) {
+        auto src_vals = values(nd), dst_vals = values(dest) + dest->size();
+        for (size_t i = from; i < nd->size(); ++i, ++dst_vals)
+            new (dst_vals) Mapped_Slot(std::move(src_vals[i]));
+    }
+    for (size_t i = from; i < nd->size(); ++i)
+        destroy_elem(nd, i);
+    dest->count_ += nd->count_ - from;
+    nd->count_ = from;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+typename btree<T, N, Compare, Alloc, Mapped>::Node* btree<T, N, Compare, Alloc, Mapped>::make_internal(Node **link) {
+    Node *nd = new_node(false);
+    move_elems(*link, 0, nd);
+    nd->total_ = (*link)->total_;
+    delete_node(*link);
+    *link = nd;
+    return nd;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+typename btree<T, N, Compare, Alloc, Mapped>::Node* btree<T, N, Compare, Alloc, Mapped>::first_node() const {
+    auto nd = root;
+    if (nd != nullptr)
+        while (child(nd, 0) != nullptr)
+            nd = child(nd, 0);
+    return nd;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+typename btree<T, N, Compare, Alloc, Mapped>::Node* btree<T, N, Compare, Alloc, Mapped>::last_node() const {
+    auto nd = root;
+    if (nd != nullptr)
+        while (child(nd, nd->size()) != nullptr)
+            nd = child(nd, nd->size());
+    return nd;
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+void btree<T, N, Compare, Alloc, Mapped>::next_location(Node*& nd, size_t& pos, Iter_Path& path) const {
+    BTREE_OP(btree_op::iterate);
+    // most steps are within a leaf
+    if (nd->leaf_ && pos + 1 < nd->size()) {
+        ++pos;
+        return;
+    }
+    // the next element is the first one of the sub-tree after this element, if there is one
+    if (auto nextChild = child(nd, pos + 1)) {
+        // the nodes on the way down become ancestors, and the node after the one reached (the next leaf
+        // in split mode) is fetched while its elements are read
+        Node *parent = nd;
+        size_t slot = pos + 1;
+        path.push(nd);
+        BTREE_COUNT(nodes, 1);
+        while (auto first = child(nextChild, 0)) {
+            path.push(nextChild);
+            parent = nextChild;
+            slot = 0;
+            nextChild = first;
+            BTREE_COUNT(nodes, 1);
+        }
+        if (slot < parent->size())
+            prefetch_node(child(parent, slot + 1));
+        nd = nextChild;
+        pos = 0;
+        return;
+    }
+    if (pos + 1 < nd->size()) {
+        ++pos;
+        return;
+    }
+    // end of a node: the next element is in an ancestor
+    climb_location(nd, pos, path, true);
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+void btree<T, N, Compare, Alloc, Mapped>::prev_location(Node*& nd, size_t& pos, Iter_Path& path) const {
+    BTREE_OP(btree_op::iterate);
+    // decrement from end() gives the last element, the nodes on the way down are its ancestors
+    if (nd == nullptr) {
+        path.forget();
+        if (root == nullptr)
+            return;
+        path.known = true;
+        nd = root;
+        while (auto last = child(nd, nd->size())) {
+            path.push(nd);
+            nd = last;
+        }
+        pos = nd->size() - 1;
+        return;
+    }
+    if (nd->leaf_ && pos > 0) {
+        --pos;
+        return;
+    }
+    // the previous element is the last one of the sub-tree before this element, if there is one
+    if (auto prevChild = child(nd, pos)) {
+        Node *parent = nd;
+        size_t slot = pos;
+        path.push(nd);
+        BTREE_COUNT(nodes, 1);
+        while (auto last = child(prevChild, prevChild->size())) {
+            path.push(prevChild);
+            parent = prevChild;
+            slot = prevChild->size();
+            prevChild = last;
+            BTREE_COUNT(nodes, 1);
+        }
+        if (slot > 0)
+            prefetch_node(child(parent, slot - 1));
+        nd = prevChild;
+        pos = prevChild->size() - 1;
+        return;
+    }
+    if (pos > 0) {
+        --pos;
+        return;
+    }
+    // start of a node: the previous element is in an ancestor
+    climb_location(nd, pos, path, false);
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc, typename Mapped>
+void btree<T, N, Compare, Alloc, Mapped>::climb_location(Node*& nd, size_t& pos, Iter_Path& path, bool forward) const {
+    if (path.known) {
+        // up to the first ancestor that has an element after (before) the child the path went through
+        while (path.depth > 0) {
+            Node *parent = path.pop();
+            size_t slot = child_slot(parent, nd);
+            BTREE_COUNT(nodes, 1);
+            if (forward ? slot < parent->size() : slot > 0) {
+                nd = parent;
+                pos = forward ? slot : slot - 1;
+                return;
+            }
+            nd = parent;
+        }
+        nd = nullptr;
+        pos = 0;
+        path.forget();
+        return;
+    }
+    // the path is not known: search from root for the current element, the nodes on the way are its
+    // ancestors, and the element sought is in the deepest of them that has one after (before) the way down
+    const T& elem = elems(nd)[pos];
+    Node *found = nullptr;
+    size_t found_pos = 0, found_level = 0, level = 0;
+    path.forget();
+    for (Node *current_node = root; current_node != nd && current_node != nullptr; ++level) {
+        size_t i = find_ele_location(current_node, elem).first;
+        if (forward ? i < current_node->size() : i > 0) {
+            found = current_node;
+            found_pos = forward ? i : i - 1;
+            found_level = level;
         }
-        current = (lower + upper) / 2;
+        path.push(current_node);
+        current_node = child(current_node, i);
     }
-    return std::make_pair(nd->Elems_list.begin() + current, find_flag);
+    nd = found;
+    pos = found_pos;
+    // the ancestors of the node found are the levels above it
+    path.known = found != nullptr;
+    path.depth = path.known ? found_level : 0;
+}
+
+// Set operations of two B-Trees in O(n + m): both sorted sequences are walked together once, listing the
+// elements kept (a pointer to each), and packed nodes are built bottom up from the list (see bulk_load) with
+// a copy of each element, with no descent for each element.
+// set_union: elements in 'a' or in 'b'; set_intersection: elements in both; set_difference: elements in 'a'
+// and not in 'b'. The result has the node size, insert mode, comparator and allocator of 'a'.
+// 'threads' above 1 splits the key range into that many parts at elements of the larger tree, which are
+// merged and built on as many threads (the comparator is then called from several threads at once). Trees too
+// small for that, allocators other than std::allocator and elements that opt out through btree_parallel_elems
+// are done on one thread, as for a copy.
+template <typename T, size_t N, typename Compare, typename Alloc>
+btree<T, N, Compare, Alloc, void> set_union(const btree<T, N, Compare, Alloc, void>& a,
+                                            const btree<T, N, Compare, Alloc, void>& b, size_t threads) {
+    typedef btree<T, N, Compare, Alloc, void> tree;
+    return tree::set_operation(a, b, tree::Set_Op::Union, threads);
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc>
+btree<T, N, Compare, Alloc, void> set_intersection(const btree<T, N, Compare, Alloc, void>& a,
+                                                   const btree<T, N, Compare, Alloc, void>& b, size_t threads) {
+    typedef btree<T, N, Compare, Alloc, void> tree;
+    return tree::set_operation(a, b, tree::Set_Op::Intersection, threads);
+}
+
+template <typename T, size_t N, typename Compare, typename Alloc>
+btree<T, N, Compare, Alloc, void> set_difference(const btree<T, N, Compare, Alloc, void>& a,
+                                                 const btree<T, N, Compare, Alloc, void>& b, size_t threads) {
+    typedef btree<T, N, Compare, Alloc, void> tree;
+    return tree::set_operation(a, b, tree::Set_Op::Difference, threads);
 }
 
 #endif
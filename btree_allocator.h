@@ -0,0 +1,129 @@
+#ifndef BTREE_ALLOCATOR_H
+#define BTREE_ALLOCATOR_H
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Arena that hands out memory from large blocks
+// Freed chunks are kept in a free list per chunk size and reused, memory goes back to the system
+// only when the arena is released or destroyed. Not thread-safe.
+class btree_arena {
+public:
+    // argument 'blockSize' is number of bytes requested from the system at a time
+    explicit btree_arena(size_t blockSize = 1 << 16) : Block_Size(blockSize), cur_(nullptr), left_(0) {}
+    btree_arena(const btree_arena&) = delete;
+    btree_arena& operator=(const btree_arena&) = delete;
+    ~btree_arena() { release(); }
+
+    // get a chunk of 'bytes' bytes, aligned for any fundamental type
+    void* allocate(size_t bytes) {
+        bytes = round_up(bytes);
+        for (auto& list : free_lists_) {
+            if (list.first == bytes && list.second != nullptr) {
+                auto chunk = list.second;
+                list.second = *static_cast<void**>(chunk);
+                return chunk;
+            }
+        }
+        if (bytes > left_) {
+            // a chunk bigger than a block gets a block of its own
+            size_t size = std::max(bytes, Block_Size);
+            blocks_.push_back(::operator new(size));
+            cur_ = static_cast<char*>(blocks_.back());
+            left_ = size;
+        }
+        auto chunk = cur_;
+        cur_ += bytes;
+        left_ -= bytes;
+        return chunk;
+    }
+    // give back a chunk, it is reused by the next allocation of the same size
+    void deallocate(void *chunk, size_t bytes) {
+        bytes = round_up(bytes);
+        auto list = std::find_if(free_lists_.begin(), free_lists_.end(),
+                                 [bytes] (const std::pair<size_t, void*>& l) { return l.first == bytes; });
+        if (list == free_lists_.end()) {
+            free_lists_.push_back(std::make_pair(bytes, nullptr));
+            list = free_lists_.end() - 1;
+        }
+        *static_cast<void**>(chunk) = list->second;
+        list->second = chunk;
+    }
+    // free every block at once, all chunks handed out before become invalid
+    void release() {
+        for (auto block : blocks_)
+            ::operator delete(block);
+        blocks_.clear();
+        free_lists_.clear();
+        cur_ = nullptr;
+        left_ = 0;
+    }
+    // number of blocks requested from the system
+    size_t blocks() const { return blocks_.size(); }
+    size_t block_size() const { return Block_Size; }
+private:
+    // chunks are multiples of the fundamental alignment, so every chunk stays aligned
+    static size_t round_up(size_t bytes) {
+        const size_t align = alignof(std::max_align_t);
+        bytes = std::max(bytes, sizeof(void*));
+        return (bytes + align - 1) & ~(align - 1);
+    }
+
+    size_t Block_Size;
+    std::vector<void*> blocks_;
+    // pairs of chunk size and head of the free list (a freed chunk stores the next free chunk)
+    std::vector<std::pair<size_t, void*>> free_lists_;
+    // unused part of the newest block
+    char *cur_;
+    size_t left_;
+};
+
+// Standard allocator that allocates from a shared btree_arena
+// Copies (and rebound copies) of an allocator share its arena. A container copy gets a new arena, so
+// a btree owns its arena and can drop all of its nodes at once with release_if_unique().
+template <typename T> class btree_arena_allocator {
+public:
+    template <typename U> friend class btree_arena_allocator;
+
+    typedef T value_type;
+    typedef std::false_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    explicit btree_arena_allocator(size_t blockSize = 1 << 16) : arena_(std::make_shared<btree_arena>(blockSize)) {}
+    // moving an allocator copies it, so a moved-from container can still allocate
+    btree_arena_allocator(const btree_arena_allocator& other) = default;
+    btree_arena_allocator& operator=(const btree_arena_allocator& other) = default;
+    template <typename U>
+    btree_arena_allocator(const btree_arena_allocator<U>& other) : arena_(other.arena_) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(arena_->allocate(n * sizeof(T))); }
+    void deallocate(T *p, size_t n) { arena_->deallocate(p, n * sizeof(T)); }
+
+    // copy of a container gets its own arena
+    btree_arena_allocator select_on_container_copy_construction() const {
+        return btree_arena_allocator(arena_->block_size());
+    }
+    // free all memory of the arena if no other allocator uses it
+    // @Return: true if the memory was freed (everything allocated through this allocator is gone)
+    bool release_if_unique() {
+        if (arena_.use_count() != 1)
+            return false;
+        arena_->release();
+        return true;
+    }
+    const btree_arena& arena() const { return *arena_; }
+
+    template <typename U>
+    bool operator==(const btree_arena_allocator<U>& other) const { return arena_ == other.arena_; }
+    template <typename U>
+    bool operator!=(const btree_arena_allocator<U>& other) const { return arena_ != other.arena_; }
+private:
+    std::shared_ptr<btree_arena> arena_;
+};
+
+#endif
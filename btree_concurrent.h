@@ -0,0 +1,418 @@
+#ifndef BTREE_CONCURRENT_H
+#define BTREE_CONCURRENT_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "btree.h"
+
+// B-Tree that many threads can use at the same time, with optimistic lock coupling
+// Every node has a version word. Readers ('contains', 'scan') take no locks: they note the version of
+// each node before reading it and check afterwards that it has not changed, and start again from root
+// if it has. Writers ('insert', 'erase') descend the same way and lock only the nodes that they change:
+// the leaf, and the parent as well when a full node is split. Full nodes are split on the way down, so
+// a split never has to go back up the tree.
+// The elements are stored in the leaves, the internal nodes hold copies of elements that separate the
+// sub-trees. Nodes are never merged or freed while the tree exists (erase leaves a leaf with fewer
+// elements), so a reader can always follow a pointer that it has read, even one that is out of date.
+// Elements are read while writers may change them, so each one is a std::atomic<T>, which is lock-free
+// for trivially copyable types of up to 8 bytes.
+// template argument N is the maximum number of elements of each node
+template <typename T, size_t N = btree_default_node_elems<T>()> class concurrent_btree {
+public:
+    static_assert(std::is_trivially_copyable<T>::value && sizeof(T) <= 8 && (sizeof(T) & (sizeof(T) - 1)) == 0,
+                  "elements must be trivially copyable and of size 1, 2, 4 or 8 bytes");
+    static_assert(N >= 3, "a node must hold at least 3 elements");
+
+    typedef T value_type;
+
+    concurrent_btree() : root_(new Leaf()), size_(0) {}
+    concurrent_btree(const concurrent_btree&) = delete;
+    concurrent_btree& operator=(const concurrent_btree&) = delete;
+    // not thread-safe: no other thread may use the tree any more
+    ~concurrent_btree();
+
+    // Insert an element
+    // @Return: true if it was inserted, false if it was in the tree already
+    bool insert(const T& elem);
+    // Erase an element
+    // @Return: true if it was erased, false if it was not in the tree
+    bool erase(const T& elem);
+    // true if 'elem' is in the tree
+    bool contains(const T& elem) const;
+    // Call 'f(elem)' on each element in [lo, hi), in order
+    // Each leaf is read as it was at one moment, the leaves are read one after the other: an element that
+    // is in the tree during the whole scan is visited once, an element inserted or erased during the scan
+    // may or may not be.
+    // @Return: number of elements visited
+    template <typename F>
+    size_t scan(const T& lo, const T& hi, F f) const;
+    // number of elements (exact when no writer is running)
+    size_t size() const { return size_.load(std::memory_order_relaxed); }
+
+private:
+    // version word: bit 0 is set while a writer holds the node, the rest counts the changes
+    static const uint64_t Locked = 1, Step = 2;
+
+    struct Node {
+        explicit Node(bool leaf) : version(0), count(0), leaf(leaf) {}
+        std::atomic<uint64_t> version;
+        std::atomic<unsigned> count;
+        const bool leaf;
+        std::atomic<T> elems[N];
+    };
+    struct Leaf : Node {
+        Leaf() : Node(true) {}
+    };
+    // child i holds the elements less than elems[i] and not less than elems[i - 1]
+    struct Inner : Node {
+        Inner() : Node(false) {
+            for (auto& child : children)
+                child.store(nullptr, std::memory_order_relaxed);
+        }
+        std::atomic<Node*> children[N + 1];
+    };
+
+    // Version helpers
+    // version of the node if no writer holds it, otherwise 'ok' is set to false
+    static uint64_t read_lock(const Node *nd, bool& ok) {
+        uint64_t version = nd->version.load(std::memory_order_acquire);
+        if (version & Locked)
+            ok = false;
+        return version;
+    }
+    // check that the node has not changed since 'version' was read, so what was read from it is valid
+    static bool validate(const Node *nd, uint64_t version) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return nd->version.load(std::memory_order_relaxed) == version;
+    }
+    // lock the node if it has not changed since 'version' was read
+    static bool upgrade(Node *nd, uint64_t version) {
+        if (!nd->version.compare_exchange_strong(version, version + Locked, std::memory_order_acquire))
+            return false;
+        // the stores after the lock must not be seen before it
+        std::atomic_thread_fence(std::memory_order_release);
+        return true;
+    }
+    static void unlock(Node *nd) { nd->version.fetch_add(Step - Locked, std::memory_order_release); }
+    // check that 'nd', whose version was just read, is still the root: a root split in between would
+    // leave it the left half of the tree with a version that says nothing changed
+    bool still_root(const Node *nd) const { return root_.load(std::memory_order_acquire) == nd; }
+
+    // Node helpers
+    // number of elements, a reader may see a count from the middle of a change, so it is capped
+    static size_t count(const Node *nd) {
+        size_t size = nd->count.load(std::memory_order_relaxed);
+        return size < N ? size : N;
+    }
+    static T elem(const Node *nd, size_t i) { return nd->elems[i].load(std::memory_order_relaxed); }
+    static void set_elem(Node *nd, size_t i, const T& value) { nd->elems[i].store(value, std::memory_order_relaxed); }
+    // a child pointer is stored with release and loaded with acquire, so a reader that reaches a node a split
+    // has just linked in sees it constructed before it reads its version
+    static Node* child(const Node *nd, size_t i) {
+        return static_cast<const Inner*>(nd)->children[i].load(std::memory_order_acquire);
+    }
+    static void set_child(Node *nd, size_t i, Node *c) { static_cast<Inner*>(nd)->children[i].store(c, std::memory_order_release); }
+    // location of the first element not less than 'value' (for a leaf), or child that holds 'value'
+    // (for an internal node: the number of elements not greater than it)
+    static size_t lower_bound(const Node *nd, const T& value);
+    static size_t child_index(const Node *nd, const T& value);
+    // split the full node 'nd' (locked) into itself and a new right node, and add the separator to the
+    // locked parent, or to a new root if 'parent' is nullptr
+    void split(Node *nd, Node *parent);
+    // descend to the leaf for 'value', splitting full nodes on the way down
+    // @Return: the leaf with its version (checked, but not locked), or nullptr to start again
+    Node* find_leaf_for_write(const T& value, uint64_t& version);
+
+    std::atomic<Node*> root_;
+    std::atomic<size_t> size_;
+};
+
+template <typename T, size_t N>
+concurrent_btree<T, N>::~concurrent_btree() {
+    std::vector<Node*> stack{root_.load()};
+    while (!stack.empty()) {
+        Node *nd = stack.back();
+        stack.pop_back();
+        if (nd->leaf) {
+            delete static_cast<Leaf*>(nd);
+            continue;
+        }
+        for (size_t i = 0; i <= count(nd); ++i)
+            stack.push_back(child(nd, i));
+        delete static_cast<Inner*>(nd);
+    }
+}
+
+// both searches halve the range without branching on the comparison, as btree_narrow does
+template <typename T, size_t N>
+size_t concurrent_btree<T, N>::lower_bound(const Node *nd, const T& value) {
+    size_t first = 0, size = count(nd);
+    if (size == 0)
+        return 0;
+    while (size > 1) {
+        size_t half = size / 2;
+        first = elem(nd, first + half - 1) < value ? first + half : first;
+        size -= half;
+    }
+    return first + (elem(nd, first) < value);
+}
+
+template <typename T, size_t N>
+size_t concurrent_btree<T, N>::child_index(const Node *nd, const T& value) {
+    size_t first = 0, size = count(nd);
+    if (size == 0)
+        return 0;
+    while (size > 1) {
+        size_t half = size / 2;
+        first = value < elem(nd, first + half - 1) ? first : first + half;
+        size -= half;
+    }
+    return first + !(value < elem(nd, first));
+}
+
+template <typename T, size_t N>
+bool concurrent_btree<T, N>::contains(const T& elem_value) const {
+    while (true) {
+        bool ok = true;
+        const Node *nd = root_.load(std::memory_order_acquire);
+        uint64_t version = read_lock(nd, ok);
+        if (!ok || !still_root(nd))
+            continue;
+        while (ok && !nd->leaf) {
+            const Node *next = child(nd, child_index(nd, elem_value));
+            if (next == nullptr) {
+                ok = false;
+                break;
+            }
+            // the child's version is read before the parent is checked: a split of the child after that
+            // changes its version, one before it changes the parent's
+            uint64_t next_version = read_lock(next, ok);
+            if (!ok || !validate(nd, version)) {
+                ok = false;
+                break;
+            }
+            nd = next;
+            version = next_version;
+        }
+        if (!ok)
+            continue;
+        size_t pos = lower_bound(nd, elem_value);
+        bool found = pos < count(nd) && !(elem_value < elem(nd, pos));
+        if (validate(nd, version))
+            return found;
+    }
+}
+
+template <typename T, size_t N>
+template <typename F>
+size_t concurrent_btree<T, N>::scan(const T& lo, const T& hi, F f) const {
+    size_t visited = 0;
+    // the elements of each leaf are copied out and checked before 'f' sees them
+    T buffer[N];
+    T from = lo;
+    if (!(lo < hi))
+        return 0;
+    while (true) {
+        bool ok = true, bounded = false;
+        // the separator after the leaf: where the next leaf starts
+        T upper = from;
+        const Node *nd = root_.load(std::memory_order_acquire);
+        uint64_t version = read_lock(nd, ok);
+        if (!ok || !still_root(nd))
+            continue;
+        while (ok && !nd->leaf) {
+            size_t i = child_index(nd, from);
+            const Node *next = child(nd, i);
+            bool has_upper = i < count(nd);
+            T separator = has_upper ? elem(nd, i) : from;
+            if (next == nullptr) {
+                ok = false;
+                break;
+            }
+            // as in 'contains', the child's version is read before the parent (and so the separator) is checked
+            uint64_t next_version = read_lock(next, ok);
+            if (!ok || !validate(nd, version)) {
+                ok = false;
+                break;
+            }
+            if (has_upper) {
+                upper = separator;
+                bounded = true;
+            }
+            nd = next;
+            version = next_version;
+        }
+        if (!ok)
+            continue;
+        size_t copied = 0;
+        for (size_t i = lower_bound(nd, from), size = count(nd); i < size; ++i) {
+            T value = elem(nd, i);
+            if (!(value < hi))
+                break;
+            buffer[copied++] = value;
+        }
+        if (!validate(nd, version))
+            continue;
+        for (size_t i = 0; i < copied; ++i)
+            f(static_cast<const T&>(buffer[i]));
+        visited += copied;
+        // go on with the next leaf, unless this was the last one or the range ends before it
+        if (!bounded || !(upper < hi))
+            return visited;
+        from = upper;
+    }
+}
+
+template <typename T, size_t N>
+void concurrent_btree<T, N>::split(Node *nd, Node *parent) {
+    size_t size = count(nd), mid = size / 2;
+    Node *right;
+    T separator;
+    if (nd->leaf) {
+        // the right leaf gets the upper half, its first element is copied up
+        right = new Leaf();
+        for (size_t i = mid; i < size; ++i)
+            set_elem(right, i - mid, elem(nd, i));
+        right->count.store(size - mid, std::memory_order_relaxed);
+        separator = elem(nd, mid);
+        nd->count.store(mid, std::memory_order_relaxed);
+    } else {
+        // the middle element moves up, the elements and children after it go to the right node
+        right = new Inner();
+        for (size_t i = mid + 1; i < size; ++i)
+            set_elem(right, i - mid - 1, elem(nd, i));
+        for (size_t i = mid + 1; i <= size; ++i)
+            set_child(right, i - mid - 1, child(nd, i));
+        right->count.store(size - mid - 1, std::memory_order_relaxed);
+        separator = elem(nd, mid);
+        nd->count.store(mid, std::memory_order_relaxed);
+    }
+    if (parent == nullptr) {
+        // a new root above the two halves, published after it is complete
+        Inner *new_root = new Inner();
+        set_elem(new_root, 0, separator);
+        set_child(new_root, 0, nd);
+        set_child(new_root, 1, right);
+        new_root->count.store(1, std::memory_order_relaxed);
+        root_.store(new_root, std::memory_order_release);
+        return;
+    }
+    // the parent is not full (full nodes are split before they are descended through)
+    size_t parent_size = count(parent), pos = child_index(parent, separator);
+    for (size_t i = parent_size; i > pos; --i) {
+        set_elem(parent, i, elem(parent, i - 1));
+        set_child(parent, i + 1, child(parent, i));
+    }
+    set_elem(parent, pos, separator);
+    set_child(parent, pos + 1, right);
+    parent->count.store(parent_size + 1, std::memory_order_relaxed);
+}
+
+template <typename T, size_t N>
+typename concurrent_btree<T, N>::Node* concurrent_btree<T, N>::find_leaf_for_write(const T& value, uint64_t& version) {
+    bool ok = true;
+    Node *parent = nullptr, *nd = root_.load(std::memory_order_acquire);
+    uint64_t parent_version = 0;
+    version = read_lock(nd, ok);
+    if (!ok || !still_root(nd))
+        return nullptr;
+    while (true) {
+        if (count(nd) == N) {
+            // full: lock the parent and the node, split and start again
+            if (parent != nullptr && !upgrade(parent, parent_version))
+                return nullptr;
+            if (!upgrade(nd, version)) {
+                if (parent != nullptr)
+                    unlock(parent);
+                return nullptr;
+            }
+            // without a parent the node must still be the root
+            if (parent == nullptr && root_.load(std::memory_order_relaxed) != nd) {
+                unlock(nd);
+                return nullptr;
+            }
+            split(nd, parent);
+            unlock(nd);
+            if (parent != nullptr)
+                unlock(parent);
+            return nullptr;
+        }
+        if (nd->leaf)
+            break;
+        // lock coupling: the parent is released once the child is known to be the right one
+        if (parent != nullptr && !validate(parent, parent_version))
+            return nullptr;
+        parent = nd;
+        parent_version = version;
+        nd = child(parent, child_index(parent, value));
+        if (nd == nullptr || !validate(parent, parent_version))
+            return nullptr;
+        version = read_lock(nd, ok);
+        if (!ok)
+            return nullptr;
+    }
+    if (parent != nullptr && !validate(parent, parent_version))
+        return nullptr;
+    return nd;
+}
+
+template <typename T, size_t N>
+bool concurrent_btree<T, N>::insert(const T& value) {
+    while (true) {
+        uint64_t version;
+        Node *leaf = find_leaf_for_write(value, version);
+        if (leaf == nullptr)
+            continue;
+        size_t pos = lower_bound(leaf, value);
+        bool found = pos < count(leaf) && !(value < elem(leaf, pos));
+        if (found) {
+            if (validate(leaf, version))
+                return false;
+            continue;
+        }
+        if (!upgrade(leaf, version))
+            continue;
+        // locked and unchanged since the search, so 'pos' is right and the leaf is not full
+        size_t size = count(leaf);
+        for (size_t i = size; i > pos; --i)
+            set_elem(leaf, i, elem(leaf, i - 1));
+        set_elem(leaf, pos, value);
+        leaf->count.store(size + 1, std::memory_order_relaxed);
+        unlock(leaf);
+        size_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+}
+
+template <typename T, size_t N>
+bool concurrent_btree<T, N>::erase(const T& value) {
+    while (true) {
+        uint64_t version;
+        Node *leaf = find_leaf_for_write(value, version);
+        if (leaf == nullptr)
+            continue;
+        size_t pos = lower_bound(leaf, value);
+        bool found = pos < count(leaf) && !(value < elem(leaf, pos));
+        if (!found) {
+            if (validate(leaf, version))
+                return false;
+            continue;
+        }
+        if (!upgrade(leaf, version))
+            continue;
+        size_t size = count(leaf);
+        for (size_t i = pos + 1; i < size; ++i)
+            set_elem(leaf, i - 1, elem(leaf, i));
+        leaf->count.store(size - 1, std::memory_order_relaxed);
+        unlock(leaf);
+        size_.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+}
+
+#endif
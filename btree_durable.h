@@ -0,0 +1,330 @@
+#ifndef BTREE_DURABLE_H
+#define BTREE_DURABLE_H
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "btree.h"
+
+// How elements are written to the log of a durable_btree: trivially copyable elements as their bytes,
+// std::string as its characters (a record knows its own length)
+template <typename T, typename Enable = void>
+struct btree_log_codec {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "only trivially copyable elements and std::string can be logged");
+    static void encode(const T& elem, std::string& out) { out.append(reinterpret_cast<const char*>(&elem), sizeof(T)); }
+    // @Return: false if the bytes are not an element
+    static bool decode(const char *bytes, size_t size, T& elem) {
+        if (size != sizeof(T))
+            return false;
+        std::memcpy(static_cast<void*>(&elem), bytes, sizeof(T));
+        return true;
+    }
+};
+
+template <>
+struct btree_log_codec<std::string> {
+    static void encode(const std::string& elem, std::string& out) { out.append(elem); }
+    static bool decode(const char *bytes, size_t size, std::string& elem) {
+        elem.assign(bytes, size);
+        return true;
+    }
+};
+
+// B-Tree whose changes survive a crash (POSIX only)
+// Every insert and erase that changes the tree is appended to a write-ahead log '<path>.log', and returns once
+// the log is on disk. Callers on several threads share the syncs (group commit): while one thread writes and
+// syncs the log, the others add their records to a buffer, and the next sync takes all of them, so under load
+// a sync costs each insert a fraction of its time. checkpoint() writes the tree as an image '<path>.img' (see
+// btree::save) and empties the log. When the tree is opened, the image is loaded and the log replayed on top
+// of it; a record cut short by a crash is dropped along with anything after it.
+// Replaying an insert or erase twice has the same result as once, so a crash at any point of a checkpoint
+// leaves an image and a log that give back the tree.
+// A change is seen by other threads as soon as it is made, before it is on disk (like a database that reads
+// uncommitted data of a transaction that has ended, but not yet synced).
+template <typename T, size_t N = 0, typename Alloc = std::allocator<T>> class durable_btree {
+public:
+    typedef btree<T, N, std::less<T>, Alloc> tree_type;
+
+    // Open the tree stored under 'path', or start an empty one
+    // other arguments are those of the btree constructor
+    // throws std::system_error if the files cannot be read or written
+    explicit durable_btree(const std::string& path, size_t maxNodeElems = 40, bool splitNodes = true,
+                           const Alloc& alloc = Alloc());
+    durable_btree(const durable_btree&) = delete;
+    durable_btree& operator=(const durable_btree&) = delete;
+    ~durable_btree() { ::close(log_fd_); }
+
+    // Insert or erase an element, durably
+    // @Return: true if the tree was changed
+    // throws std::system_error if the log cannot be written, the tree is then changed but the change may be
+    // lost, and the calls after it throw as well
+    bool insert(const T& elem) { return apply(Insert, elem); }
+    bool erase(const T& elem) { return apply(Erase, elem); }
+
+    // Write the tree as an image and empty the log, writers wait until it is done
+    void checkpoint();
+
+    // Copy of the tree as it is now (O(1), see btree::snapshot), for lookups and iteration
+    tree_type snapshot() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return tree_.snapshot();
+    }
+    bool contains(const T& elem) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return tree_.find(elem) != tree_.end();
+    }
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return tree_.size();
+    }
+    // number of log records replayed when the tree was opened
+    size_t recovered() const { return recovered_; }
+    // number of times the log was synced, each sync commits all the records written before it
+    size_t syncs() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return syncs_;
+    }
+
+private:
+    // Log record: payload length (4 bytes), operation (1 byte), element, checksum of operation and element (4 bytes)
+    enum Operation : char { Insert = 'I', Erase = 'E' };
+    static const size_t Record_Header = 5, Record_Trailer = 4;
+
+    // change the tree, log the change and wait until it is on disk
+    bool apply(Operation op, const T& elem);
+    // wait until the records up to number 'record' are on disk, syncing them if no other thread is
+    void commit(std::unique_lock<std::mutex>& lock, uint64_t record);
+    // load the image, replay the log and cut off a broken tail
+    void recover();
+    // FNV-1a hash of the bytes
+    static uint32_t checksum(const char *bytes, size_t size);
+    // write all of 'bytes' to 'fd' and sync it
+    // @Return: 0, or the errno of the call that failed
+    static int write_and_sync(int fd, const std::string& bytes);
+    static int sync(int fd) {
+#ifdef __APPLE__
+        return ::fsync(fd) == 0 ? 0 : errno;
+#else
+        return ::fdatasync(fd) == 0 ? 0 : errno;
+#endif
+    }
+    // sync the directory that holds 'path', so that a file created or renamed there is durable (a file
+    // system that cannot open a directory for it is left as it is)
+    static void sync_dir(const std::string& path) {
+        size_t slash = path.rfind('/');
+        std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+        int dir_fd = ::open(dir.c_str(), O_RDONLY);
+        if (dir_fd >= 0) {
+            ::fsync(dir_fd);
+            ::close(dir_fd);
+        }
+    }
+    // throw the error that stopped the log
+    void check_error() const {
+        if (error_ != 0)
+            throw std::system_error(error_, std::generic_category(), "write " + log_path_);
+    }
+
+    std::string image_path_, log_path_;
+    int log_fd_;
+    // guards everything below, and the tree
+    mutable std::mutex mutex_;
+    // signalled when a sync ends
+    std::condition_variable synced_;
+    tree_type tree_;
+    // records that are not written to the log yet
+    std::string pending_;
+    // number of records made, and number of them that are on disk
+    uint64_t records_, durable_;
+    // true while a thread writes and syncs the log (without holding the lock)
+    bool syncing_;
+    int error_;
+    size_t syncs_, recovered_;
+};
+
+template <typename T, size_t N, typename Alloc>
+durable_btree<T, N, Alloc>::durable_btree(const std::string& path, size_t maxNodeElems, bool splitNodes,
+                                          const Alloc& alloc)
+        : image_path_(path + ".img"), log_path_(path + ".log"), log_fd_(-1), tree_(maxNodeElems, splitNodes, alloc),
+          records_(0), durable_(0), syncing_(false), error_(0), syncs_(0), recovered_(0) {
+    recover();
+    // a new log is durable, and so are the records written to it, once its directory is synced
+    log_fd_ = ::open(log_path_.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_EXCL, 0644);
+    if (log_fd_ >= 0)
+        sync_dir(log_path_);
+    else if (errno == EEXIST)
+        log_fd_ = ::open(log_path_.c_str(), O_WRONLY | O_APPEND);
+    if (log_fd_ < 0)
+        throw std::system_error(errno, std::generic_category(), "open " + log_path_);
+}
+
+template <typename T, size_t N, typename Alloc>
+void durable_btree<T, N, Alloc>::recover() {
+    // the image of the last checkpoint, if there was one
+    struct stat info;
+    if (::stat(image_path_.c_str(), &info) == 0) {
+        btree_mapped<T> image(image_path_);
+        std::vector<T> elems;
+        elems.reserve(image.size());
+        for (auto it = image.begin(); it != image.end(); ++it)
+            elems.push_back(btree_mapped_traits<T>::element(*it));
+        tree_.bulk_load(std::make_move_iterator(elems.begin()), std::make_move_iterator(elems.end()));
+    }
+    // replay the log up to the first record that is cut short or does not match its checksum
+    std::ifstream file(log_path_, std::ios::binary);
+    if (!file)
+        return;
+    std::string log((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    size_t offset = 0;
+    T elem;
+    while (log.size() - offset >= Record_Header + Record_Trailer) {
+        uint32_t length, sum;
+        std::memcpy(&length, log.data() + offset, sizeof(length));
+        if (length > log.size() - offset - Record_Header - Record_Trailer)
+            break;
+        const char *body = log.data() + offset + sizeof(length);
+        std::memcpy(&sum, body + 1 + length, sizeof(sum));
+        if (sum != checksum(body, 1 + length) || (body[0] != Insert && body[0] != Erase) ||
+            !btree_log_codec<T>::decode(body + 1, length, elem))
+            break;
+        if (body[0] == Insert)
+            tree_.insert(elem);
+        else
+            tree_.erase(elem);
+        ++recovered_;
+        offset += Record_Header + length + Record_Trailer;
+    }
+    // new records go after the last good one
+    if (offset < log.size() && ::truncate(log_path_.c_str(), offset) != 0)
+        throw std::system_error(errno, std::generic_category(), "truncate " + log_path_);
+}
+
+template <typename T, size_t N, typename Alloc>
+bool durable_btree<T, N, Alloc>::apply(Operation op, const T& elem) {
+    // the record is made first, so that an element that cannot be logged leaves the tree as it was
+    // (the length goes in front of the operation once the element is encoded)
+    uint32_t length = 0;
+    std::string record(reinterpret_cast<const char*>(&length), sizeof(length));
+    record.push_back(op);
+    btree_log_codec<T>::encode(elem, record);
+    if (record.size() - Record_Header > UINT32_MAX)
+        throw std::length_error("element too long for the log");
+    length = static_cast<uint32_t>(record.size() - Record_Header);
+    std::memcpy(&record[0], &length, sizeof(length));
+    uint32_t sum = checksum(record.data() + sizeof(length), 1 + length);
+    record.append(reinterpret_cast<const char*>(&sum), sizeof(sum));
+    std::unique_lock<std::mutex> lock(mutex_);
+    check_error();
+    // room for the record is made before the change too, appending it then does not throw
+    pending_.reserve(pending_.size() + record.size());
+    bool changed = op == Insert ? tree_.insert(elem).second : tree_.erase(elem) == 1;
+    if (changed) {
+        pending_.append(record);
+        ++records_;
+    }
+    // an unchanged tree may still hold a change of another thread that is not on disk yet
+    commit(lock, records_);
+    return changed;
+}
+
+template <typename T, size_t N, typename Alloc>
+void durable_btree<T, N, Alloc>::commit(std::unique_lock<std::mutex>& lock, uint64_t record) {
+    while (durable_ < record) {
+        check_error();
+        if (syncing_) {
+            synced_.wait(lock);
+            continue;
+        }
+        // lead a group: write all records made so far, the threads that come meanwhile form the next group
+        syncing_ = true;
+        std::string group;
+        group.swap(pending_);
+        uint64_t last = records_;
+        lock.unlock();
+        int error = write_and_sync(log_fd_, group);
+        lock.lock();
+        syncing_ = false;
+        if (error != 0)
+            error_ = error;
+        else
+            durable_ = last;
+        ++syncs_;
+        synced_.notify_all();
+    }
+}
+
+template <typename T, size_t N, typename Alloc>
+void durable_btree<T, N, Alloc>::checkpoint() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    check_error();
+    while (syncing_)
+        synced_.wait(lock);
+    // the image is written to a new file and renamed over the old one, so there is always a whole image
+    std::string temp_path = image_path_ + ".tmp";
+    tree_.save(temp_path);
+    int error = 0;
+    int fd = ::open(temp_path.c_str(), O_RDONLY);
+    if (fd < 0 || ::fsync(fd) != 0)
+        error = errno;
+    if (fd >= 0)
+        ::close(fd);
+    if (error == 0 && ::rename(temp_path.c_str(), image_path_.c_str()) != 0)
+        error = errno;
+    // the rename is durable once the directory is synced
+    if (error == 0)
+        sync_dir(image_path_);
+    // the image holds every change, written to the log or not
+    if (error == 0 && ::ftruncate(log_fd_, 0) != 0)
+        error = errno;
+    if (error == 0)
+        error = sync(log_fd_);
+    if (error != 0)
+        throw std::system_error(error, std::generic_category(), "checkpoint " + image_path_);
+    pending_.clear();
+    durable_ = records_;
+    synced_.notify_all();
+}
+
+template <typename T, size_t N, typename Alloc>
+uint32_t durable_btree<T, N, Alloc>::checksum(const char *bytes, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= static_cast<unsigned char>(bytes[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+template <typename T, size_t N, typename Alloc>
+int durable_btree<T, N, Alloc>::write_and_sync(int fd, const std::string& bytes) {
+    size_t written = 0;
+    while (written < bytes.size()) {
+        ssize_t n = ::write(fd, bytes.data() + written, bytes.size() - written);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        written += static_cast<size_t>(n);
+    }
+    return sync(fd);
+}
+
+#endif
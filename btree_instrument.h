@@ -0,0 +1,188 @@
+#ifndef BTREE_INSTRUMENT_H
+#define BTREE_INSTRUMENT_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Instrumentation of the B-Tree operations
+// Compiled in if BTREE_INSTRUMENT is defined before btree.h is included (e.g. -DBTREE_INSTRUMENT), then each
+// find, insert (and emplace), step of an iterator and copy of a tree records the element comparisons, nodes
+// visited and nodes allocated that it took, and its latency. Without the flag the hooks in the tree are empty
+// macros and the operations are compiled as if they were not there. Every translation unit of a program must
+// be built with the same setting, the members of btree are not the same otherwise.
+// The records are kept per thread (so recording takes no locks), btree_instrument::stats(op) reads those of
+// the calling thread; records of several threads can be added with '+='. An operation run from inside another
+// one (like the copies of the elements of a copied btree of btrees) counts in the outer one only.
+
+// the instrumented operations
+enum class btree_op { find, insert, iterate, copy };
+
+// counters that the tree raises as it works, per thread
+struct btree_counts {
+    uint64_t comparisons = 0;
+    uint64_t nodes = 0;
+    uint64_t allocations = 0;
+};
+
+// records of one operation
+struct btree_op_stats {
+    // number of calls, and the comparisons, node visits and node allocations of all of them
+    uint64_t calls = 0;
+    uint64_t comparisons = 0;
+    uint64_t nodes = 0;
+    uint64_t allocations = 0;
+    // latency histogram in nanoseconds: values below 8 have a bucket each, then each power of two is split
+    // into 8 buckets, so a percentile is within 1/8 of the latency it stands for
+    static const size_t Sub_Buckets = 8;
+    static const size_t Buckets = Sub_Buckets + 61 * Sub_Buckets;
+    std::array<uint64_t, Buckets> latency{};
+
+    void record(uint64_t ns) {
+        ++calls;
+        ++latency[bucket(ns)];
+    }
+    // latency in nanoseconds that fraction 'q' of the calls took at most (the upper end of the bucket
+    // that holds that call), 0 if there are no calls; e.g. percentile(0.99) is p99
+    uint64_t percentile(double q) const {
+        uint64_t rank = static_cast<uint64_t>(q * calls + 0.5), seen = 0;
+        if (rank == 0)
+            rank = 1;
+        for (size_t b = 0; b < Buckets; ++b) {
+            seen += latency[b];
+            if (seen >= rank)
+                return upper(b);
+        }
+        return 0;
+    }
+    btree_op_stats& operator+=(const btree_op_stats& other) {
+        calls += other.calls;
+        comparisons += other.comparisons;
+        nodes += other.nodes;
+        allocations += other.allocations;
+        for (size_t b = 0; b < Buckets; ++b)
+            latency[b] += other.latency[b];
+        return *this;
+    }
+
+private:
+    static size_t bucket(uint64_t ns) {
+        if (ns < Sub_Buckets)
+            return static_cast<size_t>(ns);
+        size_t exp = 63 - static_cast<size_t>(__builtin_clzll(ns));
+        return Sub_Buckets * (exp - 2) + static_cast<size_t>((ns >> (exp - 3)) & (Sub_Buckets - 1));
+    }
+    static uint64_t upper(size_t b) {
+        if (b < Sub_Buckets)
+            return b;
+        size_t exp = b / Sub_Buckets + 2;
+        uint64_t low = static_cast<uint64_t>(Sub_Buckets + b % Sub_Buckets) << (exp - 3);
+        return low + (uint64_t(1) << (exp - 3)) - 1;
+    }
+};
+
+class btree_instrument {
+public:
+#ifdef BTREE_INSTRUMENT
+    static const bool enabled = true;
+#else
+    static const bool enabled = false;
+#endif
+    // records of operation 'op' on the calling thread (all 0 without BTREE_INSTRUMENT)
+    static btree_op_stats& stats(btree_op op) { return records()[static_cast<size_t>(op)]; }
+    // clear the records of the calling thread
+    static void reset() {
+        for (auto& op : records())
+            op = btree_op_stats();
+    }
+    // counters of the calling thread, the operations record the difference between their start and end
+    static btree_counts& counts() {
+        static thread_local btree_counts counts;
+        return counts;
+    }
+
+private:
+    friend class btree_op_scope;
+    static std::array<btree_op_stats, 4>& records() {
+        static thread_local std::array<btree_op_stats, 4> records;
+        return records;
+    }
+    // number of operations running on the calling thread, only the outermost one records
+    static size_t& depth() {
+        static thread_local size_t depth = 0;
+        return depth;
+    }
+};
+
+// Records one operation: made at its start, records it when it goes out of scope (an operation that
+// throws is recorded too)
+class btree_op_scope {
+public:
+    explicit btree_op_scope(btree_op op)
+            : op_(op), outer_(btree_instrument::depth()++ == 0), start_counts_(btree_instrument::counts()),
+              start_(std::chrono::steady_clock::now()) {}
+    btree_op_scope(const btree_op_scope&) = delete;
+    btree_op_scope& operator=(const btree_op_scope&) = delete;
+    ~btree_op_scope() {
+        --btree_instrument::depth();
+        if (!outer_)
+            return;
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_);
+        const btree_counts& now = btree_instrument::counts();
+        btree_op_stats& stats = btree_instrument::stats(op_);
+        stats.comparisons += now.comparisons - start_counts_.comparisons;
+        stats.nodes += now.nodes - start_counts_.nodes;
+        stats.allocations += now.allocations - start_counts_.allocations;
+        stats.record(static_cast<uint64_t>(elapsed.count()));
+    }
+
+private:
+    btree_op op_;
+    bool outer_;
+    btree_counts start_counts_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Counts of work that an operation hands to other threads (the parallel copy of a large tree): each worker
+// moves what it counted into the tally as it ends, and the operation adds the tally to its own thread's counts
+struct btree_counts_tally {
+    std::atomic<uint64_t> comparisons{0}, nodes{0}, allocations{0};
+    // add the tally to the counts of the calling thread
+    void collect() {
+        btree_counts& counts = btree_instrument::counts();
+        counts.comparisons += comparisons;
+        counts.nodes += nodes;
+        counts.allocations += allocations;
+    }
+};
+class btree_worker_scope {
+public:
+    explicit btree_worker_scope(btree_counts_tally& tally) : tally_(tally), start_(btree_instrument::counts()) {}
+    btree_worker_scope(const btree_worker_scope&) = delete;
+    btree_worker_scope& operator=(const btree_worker_scope&) = delete;
+    ~btree_worker_scope() {
+        btree_counts& counts = btree_instrument::counts();
+        tally_.comparisons += counts.comparisons - start_.comparisons;
+        tally_.nodes += counts.nodes - start_.nodes;
+        tally_.allocations += counts.allocations - start_.allocations;
+        counts = start_;
+    }
+
+private:
+    btree_counts_tally& tally_;
+    btree_counts start_;
+};
+
+// Hooks of the tree: BTREE_COUNT(counter, n) adds n to a counter of btree_counts, BTREE_OP(op) records the
+// rest of the enclosing block as operation 'op' (see btree_op_scope)
+#ifdef BTREE_INSTRUMENT
+#define BTREE_COUNT(counter, n) (btree_instrument::counts().counter += (n))
+#define BTREE_OP(op) btree_op_scope btree_op_scope_(op)
+#else
+#define BTREE_COUNT(counter, n) ((void)0)
+#define BTREE_OP(op) ((void)0)
+#endif
+
+#endif
@@ -1,347 +1,431 @@
 #ifndef BTREE_ITERATOR_H
 #define BTREE_ITERATOR_H
 
+#include <algorithm>
+#include <cstddef>
 #include <iterator>
+#include <vector>
 #include <assert.h>
 #include "btree.h"
 
-template <typename T> class btree;
-template <typename T> class btree_Iterator;
-template <typename T> class btree_Reverse_Iterator;
-template <typename T> class btree_Const_Iterator;
-template <typename T> class btree_Const_Reverse_Iterator;
+template <typename T, std::size_t N, typename Compare, typename Alloc, typename Mapped> class btree;
+// the iterators are parameterised by the type of the tree they iterate over
+template <typename Tree> class btree_Iterator;
+template <typename Tree> class btree_Reverse_Iterator;
+template <typename Tree> class btree_Const_Iterator;
+template <typename Tree> class btree_Const_Reverse_Iterator;
+
+// Ancestors of the node that an iterator is at, so that a step past the end of a node climbs to its parent
+// instead of searching from root for the next element (see btree::next_location); nodes do not point to their
+// parents, since copies of a tree share them. The path is found by the first step that leaves a node, in the
+// one descent from root that such a step took before, and kept up to date as the iterator moves. The top
+// Inline_Depth levels are kept in the iterator, deeper ones (a long chain of the default insert mode) in a
+// vector. A copy of a path that deep starts unknown, so copying an iterator stays cheap, and the copy finds
+// its path again when it first leaves a node.
+template <typename Node>
+struct btree_iter_path {
+    static const size_t Inline_Depth = 16;
+    // number of ancestors, the parent of the iterator's node is the last one
+    size_t depth;
+    // false until the path is found
+    bool known;
+
+    btree_iter_path() : depth(0), known(false) {}
+    // copies take the levels in use only
+    btree_iter_path(const btree_iter_path& other) : depth(0), known(false) { *this = other; }
+    btree_iter_path& operator=(const btree_iter_path& other) {
+        if (other.depth > Inline_Depth) {
+            forget();
+            return *this;
+        }
+        depth = other.depth;
+        known = other.known;
+        std::copy(other.nodes_, other.nodes_ + depth, nodes_);
+        return *this;
+    }
+    // 'nd' is the parent of the node below it that the iterator moves to
+    void push(Node *nd) {
+        if (depth < Inline_Depth)
+            nodes_[depth] = nd;
+        else if (depth - Inline_Depth < deeper_.size())
+            deeper_[depth - Inline_Depth] = nd;
+        else
+            deeper_.push_back(nd);
+        ++depth;
+    }
+    // remove the parent and return it, depth must not be 0
+    Node* pop() {
+        --depth;
+        return depth < Inline_Depth ? nodes_[depth] : deeper_[depth - Inline_Depth];
+    }
+    void forget() {
+        depth = 0;
+        known = false;
+    }
+
+private:
+    // ancestors from root down, the levels past the first Inline_Depth in 'deeper_'
+    Node *nodes_[Inline_Depth];
+    std::vector<Node*> deeper_;
+};
+
 // iterator
-template <typename T> class btree_Iterator {
+template <typename Tree> class btree_Iterator {
 public:
     typedef std::ptrdiff_t                     difference_type;
-    typedef std::forward_iterator_tag          iterator_category;
-    typedef T                                  value_type;
-    typedef T*                                 pointer;
-    typedef T&                                 reference;
+    typedef std::bidirectional_iterator_tag    iterator_category;
+    typedef typename Tree::value_type          value_type;
+    // elements cannot be changed in place, they set the order of the tree and may be shared with copies
+    // (the values of a btree_map can, see btree_slot_traits)
+    typedef typename Tree::pointer             pointer;
+    typedef typename Tree::reference           reference;
 
     // constructor
-    // param including 'tail', if do decrement operator with end(), then iterator point to 'tail'
-    btree_Iterator(typename btree<T>::Elem *pointee = nullptr, typename btree<T>::Elem *tail = nullptr)
-            : pointee_(pointee), tail_(tail) {}
+    // an iterator is a location (node, pos) in 'tree', node is nullptr for end()
+    // param including 'tree', if do decrement operator with end(), then iterator point to last element of 'tree'
+    btree_Iterator(const Tree *tree = nullptr, typename Tree::Node *node = nullptr, size_t pos = 0)
+            : tree_(tree), node_(node), pos_(pos) {}
     reference operator*() const;
     pointer operator->() const;
-    btree_Iterator<T>& operator++();
-    btree_Iterator<T>& operator--();
-    btree_Iterator<T> operator++(int);
-    btree_Iterator<T> operator--(int);
-    bool operator==(const btree_Iterator<T>& other) const;
-    bool operator==(const btree_Const_Iterator<T>& other) const;
-    bool operator!=(const btree_Iterator<T>& other) const { return !operator==(other); }
-    bool operator!=(const btree_Const_Iterator<T>& other) const { return !operator==(other); }
-    operator btree_Const_Iterator<T>() {
-        return btree_Const_Iterator<T>{pointee_};
+    btree_Iterator<Tree>& operator++();
+    btree_Iterator<Tree>& operator--();
+    btree_Iterator<Tree> operator++(int);
+    btree_Iterator<Tree> operator--(int);
+    // move by n elements, and number of elements from 'other' to this iterator, O(log n) through the
+    // sub-tree sizes kept in the nodes (see btree::select and btree::rank)
+    btree_Iterator<Tree>& operator+=(difference_type n);
+    btree_Iterator<Tree>& operator-=(difference_type n) { return operator+=(-n); }
+    btree_Iterator<Tree> operator+(difference_type n) const { auto copy = *this; return copy += n; }
+    btree_Iterator<Tree> operator-(difference_type n) const { auto copy = *this; return copy -= n; }
+    difference_type operator-(const btree_Iterator<Tree>& other) const;
+    bool operator==(const btree_Iterator<Tree>& other) const;
+    bool operator==(const btree_Const_Iterator<Tree>& other) const;
+    bool operator!=(const btree_Iterator<Tree>& other) const { return !operator==(other); }
+    bool operator!=(const btree_Const_Iterator<Tree>& other) const { return !operator==(other); }
+    operator btree_Const_Iterator<Tree>() {
+        return btree_Const_Iterator<Tree>{tree_, node_, pos_};
     }
 private:
-    mutable typename btree<T>::Elem *pointee_;
-    typename btree<T>::Elem *tail_;
+    const Tree *tree_;
+    typename Tree::Node *node_;
+    size_t pos_;
+    typename Tree::Iter_Path path_;
 };
 
 // reverse_iterator
-template <typename T> class btree_Reverse_Iterator {
+template <typename Tree> class btree_Reverse_Iterator {
 public:
     typedef std::ptrdiff_t                     difference_type;
-    typedef std::forward_iterator_tag          iterator_category;
-    typedef T                                  value_type;
-    typedef T*                                 pointer;
-    typedef T&                                 reference;
+    typedef std::bidirectional_iterator_tag    iterator_category;
+    typedef typename Tree::value_type          value_type;
+    // elements cannot be changed in place, they set the order of the tree and may be shared with copies
+    // (the values of a btree_map can, see btree_slot_traits)
+    typedef typename Tree::pointer             pointer;
+    typedef typename Tree::reference           reference;
 
     // constructor
-    // param including 'head', if do decrement operator with rend(), then iterator point to 'head'
-    btree_Reverse_Iterator(typename btree<T>::Elem *pointee = nullptr, typename btree<T>::Elem *head = nullptr)
-            : pointee_(pointee), head_(head) {}
+    // param including 'tree', if do decrement operator with rend(), then iterator point to first element of 'tree'
+    btree_Reverse_Iterator(const Tree *tree = nullptr, typename Tree::Node *node = nullptr, size_t pos = 0)
+            : tree_(tree), node_(node), pos_(pos) {}
     reference operator*() const;
     pointer operator->() const;
-    btree_Reverse_Iterator<T>& operator++();
-    btree_Reverse_Iterator<T>& operator--();
-    btree_Reverse_Iterator<T> operator++(int);
-    btree_Reverse_Iterator<T> operator--(int);
-    bool operator==(const btree_Reverse_Iterator<T>& other) const;
-    bool operator==(const btree_Const_Reverse_Iterator<T>& other) const;
-    bool operator!=(const btree_Reverse_Iterator<T>& other) const { return !operator==(other); }
-    bool operator!=(const btree_Const_Reverse_Iterator<T>& other) const { return !operator==(other); }
-    operator btree_Const_Reverse_Iterator<T>() {
-        return btree_Const_Reverse_Iterator<T>{pointee_};
+    btree_Reverse_Iterator<Tree>& operator++();
+    btree_Reverse_Iterator<Tree>& operator--();
+    btree_Reverse_Iterator<Tree> operator++(int);
+    btree_Reverse_Iterator<Tree> operator--(int);
+    bool operator==(const btree_Reverse_Iterator<Tree>& other) const;
+    bool operator==(const btree_Const_Reverse_Iterator<Tree>& other) const;
+    bool operator!=(const btree_Reverse_Iterator<Tree>& other) const { return !operator==(other); }
+    bool operator!=(const btree_Const_Reverse_Iterator<Tree>& other) const { return !operator==(other); }
+    operator btree_Const_Reverse_Iterator<Tree>() {
+        return btree_Const_Reverse_Iterator<Tree>{tree_, node_, pos_};
     }
 private:
-    mutable typename btree<T>::Elem *pointee_;
-    typename btree<T>::Elem *head_;
+    const Tree *tree_;
+    typename Tree::Node *node_;
+    size_t pos_;
+    typename Tree::Iter_Path path_;
 };
 
 // const_iterator, similar to 'iterator'
-template <typename T> class btree_Const_Iterator {
+template <typename Tree> class btree_Const_Iterator {
 public:
-    friend class btree_Iterator<T>;
+    friend class btree_Iterator<Tree>;
+    // the tree reads the location of an iterator passed to erase
+    friend Tree;
     typedef std::ptrdiff_t                     difference_type;
-    typedef std::forward_iterator_tag          iterator_category;
-    typedef T                                  value_type;
-    typedef const T*                           pointer;
-    typedef const T&                           reference;
+    typedef std::bidirectional_iterator_tag    iterator_category;
+    typedef typename Tree::value_type          value_type;
+    typedef typename Tree::const_pointer       pointer;
+    typedef typename Tree::const_reference     reference;
 
-    btree_Const_Iterator(typename btree<T>::Elem *pointee = nullptr, typename btree<T>::Elem *tail = nullptr)
-            : pointee_(pointee), tail_(tail) {}
+    btree_Const_Iterator(const Tree *tree = nullptr, typename Tree::Node *node = nullptr, size_t pos = 0)
+            : tree_(tree), node_(node), pos_(pos) {}
     reference operator*() const;
     pointer operator->() const;
-    btree_Const_Iterator<T>& operator++();
-    btree_Const_Iterator<T>& operator--();
-    btree_Const_Iterator<T> operator++(int);
-    btree_Const_Iterator<T> operator--(int);
-    bool operator==(const btree_Const_Iterator<T>& other) const;
-    bool operator!=(const btree_Const_Iterator<T>& other) const { return !operator==(other); }
+    btree_Const_Iterator<Tree>& operator++();
+    btree_Const_Iterator<Tree>& operator--();
+    btree_Const_Iterator<Tree> operator++(int);
+    btree_Const_Iterator<Tree> operator--(int);
+    // move by n elements, and number of elements from 'other' to this iterator, O(log n) through the
+    // sub-tree sizes kept in the nodes (see btree::select and btree::rank)
+    btree_Const_Iterator<Tree>& operator+=(difference_type n);
+    btree_Const_Iterator<Tree>& operator-=(difference_type n) { return operator+=(-n); }
+    btree_Const_Iterator<Tree> operator+(difference_type n) const { auto copy = *this; return copy += n; }
+    btree_Const_Iterator<Tree> operator-(difference_type n) const { auto copy = *this; return copy -= n; }
+    difference_type operator-(const btree_Const_Iterator<Tree>& other) const;
+    bool operator==(const btree_Const_Iterator<Tree>& other) const;
+    bool operator!=(const btree_Const_Iterator<Tree>& other) const { return !operator==(other); }
 private:
-    mutable typename btree<T>::Elem *pointee_;
-    typename btree<T>::Elem *tail_;
+    const Tree *tree_;
+    typename Tree::Node *node_;
+    size_t pos_;
+    typename Tree::Iter_Path path_;
 };
 
 // const_reverse_iterator, similar to 'reverse_iterator'
-template <typename T> class btree_Const_Reverse_Iterator {
+template <typename Tree> class btree_Const_Reverse_Iterator {
 public:
-    friend class btree_Reverse_Iterator<T>;
+    friend class btree_Reverse_Iterator<Tree>;
     typedef std::ptrdiff_t                     difference_type;
-    typedef std::forward_iterator_tag          iterator_category;
-    typedef T                                  value_type;
-    typedef const T*                           pointer;
-    typedef const T&                           reference;
+    typedef std::bidirectional_iterator_tag    iterator_category;
+    typedef typename Tree::value_type          value_type;
+    typedef typename Tree::const_pointer       pointer;
+    typedef typename Tree::const_reference     reference;
 
-    btree_Const_Reverse_Iterator(typename btree<T>::Elem *pointee = nullptr, typename btree<T>::Elem *head = nullptr)
-            : pointee_(pointee), head_(head) {}
+    btree_Const_Reverse_Iterator(const Tree *tree = nullptr, typename Tree::Node *node = nullptr, size_t pos = 0)
+            : tree_(tree), node_(node), pos_(pos) {}
     reference operator*() const;
     pointer operator->() const;
-    btree_Const_Reverse_Iterator<T>& operator++();
-    btree_Const_Reverse_Iterator<T>& operator--();
-    btree_Const_Reverse_Iterator<T> operator++(int);
-    btree_Const_Reverse_Iterator<T> operator--(int);
-    bool operator==(const btree_Const_Reverse_Iterator<T>& other) const;
-    bool operator!=(const btree_Const_Reverse_Iterator<T>& other) const { return !operator==(other); }
+    btree_Const_Reverse_Iterator<Tree>& operator++();
+    btree_Const_Reverse_Iterator<Tree>& operator--();
+    btree_Const_Reverse_Iterator<Tree> operator++(int);
+    btree_Const_Reverse_Iterator<Tree> operator--(int);
+    bool operator==(const btree_Const_Reverse_Iterator<Tree>& other) const;
+    bool operator!=(const btree_Const_Reverse_Iterator<Tree>& other) const { return !operator==(other); }
 private:
-    mutable typename btree<T>::Elem *pointee_;
-    typename btree<T>::Elem *head_;
+    const Tree *tree_;
+    typename Tree::Node *node_;
+    size_t pos_;
+    typename Tree::Iter_Path path_;
 };
 
-template <typename T> typename btree_Iterator<T>::reference
-btree_Iterator<T>::operator*() const {
-    return pointee_->elem_;
+template <typename Tree> typename btree_Iterator<Tree>::reference
+btree_Iterator<Tree>::operator*() const {
+    return tree_->reference_at(node_, pos_);
 }
 
-template <typename T> typename btree_Iterator<T>::pointer
-btree_Iterator<T>::operator->() const {
-    return &(operator*());
+template <typename Tree> typename btree_Iterator<Tree>::pointer
+btree_Iterator<Tree>::operator->() const {
+    return tree_->pointer_at(node_, pos_);
 }
 
-template <typename T>
-btree_Iterator<T>& btree_Iterator<T>::operator++() {
-    assert(pointee_ != nullptr);
-    pointee_ = pointee_->next_;
+template <typename Tree>
+btree_Iterator<Tree>& btree_Iterator<Tree>::operator++() {
+    assert(node_ != nullptr);
+    tree_->next_location(node_, pos_, path_);
     return *this;
 }
 
-template <typename T>
-btree_Iterator<T>& btree_Iterator<T>::operator--() {
-    if (pointee_ != nullptr) {
-        assert(pointee_->pre_ != nullptr);
-        pointee_ = pointee_->pre_;
-    } else {
-        pointee_ = tail_;
-    }
+template <typename Tree>
+btree_Iterator<Tree>& btree_Iterator<Tree>::operator--() {
+    // prev_location moves end() to the last element
+    tree_->prev_location(node_, pos_, path_);
     return *this;
 }
 
-template <typename T>
-btree_Iterator<T> btree_Iterator<T>::operator++(int) {
-    assert(pointee_ != nullptr);
-    auto ptCopy = pointee_;
-    pointee_ = pointee_->next_;
-    return ptCopy;
+template <typename Tree>
+btree_Iterator<Tree> btree_Iterator<Tree>::operator++(int) {
+    auto copy = *this;
+    operator++();
+    return copy;
 }
 
-template <typename T>
-btree_Iterator<T> btree_Iterator<T>::operator--(int) {
-    auto ptCopy = pointee_;
-    if (pointee_ != nullptr) {
-        assert(pointee_->pre_ != nullptr);
-        pointee_ = pointee_->pre_;
-    } else {
-        pointee_ = tail_;
-    }
-    return ptCopy;
+template <typename Tree>
+btree_Iterator<Tree> btree_Iterator<Tree>::operator--(int) {
+    auto copy = *this;
+    operator--();
+    return copy;
+}
+
+template <typename Tree>
+btree_Iterator<Tree>& btree_Iterator<Tree>::operator+=(difference_type n) {
+    tree_->advance_location(node_, pos_, n);
+    path_.forget();
+    return *this;
 }
 
-template <typename T>
-bool btree_Iterator<T>::operator==(const btree_Iterator<T>& other) const {
-    return this->pointee_ == other.pointee_;
+template <typename Tree> typename btree_Iterator<Tree>::difference_type
+btree_Iterator<Tree>::operator-(const btree_Iterator<Tree>& other) const {
+    return static_cast<difference_type>(tree_->location_rank(node_, pos_)) -
+           static_cast<difference_type>(tree_->location_rank(other.node_, other.pos_));
 }
 
-template <typename T>
-bool btree_Iterator<T>::operator==(const btree_Const_Iterator<T>& other) const {
-    return this->pointee_ == other.pointee_;
+template <typename Tree>
+bool btree_Iterator<Tree>::operator==(const btree_Iterator<Tree>& other) const {
+    return this->node_ == other.node_ && this->pos_ == other.pos_;
 }
 
-template <typename T> typename btree_Reverse_Iterator<T>::reference
-btree_Reverse_Iterator<T>::operator*() const {
-    return pointee_->elem_;
+template <typename Tree>
+bool btree_Iterator<Tree>::operator==(const btree_Const_Iterator<Tree>& other) const {
+    return this->node_ == other.node_ && this->pos_ == other.pos_;
 }
 
-template <typename T> typename btree_Reverse_Iterator<T>::pointer
-btree_Reverse_Iterator<T>::operator->() const {
-    return &(operator*());
+template <typename Tree> typename btree_Reverse_Iterator<Tree>::reference
+btree_Reverse_Iterator<Tree>::operator*() const {
+    return tree_->reference_at(node_, pos_);
 }
 
-template <typename T>
-btree_Reverse_Iterator<T>& btree_Reverse_Iterator<T>::operator++() {
-    assert(pointee_ != nullptr);
-    pointee_ = pointee_->pre_;
+template <typename Tree> typename btree_Reverse_Iterator<Tree>::pointer
+btree_Reverse_Iterator<Tree>::operator->() const {
+    return tree_->pointer_at(node_, pos_);
+}
+
+template <typename Tree>
+btree_Reverse_Iterator<Tree>& btree_Reverse_Iterator<Tree>::operator++() {
+    assert(node_ != nullptr);
+    tree_->prev_location(node_, pos_, path_);
     return *this;
 }
 
-template <typename T>
-btree_Reverse_Iterator<T>& btree_Reverse_Iterator<T>::operator--() {
-    if (pointee_ != nullptr) {
-        assert( pointee_->next_ != nullptr);
-        pointee_ = pointee_->next_;
+template <typename Tree>
+btree_Reverse_Iterator<Tree>& btree_Reverse_Iterator<Tree>::operator--() {
+    // rend() moves to the first element
+    if (node_ != nullptr) {
+        tree_->next_location(node_, pos_, path_);
     } else {
-        pointee_ = head_;
+        node_ = tree_->first_node();
+        pos_ = 0;
     }
     return *this;
 }
 
-template <typename T>
-btree_Reverse_Iterator<T> btree_Reverse_Iterator<T>::operator++(int) {
-    assert(pointee_ != nullptr);
-    auto ptCopy = pointee_;
-    pointee_ = pointee_->pre_;
-    return ptCopy;
+template <typename Tree>
+btree_Reverse_Iterator<Tree> btree_Reverse_Iterator<Tree>::operator++(int) {
+    auto copy = *this;
+    operator++();
+    return copy;
 }
 
-template <typename T>
-btree_Reverse_Iterator<T> btree_Reverse_Iterator<T>::operator--(int) {
-    auto ptCopy = pointee_;
-    if (pointee_ != nullptr) {
-        assert( pointee_->next_ != nullptr);
-        pointee_ = pointee_->next_;
-    } else {
-        pointee_ = head_;
-    }
-    return ptCopy;
+template <typename Tree>
+btree_Reverse_Iterator<Tree> btree_Reverse_Iterator<Tree>::operator--(int) {
+    auto copy = *this;
+    operator--();
+    return copy;
 }
 
-template <typename T>
-bool btree_Reverse_Iterator<T>::operator==(const btree_Reverse_Iterator<T>& other) const {
-    return this->pointee_ == other.pointee_;
+template <typename Tree>
+bool btree_Reverse_Iterator<Tree>::operator==(const btree_Reverse_Iterator<Tree>& other) const {
+    return this->node_ == other.node_ && this->pos_ == other.pos_;
 }
 
-template <typename T>
-bool btree_Reverse_Iterator<T>::operator==(const btree_Const_Reverse_Iterator<T>& other) const {
-    return this->pointee_ == other.pointee_;
+template <typename Tree>
+bool btree_Reverse_Iterator<Tree>::operator==(const btree_Const_Reverse_Iterator<Tree>& other) const {
+    return this->node_ == other.node_ && this->pos_ == other.pos_;
 }
 
-template <typename T> typename btree_Const_Iterator<T>::reference
-btree_Const_Iterator<T>::operator*() const {
-    return pointee_->elem_;
+template <typename Tree> typename btree_Const_Iterator<Tree>::reference
+btree_Const_Iterator<Tree>::operator*() const {
+    return tree_->const_reference_at(node_, pos_);
 }
 
-template <typename T> typename btree_Const_Iterator<T>::pointer
-btree_Const_Iterator<T>::operator->() const {
-    return &(operator*());
+template <typename Tree> typename btree_Const_Iterator<Tree>::pointer
+btree_Const_Iterator<Tree>::operator->() const {
+    return tree_->const_pointer_at(node_, pos_);
 }
 
-template <typename T>
-btree_Const_Iterator<T>& btree_Const_Iterator<T>::operator++() {
-    assert(pointee_ != nullptr);
-    pointee_ = pointee_->next_;
+template <typename Tree>
+btree_Const_Iterator<Tree>& btree_Const_Iterator<Tree>::operator++() {
+    assert(node_ != nullptr);
+    tree_->next_location(node_, pos_, path_);
     return *this;
 }
 
-template <typename T>
-btree_Const_Iterator<T>& btree_Const_Iterator<T>::operator--() {
-    if (pointee_ != nullptr) {
-        assert(pointee_->pre_ != nullptr);
-        pointee_ = pointee_->pre_;
-    } else {
-        pointee_ = tail_;
-    }
+template <typename Tree>
+btree_Const_Iterator<Tree>& btree_Const_Iterator<Tree>::operator--() {
+    // prev_location moves end() to the last element
+    tree_->prev_location(node_, pos_, path_);
     return *this;
 }
 
-template <typename T>
-btree_Const_Iterator<T> btree_Const_Iterator<T>::operator++(int) {
-    assert(pointee_ != nullptr);
-    auto ptCopy = pointee_;
-    pointee_ = pointee_->next_;
-    return ptCopy;
+template <typename Tree>
+btree_Const_Iterator<Tree> btree_Const_Iterator<Tree>::operator++(int) {
+    auto copy = *this;
+    operator++();
+    return copy;
 }
 
-template <typename T>
-btree_Const_Iterator<T> btree_Const_Iterator<T>::operator--(int) {
-    auto ptCopy = pointee_;
-    if (pointee_ != nullptr) {
-        assert(pointee_->pre_ != nullptr);
-        pointee_ = pointee_->pre_;
-    } else {
-        pointee_ = tail_;
-    }
-    return ptCopy;
+template <typename Tree>
+btree_Const_Iterator<Tree> btree_Const_Iterator<Tree>::operator--(int) {
+    auto copy = *this;
+    operator--();
+    return copy;
 }
 
-template <typename T>
-bool btree_Const_Iterator<T>::operator==(const btree_Const_Iterator<T>& other) const {
-    return this->pointee_ == other.pointee_;
+template <typename Tree>
+btree_Const_Iterator<Tree>& btree_Const_Iterator<Tree>::operator+=(difference_type n) {
+    tree_->advance_location(node_, pos_, n);
+    path_.forget();
+    return *this;
+}
+
+template <typename Tree> typename btree_Const_Iterator<Tree>::difference_type
+btree_Const_Iterator<Tree>::operator-(const btree_Const_Iterator<Tree>& other) const {
+    return static_cast<difference_type>(tree_->location_rank(node_, pos_)) -
+           static_cast<difference_type>(tree_->location_rank(other.node_, other.pos_));
 }
 
-template <typename T> typename btree_Const_Reverse_Iterator<T>::reference
-btree_Const_Reverse_Iterator<T>::operator*() const {
-    return pointee_->elem_;
+template <typename Tree>
+bool btree_Const_Iterator<Tree>::operator==(const btree_Const_Iterator<Tree>& other) const {
+    return this->node_ == other.node_ && this->pos_ == other.pos_;
 }
 
-template <typename T> typename btree_Const_Reverse_Iterator<T>::pointer
-btree_Const_Reverse_Iterator<T>::operator->() const {
-    return &(operator*());
+template <typename Tree> typename btree_Const_Reverse_Iterator<Tree>::reference
+btree_Const_Reverse_Iterator<Tree>::operator*() const {
+    return tree_->const_reference_at(node_, pos_);
 }
 
-template <typename T>
-btree_Const_Reverse_Iterator<T>& btree_Const_Reverse_Iterator<T>::operator++() {
-    assert(pointee_ != nullptr);
-    pointee_ = pointee_->pre_;
+template <typename Tree> typename btree_Const_Reverse_Iterator<Tree>::pointer
+btree_Const_Reverse_Iterator<Tree>::operator->() const {
+    return tree_->const_pointer_at(node_, pos_);
+}
+
+template <typename Tree>
+btree_Const_Reverse_Iterator<Tree>& btree_Const_Reverse_Iterator<Tree>::operator++() {
+    assert(node_ != nullptr);
+    tree_->prev_location(node_, pos_, path_);
     return *this;
 }
 
-template <typename T>
-btree_Const_Reverse_Iterator<T>& btree_Const_Reverse_Iterator<T>::operator--() {
-    if (pointee_ != nullptr) {
-        assert( pointee_->next_ != nullptr);
-        pointee_ = pointee_->next_;
+template <typename Tree>
+btree_Const_Reverse_Iterator<Tree>& btree_Const_Reverse_Iterator<Tree>::operator--() {
+    // rend() moves to the first element
+    if (node_ != nullptr) {
+        tree_->next_location(node_, pos_, path_);
     } else {
-        pointee_ = head_;
+        node_ = tree_->first_node();
+        pos_ = 0;
     }
     return *this;
 }
 
-template <typename T>
-btree_Const_Reverse_Iterator<T> btree_Const_Reverse_Iterator<T>::operator++(int) {
-    assert(pointee_ != nullptr);
-    auto ptCopy = pointee_;
-    pointee_ = pointee_->pre_;
-    return ptCopy;
+template <typename Tree>
+btree_Const_Reverse_Iterator<Tree> btree_Const_Reverse_Iterator<Tree>::operator++(int) {
+    auto copy = *this;
+    operator++();
+    return copy;
 }
 
-template <typename T>
-btree_Const_Reverse_Iterator<T> btree_Const_Reverse_Iterator<T>::operator--(int) {
-    auto ptCopy = pointee_;
-    if (pointee_ != nullptr) {
-        assert( pointee_->next_ != nullptr);
-        pointee_ = pointee_->next_;
-    } else {
-        pointee_ = head_;
-    }
-    return ptCopy;
+template <typename Tree>
+btree_Const_Reverse_Iterator<Tree> btree_Const_Reverse_Iterator<Tree>::operator--(int) {
+    auto copy = *this;
+    operator--();
+    return copy;
 }
 
-template <typename T>
-bool btree_Const_Reverse_Iterator<T>::operator==(const btree_Const_Reverse_Iterator<T>& other) const {
-    return this->pointee_ == other.pointee_;
+template <typename Tree>
+bool btree_Const_Reverse_Iterator<Tree>::operator==(const btree_Const_Reverse_Iterator<Tree>& other) const {
+    return this->node_ == other.node_ && this->pos_ == other.pos_;
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,131 @@
+#ifndef BTREE_MAP_H
+#define BTREE_MAP_H
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "btree.h"
+
+// B-Tree map from keys of type K to values of type V, ordered by Compare
+// A node keeps its keys and its values in two arrays, so a search within a node reads the keys only, as densely
+// packed as in a btree<K> of the same node size, and the value of a key is read once it is found. The iterators
+// hand out std::pair<const K&, V&> (see btree_slot_traits), through which the value can be changed in place.
+// Since values are changed in place, copies of a map do not share their nodes (see btree::snapshot), a copy is
+// a deep copy. Insert and erase move elements between nodes, so they invalidate references and iterators, and
+// values must be move constructible and move assignable without throwing.
+template <typename K, typename V, size_t N = 0, typename Compare = std::less<K>, typename Alloc = std::allocator<K>>
+class btree_map : private btree<K, N, Compare, Alloc, V> {
+    typedef btree<K, N, Compare, Alloc, V> base;
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    using typename base::value_type;
+    using typename base::reference;
+    using typename base::const_reference;
+    using typename base::pointer;
+    using typename base::const_pointer;
+    using typename base::key_compare;
+    using typename base::allocator_type;
+    using typename base::iterator;
+    using typename base::const_iterator;
+    using typename base::reverse_iterator;
+    using typename base::const_reverse_iterator;
+
+    // arguments are those of the btree constructors
+    btree_map(size_t maxNodeElems = 40, bool splitNodes = false, const Alloc& alloc = Alloc())
+            : base(maxNodeElems, splitNodes, alloc) {}
+    btree_map(size_t maxNodeElems, bool splitNodes, const Compare& comp, const Alloc& alloc = Alloc())
+            : base(maxNodeElems, splitNodes, comp, alloc) {}
+
+    using base::begin;
+    using base::end;
+    using base::rbegin;
+    using base::rend;
+    using base::cbegin;
+    using base::cend;
+    using base::crbegin;
+    using base::crend;
+
+    // Lookups by key, as for btree
+    using base::find;
+    using base::lower_bound;
+    using base::upper_bound;
+    using base::equal_range;
+    bool contains(const K& key) const { return find(key) != end(); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    bool contains(const Key& key) const { return find(key) != end(); }
+
+    // Value of 'key'
+    // operator[] inserts a value-initialised one if 'key' is not in the map; at() throws std::out_of_range then
+    V& operator[](const K& key) { return try_emplace(key).first->second; }
+    V& operator[](K&& key) { return try_emplace(std::move(key)).first->second; }
+    V& at(const K& key) {
+        auto it = find(key);
+        if (it == end())
+            throw std::out_of_range("btree_map::at: key not found");
+        return it->second;
+    }
+    const V& at(const K& key) const {
+        auto it = find(key);
+        if (it == end())
+            throw std::out_of_range("btree_map::at: key not found");
+        return it->second;
+    }
+
+    // Insert 'key' with a value built from 'args', if the key is not in the map (the value is then not built,
+    // and a key passed as an rvalue is not moved from)
+    // @Return: iterator to the element of 'key', and true if it was inserted
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(const K& key, Args&&... args) {
+        return base::insert_unique(key, std::forward<Args>(args)...);
+    }
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(K&& key, Args&&... args) {
+        return base::insert_unique(std::move(key), std::forward<Args>(args)...);
+    }
+    // Insert 'key' with value 'obj', or assign 'obj' to the value of 'key' if it is in the map
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(const K& key, M&& obj) {
+        return assign(try_emplace(key, std::forward<M>(obj)), std::forward<M>(obj));
+    }
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(K&& key, M&& obj) {
+        return assign(try_emplace(std::move(key), std::forward<M>(obj)), std::forward<M>(obj));
+    }
+    // Insert a key and its value if the key is not in the map, the value in the map is left as it is otherwise
+    std::pair<iterator, bool> insert(const std::pair<const K, V>& elem) { return try_emplace(elem.first, elem.second); }
+    // any other pair that a key and value can be made from, e.g. std::make_pair("a", 1) for a map of strings
+    // (a braced list such as {1, "a"} cannot deduce P, so it goes to the overload above)
+    template <typename P, typename = typename std::enable_if<std::is_constructible<std::pair<K, V>, P&&>::value>::type>
+    std::pair<iterator, bool> insert(P&& elem) {
+        std::pair<K, V> pair(std::forward<P>(elem));
+        return try_emplace(std::move(pair.first), std::move(pair.second));
+    }
+
+    // Erase by key, iterator or range, as for btree
+    using base::erase;
+
+    using base::size;
+    using base::empty;
+    using base::height;
+    using base::stats;
+    using base::rank;
+    using base::select;
+    using base::get_allocator;
+    using base::key_comp;
+
+private:
+    // the value of an element that try_emplace found in the map becomes 'obj' (which was not moved from then)
+    template <typename M>
+    static std::pair<iterator, bool> assign(std::pair<iterator, bool> result, M&& obj) {
+        if (!result.second)
+            result.first->second = std::forward<M>(obj);
+        return result;
+    }
+};
+
+#endif
@@ -0,0 +1,477 @@
+#ifndef BTREE_MAPPED_H
+#define BTREE_MAPPED_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "btree_search.h"
+
+// the image is mapped with mmap on POSIX systems, elsewhere it is read into memory
+#if defined(__unix__) || defined(__APPLE__)
+#define BTREE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// On-disk image of a B-Tree
+// The image is a static B+-Tree in pages of 4096 bytes: the first page is a btree_mapped_header, then come the
+// records of all elements in order, cut into blocks of 'fanout' records, then the index levels. Each index level
+// holds the first record of each block of the level below, in blocks of the same size, up to a top level of one
+// block. Every region starts on a page. A record is the element itself for trivially copyable types, or the
+// offset of the element in a heap of length-prefixed strings (a 4 byte length and the bytes) for std::string.
+// Numbers are stored in the byte order of the machine that wrote the image.
+struct btree_mapped_header {
+    static const uint32_t Version = 1;
+    static const size_t Page = 4096;
+    // a fanout of at least 2 needs at most 64 levels
+    static const size_t Max_Levels = 64;
+
+    char magic[8];
+    uint32_t version;
+    // 0 for trivially copyable elements, 1 for length-prefixed strings
+    uint32_t kind;
+    // bytes of a record
+    uint64_t record_size;
+    // number of elements
+    uint64_t count;
+    // number of records in a block
+    uint64_t fanout;
+    uint64_t data_offset;
+    uint64_t heap_offset;
+    uint64_t heap_bytes;
+    // index levels, from the one above the elements to the top
+    uint64_t levels;
+    uint64_t level_offset[Max_Levels];
+    uint64_t level_count[Max_Levels];
+};
+static_assert(sizeof(btree_mapped_header) <= btree_mapped_header::Page, "the header must fit in a page");
+
+// Element of a mapped std::string image: the bytes of the string inside the mapping (not null-terminated)
+// Compares like std::string, and converts from std::string and C strings for lookups.
+class btree_string_ref {
+public:
+    btree_string_ref(const char *data, size_t size) : data_(data), size_(size) {}
+    btree_string_ref(const std::string& str) : data_(str.data()), size_(str.size()) {}
+    btree_string_ref(const char *str) : data_(str), size_(std::strlen(str)) {}
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    std::string str() const { return std::string(data_, size_); }
+
+    friend bool operator<(const btree_string_ref& a, const btree_string_ref& b) {
+        int order = std::memcmp(a.data_, b.data_, std::min(a.size_, b.size_));
+        return order != 0 ? order < 0 : a.size_ < b.size_;
+    }
+    friend bool operator==(const btree_string_ref& a, const btree_string_ref& b) {
+        return a.size_ == b.size_ && std::memcmp(a.data_, b.data_, a.size_) == 0;
+    }
+    friend bool operator!=(const btree_string_ref& a, const btree_string_ref& b) { return !(a == b); }
+    friend std::ostream& operator<<(std::ostream& os, const btree_string_ref& ref) {
+        return os.write(ref.data_, ref.size_);
+    }
+private:
+    const char *data_;
+    size_t size_;
+};
+
+// How elements of type T are stored in an image (see btree_mapped_header)
+// record: what the element blocks and index blocks hold; reference: what the mapped view gives for an
+// element; pointer: what operator-> of its iterators gives; key: what lookups compare with
+template <typename T, typename Enable = void>
+struct btree_mapped_traits {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "only trivially copyable elements and std::string can be stored in an image");
+    static const uint32_t Kind = 0;
+    typedef T record;
+    typedef T value_type;
+    typedef const T& reference;
+    typedef const T* pointer;
+    typedef T key;
+
+    static reference value(const record& rec, const char *) { return rec; }
+    static pointer make_pointer(reference ref) { return &ref; }
+    // copy of an element of the view, as an element of a btree
+    static T element(reference ref) { return ref; }
+    // the record of 'elem', whose bytes in the heap would start at 'heap_offset'
+    static record make_record(const T& elem, uint64_t) { return elem; }
+    static uint64_t heap_bytes(const T&) { return 0; }
+    static void write_heap(std::ostream&, const T&) {}
+    // number of records in [array, array + size) less than 'elem' (SIMD for arithmetic types)
+    static size_t lower_bound(const record *array, size_t size, const key& elem, const char *) {
+        return btree_search<T>::lower_bound(array, size, elem);
+    }
+};
+
+template <>
+struct btree_mapped_traits<std::string> {
+    static const uint32_t Kind = 1;
+    typedef uint64_t record;
+    typedef btree_string_ref value_type;
+    typedef btree_string_ref reference;
+    // the view of a string is made on each access, so operator-> returns a holder of it
+    struct pointer {
+        btree_string_ref ref;
+        const btree_string_ref* operator->() const { return &ref; }
+    };
+    typedef btree_string_ref key;
+
+    static reference value(const record& rec, const char *heap) {
+        uint32_t length;
+        std::memcpy(&length, heap + rec, sizeof(length));
+        return btree_string_ref(heap + rec + sizeof(length), length);
+    }
+    static pointer make_pointer(reference ref) { return pointer{ref}; }
+    static std::string element(reference ref) { return ref.str(); }
+    static record make_record(const std::string&, uint64_t heap_offset) { return heap_offset; }
+    static uint64_t heap_bytes(const std::string& elem) { return sizeof(uint32_t) + elem.size(); }
+    static void write_heap(std::ostream& os, const std::string& elem) {
+        if (elem.size() > UINT32_MAX)
+            throw std::length_error("string too long for a btree image");
+        uint32_t length = static_cast<uint32_t>(elem.size());
+        os.write(reinterpret_cast<const char*>(&length), sizeof(length));
+        os.write(elem.data(), elem.size());
+    }
+    static size_t lower_bound(const record *array, size_t size, const key& elem, const char *heap) {
+        size_t first = 0;
+        while (size > 0) {
+            size_t half = size / 2;
+            if (value(array[first + half], heap) < elem) {
+                first += half + 1;
+                size -= half + 1;
+            } else {
+                size = half;
+            }
+        }
+        return first;
+    }
+};
+
+// Read-only B-Tree served straight from a mapped image (see btree::save and btree::open_mapped)
+// Nothing is read into memory when the image is opened: lookups and iteration read the pages of the mapping,
+// which the system shares between all processes that map the same file. A lookup reads one block of each
+// level. The elements are one sorted array of records, so the iterators are random access.
+// The header and the regions are checked when the image is opened, the records are not: open only images
+// written by save().
+template <typename T> class btree_mapped {
+public:
+    typedef btree_mapped_traits<T> Traits;
+    typedef typename Traits::record record;
+    typedef typename Traits::value_type value_type;
+    typedef typename Traits::reference reference;
+    typedef typename Traits::key key_type;
+
+    // iterator over the elements in order
+    class const_iterator {
+    public:
+        typedef std::ptrdiff_t                     difference_type;
+        typedef std::random_access_iterator_tag    iterator_category;
+        typedef typename Traits::value_type        value_type;
+        typedef typename Traits::pointer           pointer;
+        typedef typename Traits::reference         reference;
+
+        const_iterator(const record *rec = nullptr, const char *heap = nullptr) : rec_(rec), heap_(heap) {}
+        reference operator*() const { return Traits::value(*rec_, heap_); }
+        pointer operator->() const { return Traits::make_pointer(Traits::value(*rec_, heap_)); }
+        reference operator[](difference_type n) const { return Traits::value(rec_[n], heap_); }
+        const_iterator& operator++() { ++rec_; return *this; }
+        const_iterator& operator--() { --rec_; return *this; }
+        const_iterator operator++(int) { auto copy = *this; ++rec_; return copy; }
+        const_iterator operator--(int) { auto copy = *this; --rec_; return copy; }
+        const_iterator& operator+=(difference_type n) { rec_ += n; return *this; }
+        const_iterator& operator-=(difference_type n) { rec_ -= n; return *this; }
+        const_iterator operator+(difference_type n) const { return const_iterator(rec_ + n, heap_); }
+        const_iterator operator-(difference_type n) const { return const_iterator(rec_ - n, heap_); }
+        difference_type operator-(const const_iterator& other) const { return rec_ - other.rec_; }
+        bool operator==(const const_iterator& other) const { return rec_ == other.rec_; }
+        bool operator!=(const const_iterator& other) const { return rec_ != other.rec_; }
+        bool operator<(const const_iterator& other) const { return rec_ < other.rec_; }
+        bool operator>(const const_iterator& other) const { return rec_ > other.rec_; }
+        bool operator<=(const const_iterator& other) const { return rec_ <= other.rec_; }
+        bool operator>=(const const_iterator& other) const { return rec_ >= other.rec_; }
+    private:
+        const record *rec_;
+        const char *heap_;
+    };
+    typedef const_iterator iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    // Map the image in file 'path'
+    // throws std::system_error if the file cannot be opened or mapped, std::runtime_error if it is not an
+    // image of elements of type T
+    explicit btree_mapped(const std::string& path);
+    btree_mapped(const btree_mapped&) = delete;
+    btree_mapped& operator=(const btree_mapped&) = delete;
+    btree_mapped(btree_mapped&& other) : btree_mapped() { swap(other); }
+    btree_mapped& operator=(btree_mapped&& other) { swap(other); return *this; }
+    ~btree_mapped() { unmap(); }
+
+    // Write the sorted range [first, last) without duplicates as an image to file 'path'
+    // The range is read once, and once more for strings (after the records, the heap is written).
+    // throws std::system_error if the file cannot be written
+    template <typename ForwardIt>
+    static void save(const std::string& path, ForwardIt first, ForwardIt last);
+
+    const_iterator begin() const { return const_iterator(data_, heap_); }
+    const_iterator end() const { return const_iterator(data_ + size(), heap_); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+    const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+    const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+    size_t size() const { return header_ != nullptr ? header_->count : 0; }
+    bool empty() const { return size() == 0; }
+
+    // Lookups, the same as the ones of btree
+    const_iterator find(const key_type& elem) const {
+        size_t pos = rank(elem);
+        return pos < size() && !(elem < Traits::value(data_[pos], heap_)) ? begin() + pos : end();
+    }
+    const_iterator lower_bound(const key_type& elem) const { return begin() + rank(elem); }
+    const_iterator upper_bound(const key_type& elem) const {
+        size_t pos = rank(elem);
+        return begin() + pos + (pos < size() && !(elem < Traits::value(data_[pos], heap_)) ? 1 : 0);
+    }
+    std::pair<const_iterator, const_iterator> equal_range(const key_type& elem) const {
+        return std::make_pair(lower_bound(elem), upper_bound(elem));
+    }
+    // number of elements less than 'elem'
+    size_t rank(const key_type& elem) const;
+    // Call 'f(elem)' on each element in [lo, hi), in order
+    // @Return: number of elements visited
+    template <typename F>
+    size_t scan(const key_type& lo, const key_type& hi, F f) const {
+        if (!(lo < hi))
+            return 0;
+        size_t from = rank(lo), to = rank(hi);
+        for (size_t i = from; i < to; ++i)
+            f(Traits::value(data_[i], heap_));
+        return to - from;
+    }
+
+private:
+    btree_mapped() : image_(nullptr), bytes_(0), header_(nullptr), data_(nullptr), heap_(nullptr) {}
+    void swap(btree_mapped& other) {
+        std::swap(image_, other.image_);
+        std::swap(bytes_, other.bytes_);
+        std::swap(header_, other.header_);
+        std::swap(data_, other.data_);
+        std::swap(heap_, other.heap_);
+        std::swap(levels_, other.levels_);
+    }
+    // check the header and that every region lies inside the file, and set up the pointers
+    void attach();
+    void unmap();
+    // first byte of the image
+    const char* image() const { return static_cast<const char*>(image_); }
+    // pad the file with zeros up to the next page
+    static void pad(std::ostream& os, uint64_t& offset);
+
+    // the mapping (or the buffer the file was read into)
+    void *image_;
+    size_t bytes_;
+    const btree_mapped_header *header_;
+    const record *data_;
+    const char *heap_;
+    // index levels, from the one above the elements to the top
+    std::vector<const record*> levels_;
+};
+
+template <typename T>
+btree_mapped<T>::btree_mapped(const std::string& path) : btree_mapped() {
+#ifdef BTREE_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), "open " + path);
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+        int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "stat " + path);
+    }
+    bytes_ = static_cast<size_t>(info.st_size);
+    if (bytes_ >= sizeof(btree_mapped_header)) {
+        void *mapping = ::mmap(nullptr, bytes_, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "mmap " + path);
+        }
+        image_ = mapping;
+    }
+    // the mapping stays valid after the file is closed
+    ::close(fd);
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        throw std::system_error(errno, std::generic_category(), "open " + path);
+    std::vector<char> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    bytes_ = contents.size();
+    if (bytes_ >= sizeof(btree_mapped_header)) {
+        // operator new gives memory aligned for any record
+        image_ = ::operator new(bytes_);
+        std::memcpy(image_, contents.data(), bytes_);
+    }
+#endif
+    try {
+        attach();
+    } catch (...) {
+        unmap();
+        throw;
+    }
+}
+
+template <typename T>
+void btree_mapped<T>::attach() {
+    if (image_ == nullptr)
+        throw std::runtime_error("not a btree image: file too short");
+    header_ = reinterpret_cast<const btree_mapped_header*>(image_);
+    const btree_mapped_header& header = *header_;
+    if (std::memcmp(header.magic, "BTREEMAP", sizeof(header.magic)) != 0 ||
+        header.version != btree_mapped_header::Version)
+        throw std::runtime_error("not a btree image");
+    if (header.kind != Traits::Kind || header.record_size != sizeof(record))
+        throw std::runtime_error("btree image holds another element type");
+    if (header.fanout < 2 || header.levels > btree_mapped_header::Max_Levels)
+        throw std::runtime_error("corrupt btree image");
+    // every region must lie inside the file (the sizes are checked before they are multiplied)
+    auto inside = [this] (uint64_t offset, uint64_t count) {
+        return offset <= bytes_ && count <= (bytes_ - offset) / sizeof(record) &&
+               offset % btree_mapped_header::Page == 0;
+    };
+    if (!inside(header.data_offset, header.count) || header.heap_offset > bytes_ ||
+        header.heap_bytes > bytes_ - header.heap_offset)
+        throw std::runtime_error("corrupt btree image");
+    data_ = reinterpret_cast<const record*>(image() + header.data_offset);
+    heap_ = image() + header.heap_offset;
+    levels_.clear();
+    for (size_t level = 0; level < header.levels; ++level) {
+        if (!inside(header.level_offset[level], header.level_count[level]))
+            throw std::runtime_error("corrupt btree image");
+        levels_.push_back(reinterpret_cast<const record*>(image() + header.level_offset[level]));
+    }
+}
+
+template <typename T>
+void btree_mapped<T>::unmap() {
+    if (image_ != nullptr) {
+#ifdef BTREE_MMAP
+        ::munmap(image_, bytes_);
+#else
+        ::operator delete(image_);
+#endif
+    }
+    image_ = nullptr;
+    header_ = nullptr;
+    data_ = nullptr;
+    heap_ = nullptr;
+    levels_.clear();
+}
+
+template <typename T>
+size_t btree_mapped<T>::rank(const key_type& elem) const {
+    if (empty())
+        return 0;
+    // descend from the top block: in each level go to the block of the last entry not greater than 'elem'
+    // (the first block if there is none), all later blocks start with greater elements
+    size_t fanout = header_->fanout, block = 0;
+    for (size_t level = levels_.size(); level-- > 0; ) {
+        const record *entries = levels_[level] + block * fanout;
+        size_t size = std::min<size_t>(fanout, header_->level_count[level] - block * fanout);
+        size_t i = Traits::lower_bound(entries, size, elem, heap_);
+        if (i < size && !(elem < Traits::value(entries[i], heap_)))
+            ++i;
+        block = block * fanout + (i > 0 ? i - 1 : 0);
+    }
+    size_t first = block * fanout;
+    size_t size = std::min<size_t>(fanout, header_->count - first);
+    return first + Traits::lower_bound(data_ + first, size, elem, heap_);
+}
+
+template <typename T>
+void btree_mapped<T>::pad(std::ostream& os, uint64_t& offset) {
+    static const char zeros[btree_mapped_header::Page] = {};
+    uint64_t padding = (btree_mapped_header::Page - offset % btree_mapped_header::Page) % btree_mapped_header::Page;
+    os.write(zeros, padding);
+    offset += padding;
+}
+
+template <typename T>
+template <typename ForwardIt>
+void btree_mapped<T>::save(const std::string& path, ForwardIt first, ForwardIt last) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+        throw std::system_error(errno, std::generic_category(), "open " + path);
+    btree_mapped_header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "BTREEMAP", sizeof(header.magic));
+    header.version = btree_mapped_header::Version;
+    header.kind = Traits::Kind;
+    header.record_size = sizeof(record);
+    header.fanout = std::max<size_t>(2, btree_mapped_header::Page / sizeof(record));
+    // the header page is written again at the end, when the offsets are known
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    uint64_t offset = sizeof(header);
+    pad(file, offset);
+
+    // the records of the elements, keeping the first record of each block for the index
+    header.data_offset = offset;
+    std::vector<std::vector<record>> levels(1);
+    uint64_t heap_bytes = 0;
+    for (ForwardIt it = first; it != last; ++it) {
+        record rec = Traits::make_record(*it, heap_bytes);
+        if (header.count % header.fanout == 0)
+            levels[0].push_back(rec);
+        file.write(reinterpret_cast<const char*>(&rec), sizeof(rec));
+        heap_bytes += Traits::heap_bytes(*it);
+        ++header.count;
+    }
+    offset += header.count * sizeof(record);
+    pad(file, offset);
+
+    // index levels until one block holds the top level (elements that fit in one block need none)
+    if (header.count <= header.fanout)
+        levels.clear();
+    while (!levels.empty() && levels.back().size() > header.fanout) {
+        std::vector<record> next;
+        for (size_t i = 0; i < levels.back().size(); i += header.fanout)
+            next.push_back(levels.back()[i]);
+        levels.push_back(std::move(next));
+    }
+    header.levels = levels.size();
+    for (size_t level = 0; level < levels.size(); ++level) {
+        header.level_offset[level] = offset;
+        header.level_count[level] = levels[level].size();
+        file.write(reinterpret_cast<const char*>(levels[level].data()), levels[level].size() * sizeof(record));
+        offset += levels[level].size() * sizeof(record);
+        pad(file, offset);
+    }
+
+    // the heap of the strings, in the order of their records
+    header.heap_offset = offset;
+    header.heap_bytes = heap_bytes;
+    if (heap_bytes > 0)
+        for (ForwardIt it = first; it != last; ++it)
+            Traits::write_heap(file, *it);
+
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.flush();
+    if (!file)
+        throw std::system_error(errno, std::generic_category(), "write " + path);
+}
+
+#endif
@@ -0,0 +1,320 @@
+#ifndef BTREE_SEARCH_H
+#define BTREE_SEARCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "btree_instrument.h"
+
+// SIMD kernels are built for x86-64 with GCC or Clang, each with its own target attribute,
+// so they do not need -mavx2 and are only called if the CPU supports them
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define BTREE_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+// Branchless binary search: number of elements less than 'elem' in the sorted array [array, array + size)
+// The search range is halved without branching on the comparison, so the compiler can use a
+// conditional move and the loop runs log2(size) times whatever the element values are.
+// @Param: 'stop' is the size at which the halving ends, the remaining range is returned through
+// 'array' and 'size' (the generic search runs it down to 1 and finishes the count itself)
+// @Param: 'comp' orders the elements (and compares them with 'elem', which may be of another type)
+template <typename T, typename K, typename Compare>
+inline const T* btree_narrow(const T *array, size_t& size, const K& elem, size_t stop, const Compare& comp) {
+    while (size > stop) {
+        size_t half = size / 2;
+        BTREE_COUNT(comparisons, 1);
+        array = comp(*(array + half - 1), elem) ? array + half : array;
+        size -= half;
+    }
+    return array;
+}
+template <typename T>
+inline const T* btree_narrow(const T *array, size_t& size, const T& elem, size_t stop) {
+    return btree_narrow(array, size, elem, stop, std::less<T>());
+}
+
+// Branchless binary search over the whole range
+template <typename T>
+inline size_t btree_scalar_lower_bound(const T *array, size_t size, const T& elem) {
+    if (size == 0)
+        return 0;
+    const T *base = btree_narrow(array, size, elem, 1);
+    BTREE_COUNT(comparisons, 1);
+    return (base - array) + (*base < elem);
+}
+
+// In-node search of the B-Tree
+// btree_search<T>::lower_bound(array, size, elem) is the number of elements less than 'elem' in the
+// sorted array [array, array + size), which is the location of the first element not less than 'elem'.
+// The generic version is the branchless binary search on operator<. Arithmetic types are specialised below.
+template <typename T, typename Enable = void>
+struct btree_search {
+    static size_t lower_bound(const T *array, size_t size, const T& elem) {
+        return btree_scalar_lower_bound(array, size, elem);
+    }
+};
+
+#ifdef BTREE_SIMD_X86
+// CPU features, checked once at start-up (read as false before that, which selects the scalar code)
+template <typename Dummy = void>
+struct btree_cpu {
+    static const bool avx2;
+    static const bool sse42;
+};
+template <typename Dummy>
+const bool btree_cpu<Dummy>::avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+template <typename Dummy>
+const bool btree_cpu<Dummy>::sse42 = __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt");
+
+// Count the elements less than x in a[0, n): compare a vector of elements with x at a time and add
+// up the bits of the comparison mask. Unsigned integers are compared as signed after flipping the
+// sign bit ('flip' is the sign bit for unsigned types, 0 for signed ones).
+__attribute__((target("avx2,popcnt")))
+inline size_t btree_count_less_avx2(const int32_t *a, size_t n, int32_t x, int32_t flip) {
+    const __m256i vx = _mm256_set1_epi32(x ^ flip), vflip = _mm256_set1_epi32(flip);
+    size_t i = 0, count = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)), vflip);
+        count += _mm_popcnt_u32(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(vx, v))));
+    }
+    for (; i < n; ++i)
+        count += (a[i] ^ flip) < (x ^ flip);
+    return count;
+}
+
+__attribute__((target("avx2,popcnt")))
+inline size_t btree_count_less_avx2(const int64_t *a, size_t n, int64_t x, int64_t flip) {
+    const __m256i vx = _mm256_set1_epi64x(x ^ flip), vflip = _mm256_set1_epi64x(flip);
+    size_t i = 0, count = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)), vflip);
+        count += _mm_popcnt_u32(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(vx, v))));
+    }
+    for (; i < n; ++i)
+        count += (a[i] ^ flip) < (x ^ flip);
+    return count;
+}
+
+__attribute__((target("avx2,popcnt")))
+inline size_t btree_count_less_avx2(const float *a, size_t n, float x) {
+    const __m256 vx = _mm256_set1_ps(x);
+    size_t i = 0, count = 0;
+    for (; i + 8 <= n; i += 8)
+        count += _mm_popcnt_u32(_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(a + i), vx, _CMP_LT_OQ)));
+    for (; i < n; ++i)
+        count += a[i] < x;
+    return count;
+}
+
+__attribute__((target("avx2,popcnt")))
+inline size_t btree_count_less_avx2(const double *a, size_t n, double x) {
+    const __m256d vx = _mm256_set1_pd(x);
+    size_t i = 0, count = 0;
+    for (; i + 4 <= n; i += 4)
+        count += _mm_popcnt_u32(_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(a + i), vx, _CMP_LT_OQ)));
+    for (; i < n; ++i)
+        count += a[i] < x;
+    return count;
+}
+
+// 128 bit versions: SSE2 for 32 bit integers and floating types, SSE4.2 for 64 bit integers
+__attribute__((target("sse4.2,popcnt")))
+inline size_t btree_count_less_sse(const int32_t *a, size_t n, int32_t x, int32_t flip) {
+    const __m128i vx = _mm_set1_epi32(x ^ flip), vflip = _mm_set1_epi32(flip);
+    size_t i = 0, count = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)), vflip);
+        count += _mm_popcnt_u32(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(vx, v))));
+    }
+    for (; i < n; ++i)
+        count += (a[i] ^ flip) < (x ^ flip);
+    return count;
+}
+
+__attribute__((target("sse4.2,popcnt")))
+inline size_t btree_count_less_sse(const int64_t *a, size_t n, int64_t x, int64_t flip) {
+    const __m128i vx = _mm_set1_epi64x(x ^ flip), vflip = _mm_set1_epi64x(flip);
+    size_t i = 0, count = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)), vflip);
+        count += _mm_popcnt_u32(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(vx, v))));
+    }
+    for (; i < n; ++i)
+        count += (a[i] ^ flip) < (x ^ flip);
+    return count;
+}
+
+__attribute__((target("sse4.2,popcnt")))
+inline size_t btree_count_less_sse(const float *a, size_t n, float x) {
+    const __m128 vx = _mm_set1_ps(x);
+    size_t i = 0, count = 0;
+    for (; i + 4 <= n; i += 4)
+        count += _mm_popcnt_u32(_mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(a + i), vx)));
+    for (; i < n; ++i)
+        count += a[i] < x;
+    return count;
+}
+
+__attribute__((target("sse4.2,popcnt")))
+inline size_t btree_count_less_sse(const double *a, size_t n, double x) {
+    const __m128d vx = _mm_set1_pd(x);
+    size_t i = 0, count = 0;
+    for (; i + 2 <= n; i += 2)
+        count += _mm_popcnt_u32(_mm_movemask_pd(_mm_cmplt_pd(_mm_loadu_pd(a + i), vx)));
+    for (; i < n; ++i)
+        count += a[i] < x;
+    return count;
+}
+
+// Element type as seen by the kernels: 32 and 64 bit integers (signed or not), float and double.
+// Other arithmetic types (bool, char, short, long double) have no kernel.
+template <typename T, typename Enable = void>
+struct btree_simd_kind {
+    static const bool supported = false;
+    static const size_t lanes = 1;
+};
+template <typename T>
+struct btree_simd_kind<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value &&
+                                                  (sizeof(T) == 4 || sizeof(T) == 8)>::type> {
+    static const bool supported = true;
+    typedef typename std::conditional<sizeof(T) == 4, int32_t, int64_t>::type lane;
+    // elements per 256 bit vector
+    static const size_t lanes = 32 / sizeof(T);
+    static size_t count_less(const T *a, size_t n, T x, bool avx2) {
+        lane flip = std::is_signed<T>::value ? 0 : std::numeric_limits<lane>::min();
+        lane bits;
+        std::memcpy(&bits, &x, sizeof(T));
+        auto array = reinterpret_cast<const lane*>(a);
+        return avx2 ? btree_count_less_avx2(array, n, bits, flip) : btree_count_less_sse(array, n, bits, flip);
+    }
+};
+template <typename T>
+struct btree_simd_kind<T, typename std::enable_if<std::is_same<T, float>::value || std::is_same<T, double>::value>::type> {
+    static const bool supported = true;
+    static const size_t lanes = 32 / sizeof(T);
+    static size_t count_less(const T *a, size_t n, T x, bool avx2) {
+        return avx2 ? btree_count_less_avx2(a, n, x) : btree_count_less_sse(a, n, x);
+    }
+};
+#endif
+
+// Arithmetic types: the branchless binary search narrows the range down to a few vectors, then the
+// elements left are compared with SIMD instructions in one pass. Falls back to the generic search
+// if there is no kernel for the type or the CPU lacks the instructions.
+template <typename T>
+struct btree_search<T, typename std::enable_if<std::is_arithmetic<T>::value>::type> {
+    static size_t lower_bound(const T *array, size_t size, const T& elem) {
+#ifdef BTREE_SIMD_X86
+        return simd_lower_bound(array, size, elem, std::integral_constant<bool, btree_simd_kind<T>::supported>());
+#else
+        return btree_scalar_lower_bound(array, size, elem);
+#endif
+    }
+#ifdef BTREE_SIMD_X86
+private:
+    // range that is searched by comparing every element: 4 AVX2 vectors
+    static const size_t Window = 4 * btree_simd_kind<T>::lanes;
+
+    static size_t simd_lower_bound(const T *array, size_t size, const T& elem, std::true_type) {
+        if (!btree_cpu<>::avx2 && !btree_cpu<>::sse42)
+            return btree_scalar_lower_bound(array, size, elem);
+        const T *base = btree_narrow(array, size, elem, Window);
+        // the kernel compares every element left
+        BTREE_COUNT(comparisons, size);
+        return (base - array) + btree_simd_kind<T>::count_less(base, size, elem, btree_cpu<>::avx2);
+    }
+    // no kernel for this type, use the generic search
+    static size_t simd_lower_bound(const T *array, size_t size, const T& elem, std::false_type) {
+        return btree_scalar_lower_bound(array, size, elem);
+    }
+#endif
+};
+
+// Search of a node with the comparator of the tree
+// btree_node_search<T, K, Compare>::find(array, size, key, comp) is a pair: the location of the first element
+// of the sorted array [array, array + size) not less than 'key', and true if that element is equal to 'key'.
+// There are three ways to search, chosen at compile time:
+//  - operator< on arithmetic elements: btree_search above (SIMD), then one comparison for equality
+//  - operator< on elements that have a three-way 'compare' member (see btree_three_way): one call of compare
+//    per probe, and the search ends as soon as an equal element is found
+//  - any other comparator: the branchless search with 'comp', then one comparison for equality
+
+// comparators that are operator< on the elements
+template <typename Compare, typename T>
+struct btree_is_less : std::integral_constant<bool, std::is_same<Compare, std::less<T>>::value ||
+                                                     std::is_same<Compare, std::less<>>::value> {};
+
+// Element types whose member 'a.compare(b)' is negative, 0 or positive as 'a' is less than, equal to or
+// greater than 'b', in the order of operator<. std::basic_string is one, specialise this to std::true_type
+// for other types.
+template <typename T>
+struct btree_three_way : std::false_type {};
+template <typename Char, typename Traits, typename Alloc>
+struct btree_three_way<std::basic_string<Char, Traits, Alloc>> : std::true_type {};
+
+// 'a.compare(key)' can be called for an element 'a'
+template <typename T, typename K, typename Enable = void>
+struct btree_has_compare : std::false_type {};
+template <typename T, typename K>
+struct btree_has_compare<T, K, typename std::enable_if<std::is_convertible<
+        decltype(std::declval<const T&>().compare(std::declval<const K&>())), int>::value>::type> : std::true_type {};
+
+// which of the three ways: 0 SIMD, 1 three-way, 2 generic
+template <typename T, typename K, typename Compare>
+struct btree_search_kind : std::integral_constant<int,
+        !btree_is_less<Compare, T>::value ? 2 :
+        std::is_same<K, T>::value && std::is_arithmetic<T>::value ? 0 :
+        btree_three_way<T>::value && btree_has_compare<T, K>::value ? 1 : 2> {};
+
+template <typename T, typename K, typename Compare, int Kind = btree_search_kind<T, K, Compare>::value>
+struct btree_node_search {
+    static std::pair<size_t, bool> find(const T *array, size_t size, const K& key, const Compare& comp) {
+        size_t lower = 0;
+        if (size > 0) {
+            size_t left = size;
+            const T *base = btree_narrow(array, left, key, 1, comp);
+            lower = (base - array) + (comp(*base, key) ? 1 : 0);
+            BTREE_COUNT(comparisons, lower < size ? 2 : 1);
+        }
+        return std::make_pair(lower, lower < size && !comp(key, array[lower]));
+    }
+};
+
+template <typename T, typename K, typename Compare>
+struct btree_node_search<T, K, Compare, 0> {
+    static std::pair<size_t, bool> find(const T *array, size_t size, const K& key, const Compare&) {
+        size_t lower = btree_search<T>::lower_bound(array, size, key);
+        BTREE_COUNT(comparisons, lower < size ? 1 : 0);
+        return std::make_pair(lower, lower < size && !(key < array[lower]));
+    }
+};
+
+template <typename T, typename K, typename Compare>
+struct btree_node_search<T, K, Compare, 1> {
+    static std::pair<size_t, bool> find(const T *array, size_t size, const K& key, const Compare&) {
+        size_t first = 0;
+        while (size > 0) {
+            size_t half = size / 2;
+            int order = array[first + half].compare(key);
+            BTREE_COUNT(comparisons, 1);
+            if (order == 0)
+                return std::make_pair(first + half, true);
+            if (order < 0) {
+                first += half + 1;
+                size -= half + 1;
+            } else {
+                size = half;
+            }
+        }
+        return std::make_pair(first, false);
+    }
+};
+
+#endif
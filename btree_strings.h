@@ -0,0 +1,653 @@
+#ifndef BTREE_STRINGS_H
+#define BTREE_STRINGS_H
+
+#include <cstddef>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Set of strings stored with prefix compression, for dictionary-like keys where neighbours share long prefixes
+// Each node keeps the prefix that all of its keys share once, and the rest of each key (its suffix) front-coded
+// in one contiguous buffer: a suffix is stored as the number of leading bytes it shares with the suffix before
+// it, followed by the bytes after those. A key then takes a few bytes instead of a whole std::string (32 bytes,
+// plus a heap buffer for long strings). A lookup compares the key with the node prefix once and scans the
+// buffer comparing suffixes only: an entry that shares more or fewer bytes with the one before than the key
+// does is ordered without looking at its bytes, so each byte of the key is compared at most once per node.
+// The keys are stored in the leaves, which are linked for iteration. The internal nodes hold the shortest
+// strings that separate their sub-trees, compressed the same way. A node is split when its buffer grows past
+// B bytes. Erase frees a leaf that becomes empty, but does not merge part full nodes.
+// The keys are decoded into a string held by the iterator, so iterators are invalidated by insert and erase.
+template <size_t B = 256> class btree_string_set {
+    struct Node;
+public:
+    static_assert(B >= 16, "a node must have room for a few keys");
+
+    typedef std::string value_type;
+    typedef std::string key_type;
+
+    // Bidirectional iterator over the keys in order
+    class const_iterator {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::string value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::string* pointer;
+        typedef const std::string& reference;
+
+        const_iterator() : set_(nullptr), leaf_(nullptr), index_(0), offset_(0) {}
+        reference operator*() const { return key_; }
+        pointer operator->() const { return &key_; }
+        const_iterator& operator++() {
+            if (index_ + 1 < leaf_->count) {
+                // the next suffix is decoded on top of the current one
+                Entry e = read_entry(leaf_->entries, offset_);
+                key_.resize(leaf_->prefix.size() + e.shared);
+                key_.append(leaf_->entries, e.data, e.length);
+                offset_ = e.end;
+                ++index_;
+            } else {
+                leaf_ = leaf_->next;
+                seek(0);
+            }
+            return *this;
+        }
+        const_iterator operator++(int) { auto old = *this; ++*this; return old; }
+        // front coding only reads forwards, so the leaf is decoded again from its start
+        const_iterator& operator--() {
+            if (leaf_ == nullptr)
+                leaf_ = set_->last_leaf();
+            else if (index_ == 0)
+                leaf_ = leaf_->prev;
+            else {
+                seek(index_ - 1);
+                return *this;
+            }
+            seek(leaf_->count - 1);
+            return *this;
+        }
+        const_iterator operator--(int) { auto old = *this; --*this; return old; }
+        bool operator==(const const_iterator& other) const { return leaf_ == other.leaf_ && index_ == other.index_; }
+        bool operator!=(const const_iterator& other) const { return !(*this == other); }
+
+    private:
+        friend class btree_string_set;
+        const_iterator(const btree_string_set *set, const Node *leaf, size_t index)
+                : set_(set), leaf_(leaf), index_(0), offset_(0) {
+            seek(index);
+        }
+        // decode key 'index' of the leaf (end() if the leaf is nullptr)
+        void seek(size_t index) {
+            index_ = offset_ = 0;
+            key_.clear();
+            if (leaf_ == nullptr)
+                return;
+            key_ = leaf_->prefix;
+            for (size_t i = 0; i <= index; ++i) {
+                Entry e = read_entry(leaf_->entries, offset_);
+                key_.resize(leaf_->prefix.size() + e.shared);
+                key_.append(leaf_->entries, e.data, e.length);
+                offset_ = e.end;
+            }
+            index_ = index;
+        }
+
+        const btree_string_set *set_;
+        // leaf of the key, nullptr for end()
+        const Node *leaf_;
+        // location of the key in the leaf, and offset of the entry after it
+        size_t index_, offset_;
+        std::string key_;
+    };
+    typedef const_iterator iterator;
+
+    btree_string_set() : root_(nullptr), size_(0) {}
+    // Construct from the strings in [first, last)
+    template <typename InputIt>
+    btree_string_set(InputIt first, InputIt last) : btree_string_set() {
+        for (; first != last; ++first)
+            insert(*first);
+    }
+    btree_string_set(const btree_string_set& original);
+    btree_string_set(btree_string_set&& original) : root_(original.root_), size_(original.size_) {
+        original.root_ = nullptr;
+        original.size_ = 0;
+    }
+    btree_string_set& operator=(btree_string_set rhs) {
+        swap(rhs);
+        return *this;
+    }
+    ~btree_string_set() { destroy(root_); }
+    void swap(btree_string_set& other) {
+        std::swap(root_, other.root_);
+        std::swap(size_, other.size_);
+    }
+
+    // Insert a key
+    // @Return: true if it was inserted, false if it was in the set already
+    bool insert(const std::string& key) { return insert(key.data(), key.size()); }
+    bool insert(const char *key, size_t length);
+    // Erase a key
+    // @Return: number of keys erased (0 or 1)
+    size_t erase(const std::string& key);
+    // Lookups: true if 'key' is in the set, iterator to 'key' (end() if it is not in the set), and
+    // iterator to the first key not less than 'key'
+    bool contains(const std::string& key) const;
+    const_iterator find(const std::string& key) const;
+    const_iterator lower_bound(const std::string& key) const;
+
+    const_iterator begin() const { return const_iterator(this, first_leaf(), 0); }
+    const_iterator end() const { return const_iterator(this, nullptr, 0); }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    // Number of levels (0 for an empty set)
+    size_t height() const;
+    // Bytes allocated for the nodes and their buffers
+    size_t memory_usage() const { return memory_usage(root_); }
+    void clear() {
+        destroy(root_);
+        root_ = nullptr;
+        size_ = 0;
+    }
+
+private:
+    struct Node {
+        explicit Node(bool leaf) : leaf(leaf), count(0), prev(nullptr), next(nullptr) {}
+        bool leaf;
+        // number of keys
+        size_t count;
+        // bytes that every key of the node starts with
+        std::string prefix;
+        // the suffixes after the prefix, front-coded: for each key, the number of bytes it shares with the
+        // suffix before it and the number of bytes after those (both as varints), then those bytes
+        std::string entries;
+        // internal node: count + 1 children, child i holds the keys not less than key i - 1 and less than key i
+        std::vector<Node*> children;
+        // leaf: the leaves before and after it in order
+        Node *prev, *next;
+    };
+    // an entry of the buffer: shared and length as above, offset of its bytes, and offset of the next entry
+    struct Entry {
+        size_t shared, length, data, end;
+    };
+    // where a key goes in a node
+    struct Probe {
+        // number of keys less than the key, and true if key 'pos' is equal to it
+        size_t pos;
+        bool found;
+        // offset of entry 'pos' in the buffer
+        size_t offset;
+        // number of leading bytes the suffix of the key shares with suffix pos - 1 (0 if pos is 0), and
+        // with suffix pos (if there is one)
+        size_t before, after;
+    };
+
+    // Encoding helpers
+    static void put_varint(std::string& out, size_t value) {
+        for (; value >= 0x80; value >>= 7)
+            out.push_back(static_cast<char>(value | 0x80));
+        out.push_back(static_cast<char>(value));
+    }
+    static size_t get_varint(const std::string& in, size_t& offset) {
+        size_t value = 0;
+        for (unsigned shift = 0; ; shift += 7) {
+            unsigned char byte = static_cast<unsigned char>(in[offset++]);
+            value |= static_cast<size_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+    }
+    static Entry read_entry(const std::string& entries, size_t offset) {
+        Entry e;
+        // most entries share and add fewer than 128 bytes, one byte each
+        const unsigned char *bytes = reinterpret_cast<const unsigned char*>(entries.data()) + offset;
+        if (bytes[0] < 0x80 && bytes[1] < 0x80) {
+            e.shared = bytes[0];
+            e.length = bytes[1];
+            e.data = offset + 2;
+            e.end = e.data + e.length;
+            return e;
+        }
+        e.shared = get_varint(entries, offset);
+        e.length = get_varint(entries, offset);
+        e.data = offset;
+        e.end = offset + e.length;
+        return e;
+    }
+    static void put_entry(std::string& out, size_t shared, const char *bytes, size_t length) {
+        put_varint(out, shared);
+        put_varint(out, length);
+        if (length > 0)
+            out.append(bytes, length);
+    }
+    // number of leading bytes that 'a' and 'b' have in common
+    static size_t common_prefix(const char *a, size_t a_length, const char *b, size_t b_length) {
+        size_t i = 0, n = a_length < b_length ? a_length : b_length;
+        while (i < n && a[i] == b[i])
+            ++i;
+        return i;
+    }
+
+    // Node helpers
+    // find the place of the key among the keys of the node, the key must start with the node prefix
+    static Probe probe(const Node *nd, const char *key, size_t length);
+    // same for any key: one that does not start with the node prefix is before or after all the keys
+    static Probe locate(const Node *nd, const char *key, size_t length);
+    // location of the child to descend into for 'key' in an internal node
+    static size_t child_index(const Node *nd, const char *key, size_t length) {
+        Probe p = locate(nd, key, length);
+        return p.pos + (p.found ? 1 : 0);
+    }
+    // add a key that is not in the node, shortening the node prefix if the key does not start with it
+    // @Return: location of the key
+    static size_t add_key(Node *nd, const char *key, size_t length);
+    // shorten the node prefix to 'length' bytes, the bytes cut off go to the front of the suffixes
+    static void shorten_prefix(Node *nd, size_t length);
+    // remove the key whose entry starts at 'offset'
+    static void remove_entry(Node *nd, size_t offset);
+    // offset of the entry of key 'index'
+    static size_t entry_offset(const Node *nd, size_t index);
+    // all keys of the node, whole
+    static void decode(const Node *nd, std::vector<std::string>& keys);
+    // replace the keys of the node by the sorted keys [first, last)
+    static void encode(Node *nd, std::vector<std::string>::const_iterator first, std::vector<std::string>::const_iterator last);
+    // a node is split when its buffer is over B bytes (and it has two keys to split)
+    static bool overfull(const Node *nd) { return nd->entries.size() > B && nd->count >= 2; }
+    // split the node into itself and a new right node
+    // @Param: separator is set to the key to add to the parent between the two
+    // @Return: the right node
+    static Node* split(Node *nd, std::string& separator);
+
+    // Tree helpers, recursion is bounded by the height
+    const Node* find_leaf(const char *key, size_t length) const;
+    const Node* first_leaf() const;
+    const Node* last_leaf() const;
+    static Node* copy_tree(const Node *nd, Node*& last_leaf);
+    static void destroy(Node *nd);
+    static size_t memory_usage(const Node *nd);
+
+    Node *root_;
+    size_t size_;
+};
+
+template <size_t B>
+btree_string_set<B>::btree_string_set(const btree_string_set& original) : root_(nullptr), size_(original.size_) {
+    Node *last_leaf = nullptr;
+    if (original.root_ != nullptr)
+        root_ = copy_tree(original.root_, last_leaf);
+}
+
+template <size_t B>
+typename btree_string_set<B>::Probe btree_string_set<B>::probe(const Node *nd, const char *key, size_t length) {
+    const char *suffix = key + nd->prefix.size();
+    size_t suffix_length = length - nd->prefix.size();
+    // 'match' is the number of leading bytes the key shares with the suffix before the current one, which is less than the key
+    size_t match = 0, offset = 0;
+    for (size_t i = 0; i < nd->count; ++i) {
+        Entry e = read_entry(nd->entries, offset);
+        // the suffix shares more with the one before than the key does: it is less than the key like that one
+        if (i > 0 && e.shared > match) {
+            offset = e.end;
+            continue;
+        }
+        // it shares less: it is greater than the key at the byte where the key and the one before agree
+        if (e.shared < match)
+            return Probe{i, false, offset, match, e.shared};
+        // it shares as much: compare the rest
+        const char *data = nd->entries.data() + e.data;
+        size_t common = common_prefix(suffix + match, suffix_length - match, data, e.length);
+        if (common == e.length && match + common == suffix_length)
+            return Probe{i, true, offset, match, suffix_length};
+        bool less = common == e.length || (match + common < suffix_length &&
+                    static_cast<unsigned char>(data[common]) < static_cast<unsigned char>(suffix[match + common]));
+        if (!less)
+            return Probe{i, false, offset, match, match + common};
+        match += common;
+        offset = e.end;
+    }
+    return Probe{nd->count, false, nd->entries.size(), match, 0};
+}
+
+template <size_t B>
+typename btree_string_set<B>::Probe btree_string_set<B>::locate(const Node *nd, const char *key, size_t length) {
+    size_t common = common_prefix(key, length, nd->prefix.data(), nd->prefix.size());
+    if (common == nd->prefix.size())
+        return probe(nd, key, length);
+    if (common < length && static_cast<unsigned char>(key[common]) > static_cast<unsigned char>(nd->prefix[common]))
+        return Probe{nd->count, false, nd->entries.size(), 0, 0};
+    return Probe{0, false, 0, 0, 0};
+}
+
+template <size_t B>
+size_t btree_string_set<B>::add_key(Node *nd, const char *key, size_t length) {
+    if (nd->count == 0) {
+        // the only key is the prefix
+        nd->prefix.assign(key, length);
+        nd->entries.reserve(B);
+        put_entry(nd->entries, 0, nullptr, 0);
+        nd->count = 1;
+        return 0;
+    }
+    size_t common = common_prefix(key, length, nd->prefix.data(), nd->prefix.size());
+    if (common < nd->prefix.size())
+        shorten_prefix(nd, common);
+    Probe p = probe(nd, key, length);
+    const char *suffix = key + nd->prefix.size();
+    // the new entry, and the next one coded again against the new key (the new key shares at least as
+    // much with it as the key before did, so it loses bytes from its front)
+    std::string coded;
+    put_entry(coded, p.before, suffix + p.before, length - nd->prefix.size() - p.before);
+    size_t end = p.offset;
+    if (p.pos < nd->count) {
+        Entry e = read_entry(nd->entries, p.offset);
+        size_t drop = p.after - e.shared;
+        put_entry(coded, p.after, nd->entries.data() + e.data + drop, e.length - drop);
+        end = e.end;
+    }
+    nd->entries.replace(p.offset, end - p.offset, coded);
+    ++nd->count;
+    return p.pos;
+}
+
+template <size_t B>
+void btree_string_set<B>::shorten_prefix(Node *nd, size_t length) {
+    size_t cut = nd->prefix.size() - length;
+    std::string entries;
+    size_t offset = 0;
+    for (size_t i = 0; i < nd->count; ++i) {
+        Entry e = read_entry(nd->entries, offset);
+        if (i == 0) {
+            // the first suffix is whole, the others share the bytes cut off with the one before
+            std::string first = nd->prefix.substr(length);
+            first.append(nd->entries, e.data, e.length);
+            put_entry(entries, 0, first.data(), first.size());
+        } else {
+            put_entry(entries, e.shared + cut, nd->entries.data() + e.data, e.length);
+        }
+        offset = e.end;
+    }
+    nd->entries.swap(entries);
+    nd->prefix.resize(length);
+}
+
+template <size_t B>
+void btree_string_set<B>::remove_entry(Node *nd, size_t offset) {
+    Entry e = read_entry(nd->entries, offset);
+    std::string coded;
+    size_t end = e.end;
+    if (e.end < nd->entries.size()) {
+        // the next suffix is coded again against the one before the removed one: it keeps what it
+        // shares with that, and takes the bytes it shared only with the removed one into its own
+        Entry next = read_entry(nd->entries, e.end);
+        if (next.shared > e.shared) {
+            std::string bytes(nd->entries, e.data, next.shared - e.shared);
+            bytes.append(nd->entries, next.data, next.length);
+            put_entry(coded, e.shared, bytes.data(), bytes.size());
+        } else {
+            put_entry(coded, next.shared, nd->entries.data() + next.data, next.length);
+        }
+        end = next.end;
+    }
+    nd->entries.replace(offset, end - offset, coded);
+    --nd->count;
+}
+
+template <size_t B>
+size_t btree_string_set<B>::entry_offset(const Node *nd, size_t index) {
+    size_t offset = 0;
+    for (size_t i = 0; i < index; ++i)
+        offset = read_entry(nd->entries, offset).end;
+    return offset;
+}
+
+template <size_t B>
+void btree_string_set<B>::decode(const Node *nd, std::vector<std::string>& keys) {
+    std::string key = nd->prefix;
+    size_t offset = 0;
+    for (size_t i = 0; i < nd->count; ++i) {
+        Entry e = read_entry(nd->entries, offset);
+        key.resize(nd->prefix.size() + e.shared);
+        key.append(nd->entries, e.data, e.length);
+        keys.push_back(key);
+        offset = e.end;
+    }
+}
+
+template <size_t B>
+void btree_string_set<B>::encode(Node *nd, std::vector<std::string>::const_iterator first,
+                                 std::vector<std::string>::const_iterator last) {
+    nd->count = last - first;
+    // a new buffer of B bytes, the old one grew past that before the split
+    std::string().swap(nd->entries);
+    nd->entries.reserve(B);
+    nd->prefix.clear();
+    if (first == last)
+        return;
+    // the keys are sorted, so what the first and last share is shared by all
+    const std::string& back = *(last - 1);
+    nd->prefix.assign(*first, 0, common_prefix(first->data(), first->size(), back.data(), back.size()));
+    size_t skip = nd->prefix.size();
+    for (auto it = first; it != last; ++it) {
+        size_t shared = it == first ? 0 : common_prefix(it->data() + skip, it->size() - skip,
+                                                        (it - 1)->data() + skip, (it - 1)->size() - skip);
+        put_entry(nd->entries, shared, it->data() + skip + shared, it->size() - skip - shared);
+    }
+}
+
+template <size_t B>
+typename btree_string_set<B>::Node* btree_string_set<B>::split(Node *nd, std::string& separator) {
+    std::vector<std::string> keys;
+    decode(nd, keys);
+    size_t half = keys.size() / 2;
+    Node *right = new Node(nd->leaf);
+    if (nd->leaf) {
+        // the shortest string greater than the last key on the left and not greater than the first on the
+        // right, so the internal nodes hold short keys
+        const std::string& last = keys[half - 1];
+        const std::string& first = keys[half];
+        separator.assign(first, 0, common_prefix(last.data(), last.size(), first.data(), first.size()) + 1);
+        encode(right, keys.begin() + half, keys.end());
+        right->next = nd->next;
+        right->prev = nd;
+        if (nd->next != nullptr)
+            nd->next->prev = right;
+        nd->next = right;
+    } else {
+        // the middle key moves up, the children on both sides of it stay with their keys
+        separator = keys[half];
+        encode(right, keys.begin() + half + 1, keys.end());
+        right->children.assign(nd->children.begin() + half + 1, nd->children.end());
+        nd->children.resize(half + 1);
+    }
+    encode(nd, keys.begin(), keys.begin() + half);
+    return right;
+}
+
+template <size_t B>
+bool btree_string_set<B>::insert(const char *key, size_t length) {
+    if (root_ == nullptr) {
+        root_ = new Node(true);
+        add_key(root_, key, length);
+        size_ = 1;
+        return true;
+    }
+    // descend to the leaf, noting the path for the splits
+    std::vector<std::pair<Node*, size_t>> path;
+    Node *nd = root_;
+    while (!nd->leaf) {
+        size_t i = child_index(nd, key, length);
+        path.emplace_back(nd, i);
+        nd = nd->children[i];
+    }
+    if (locate(nd, key, length).found)
+        return false;
+    add_key(nd, key, length);
+    ++size_;
+    // split the nodes that are over B bytes, from the leaf up
+    while (overfull(nd)) {
+        std::string separator;
+        Node *right = split(nd, separator);
+        if (path.empty()) {
+            Node *top = new Node(false);
+            add_key(top, separator.data(), separator.size());
+            top->children.push_back(nd);
+            top->children.push_back(right);
+            root_ = top;
+            break;
+        }
+        Node *parent = path.back().first;
+        path.pop_back();
+        size_t i = add_key(parent, separator.data(), separator.size());
+        parent->children.insert(parent->children.begin() + i + 1, right);
+        nd = parent;
+    }
+    return true;
+}
+
+template <size_t B>
+size_t btree_string_set<B>::erase(const std::string& key) {
+    if (root_ == nullptr)
+        return 0;
+    std::vector<std::pair<Node*, size_t>> path;
+    Node *nd = root_;
+    while (!nd->leaf) {
+        size_t i = child_index(nd, key.data(), key.size());
+        path.emplace_back(nd, i);
+        nd = nd->children[i];
+    }
+    Probe p = locate(nd, key.data(), key.size());
+    if (!p.found)
+        return 0;
+    remove_entry(nd, p.offset);
+    --size_;
+    // free the nodes left empty, from the leaf up
+    while (nd->leaf ? nd->count == 0 : nd->children.empty()) {
+        if (nd->leaf) {
+            if (nd->prev != nullptr)
+                nd->prev->next = nd->next;
+            if (nd->next != nullptr)
+                nd->next->prev = nd->prev;
+        }
+        delete nd;
+        if (path.empty()) {
+            root_ = nullptr;
+            return 1;
+        }
+        Node *parent = path.back().first;
+        size_t i = path.back().second;
+        path.pop_back();
+        // the key before the child goes with it (the one after it, for the first child)
+        parent->children.erase(parent->children.begin() + i);
+        if (parent->count > 0)
+            remove_entry(parent, entry_offset(parent, i > 0 ? i - 1 : 0));
+        nd = parent;
+    }
+    // a root with one child is replaced by it
+    while (!root_->leaf && root_->children.size() == 1) {
+        Node *top = root_;
+        root_ = top->children[0];
+        delete top;
+    }
+    return 1;
+}
+
+template <size_t B>
+const typename btree_string_set<B>::Node* btree_string_set<B>::find_leaf(const char *key, size_t length) const {
+    const Node *nd = root_;
+    while (nd != nullptr && !nd->leaf)
+        nd = nd->children[child_index(nd, key, length)];
+    return nd;
+}
+
+template <size_t B>
+bool btree_string_set<B>::contains(const std::string& key) const {
+    return find(key) != end();
+}
+
+template <size_t B>
+typename btree_string_set<B>::const_iterator btree_string_set<B>::find(const std::string& key) const {
+    const Node *leaf = find_leaf(key.data(), key.size());
+    if (leaf == nullptr)
+        return end();
+    Probe p = locate(leaf, key.data(), key.size());
+    return p.found ? const_iterator(this, leaf, p.pos) : end();
+}
+
+template <size_t B>
+typename btree_string_set<B>::const_iterator btree_string_set<B>::lower_bound(const std::string& key) const {
+    const Node *leaf = find_leaf(key.data(), key.size());
+    if (leaf == nullptr)
+        return end();
+    // the keys of the next leaf are not less than the separator above it, which is greater than 'key'
+    size_t pos = locate(leaf, key.data(), key.size()).pos;
+    return pos < leaf->count ? const_iterator(this, leaf, pos) : const_iterator(this, leaf->next, 0);
+}
+
+template <size_t B>
+size_t btree_string_set<B>::height() const {
+    size_t levels = 0;
+    for (const Node *nd = root_; nd != nullptr; nd = nd->leaf ? nullptr : nd->children[0])
+        ++levels;
+    return levels;
+}
+
+template <size_t B>
+const typename btree_string_set<B>::Node* btree_string_set<B>::first_leaf() const {
+    const Node *nd = root_;
+    while (nd != nullptr && !nd->leaf)
+        nd = nd->children.front();
+    return nd;
+}
+
+template <size_t B>
+const typename btree_string_set<B>::Node* btree_string_set<B>::last_leaf() const {
+    const Node *nd = root_;
+    while (nd != nullptr && !nd->leaf)
+        nd = nd->children.back();
+    return nd;
+}
+
+template <size_t B>
+typename btree_string_set<B>::Node* btree_string_set<B>::copy_tree(const Node *nd, Node*& last_leaf) {
+    Node *copy = new Node(nd->leaf);
+    copy->count = nd->count;
+    copy->prefix = nd->prefix;
+    copy->entries = nd->entries;
+    if (nd->leaf) {
+        // the leaves are copied in order, each is linked to the one before
+        copy->prev = last_leaf;
+        if (last_leaf != nullptr)
+            last_leaf->next = copy;
+        last_leaf = copy;
+    } else {
+        for (const Node *c : nd->children)
+            copy->children.push_back(copy_tree(c, last_leaf));
+    }
+    return copy;
+}
+
+template <size_t B>
+void btree_string_set<B>::destroy(Node *nd) {
+    if (nd == nullptr)
+        return;
+    for (Node *c : nd->children)
+        destroy(c);
+    delete nd;
+}
+
+template <size_t B>
+size_t btree_string_set<B>::memory_usage(const Node *nd) {
+    if (nd == nullptr)
+        return 0;
+    // a string's own bytes are inside the node while they fit in it
+    size_t bytes = sizeof(Node) + nd->children.capacity() * sizeof(Node*);
+    for (const std::string *s : {&nd->prefix, &nd->entries})
+        if (s->capacity() > std::string().capacity())
+            bytes += s->capacity() + 1;
+    for (const Node *c : nd->children)
+        bytes += memory_usage(c);
+    return bytes;
+}
+
+#endif
@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <numeric>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "btree.h"
+
+// checks that the tree holds exactly the values of the set, in both directions
+bool same_contents(const btree<int> &b, const std::set<int> &s) {
+  if (!std::equal(s.begin(), s.end(), b.begin(), b.end()))
+    return false;
+  if (!std::equal(s.rbegin(), s.rend(), b.rbegin(), b.rend()))
+    return false;
+  for (auto i : s)
+    if (b.find(i) == b.end() || *b.find(i) != i)
+      return false;
+  return b.find(-1) == b.end();
+}
+
+// inserts the keys into a split mode tree and prints the resulting height
+void load(const std::string &name, const std::vector<int> &keys, size_t maxNodeElems) {
+  btree<int> b(maxNodeElems, true);
+  std::set<int> s;
+  for (auto k : keys) {
+    bool inserted = b.insert(k).second;
+    if (inserted != s.insert(k).second) {
+      std::cout << name << ": insert of " << k << " returned wrong flag" << std::endl;
+      return;
+    }
+  }
+  // inserting again must find the existing element
+  if (b.insert(keys.front()).second || *b.insert(keys.front()).first != keys.front())
+    std::cout << name << ": duplicate inserted" << std::endl;
+  const btree<int> c(b);
+  std::cout << name << " " << maxNodeElems << ": height " << b.height()
+            << (same_contents(b, s) && same_contents(c, s) ? " ok" : " MISMATCH") << std::endl;
+}
+
+int main(void) {
+  const int n = 100000;
+  std::vector<int> sorted(n);
+  for (int i = 0; i < n; ++i)
+    sorted[i] = i * 2;
+  std::vector<int> reversed(sorted.rbegin(), sorted.rend());
+  std::vector<int> shuffled(sorted);
+  std::mt19937 gen(6771);
+  for (size_t i = shuffled.size() - 1; i > 0; --i)
+    std::swap(shuffled[i], shuffled[gen() % (i + 1)]);
+
+  for (size_t maxNodeElems : {2, 5, 40}) {
+    load("sorted", sorted, maxNodeElems);
+    load("reverse", reversed, maxNodeElems);
+    load("random", shuffled, maxNodeElems);
+  }
+
+  // random keys that land at the end of a node inside the tree split it in the middle, so only the root can
+  // be below half full; sorted keys still fill the nodes
+  for (const auto *keys : {&shuffled, &sorted}) {
+    btree<int> f(40, true);
+    for (auto k : *keys)
+      f.insert(k);
+    auto stats = f.stats();
+    size_t below_half = std::accumulate(stats.fill_histogram.begin(), stats.fill_histogram.begin() + 5, size_t(0));
+    std::cout << (keys == &sorted ? "sorted" : "random") << " 40: nodes " << stats.nodes << ", below half full "
+              << below_half << ", full " << stats.fill_histogram[9] << std::endl;
+  }
+
+  // small tree, the breadth-first output shows the promoted elements
+  btree<int> b(2, true);
+  for (int i = 1; i <= 7; ++i)
+    b.insert(i);
+  std::cout << b << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,61 @@
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <set>
+#include <string>
+
+#include "btree.h"
+#include "btree_allocator.h"
+
+typedef btree<long, 0, std::less<long>, btree_arena_allocator<long>> arena_tree;
+
+bool same_contents(const arena_tree &b, const std::set<long> &s) {
+  return std::equal(s.begin(), s.end(), b.begin(), b.end()) &&
+         std::equal(s.rbegin(), s.rend(), b.rbegin(), b.rend());
+}
+
+int main(void) {
+  for (bool split : {false, true}) {
+    arena_tree b(16, split);
+    std::set<long> s;
+    long x = 1;
+    for (int i = 0; i < 20000; ++i) {
+      x = (x * 48271) % 2147483647;
+      b.insert(x % 100000);
+      s.insert(x % 100000);
+    }
+    std::cout << (split ? "split" : "overflow") << ": "
+              << (same_contents(b, s) ? "ok" : "MISMATCH") << std::endl;
+
+    // a copy has its own arena and survives the original
+    arena_tree *original = new arena_tree(b);
+    arena_tree copy(*original);
+    std::cout << "copy has own arena: " << (copy.get_allocator() != original->get_allocator()) << std::endl;
+    delete original;
+    std::cout << "copy: " << (same_contents(copy, s) ? "ok" : "MISMATCH") << std::endl;
+
+    // assignment keeps the target's arena and replaces the contents
+    arena_tree assigned(4, split);
+    assigned.insert(-1);
+    auto arena = assigned.get_allocator();
+    assigned = copy;
+    std::cout << "assigned: " << (same_contents(assigned, s) ? "ok" : "MISMATCH")
+              << ", same arena: " << (assigned.get_allocator() == arena) << std::endl;
+
+    // moved-from tree is empty and still usable
+    arena_tree moved(std::move(copy));
+    copy.insert(7);
+    std::cout << "moved: " << (same_contents(moved, s) ? "ok" : "MISMATCH")
+              << ", moved-from: " << *copy.begin() << std::endl;
+  }
+
+  // element types with destructors are destroyed one by one
+  btree<std::string, 0, std::less<std::string>, btree_arena_allocator<std::string>> words(3, true);
+  for (auto w : {"delta", "alpha", "echo", "charlie", "bravo", "foxtrot", "golf"})
+    words.insert(w);
+  auto copied = words;
+  std::copy(copied.begin(), copied.end(), std::ostream_iterator<std::string>(std::cout, " "));
+  std::cout << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,47 @@
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <set>
+#include <string>
+
+#include "btree.h"
+
+// loads the same pseudo-random keys into a fixed capacity tree and a set, compares them
+template <typename Tree, typename Key>
+void check(const std::string &name, bool split, Key (*make_key)(long)) {
+  Tree b(0, split);
+  std::set<Key> s;
+  long x = 1;
+  for (int i = 0; i < 5000; ++i) {
+    x = (x * 48271) % 2147483647;
+    Key k = make_key(x % 20000);
+    if (b.insert(k).second != s.insert(k).second)
+      std::cout << name << ": insert returned wrong flag" << std::endl;
+  }
+  const Tree c(b);
+  bool ok = std::equal(s.begin(), s.end(), c.begin(), c.end()) &&
+            std::equal(s.rbegin(), s.rend(), c.rbegin(), c.rend());
+  for (long i = 0; i < 20000 && ok; i += 7)
+    ok = (c.find(make_key(i)) != c.end()) == (s.count(make_key(i)) == 1);
+  std::cout << name << (split ? " split: " : " overflow: ") << (ok ? "ok" : "MISMATCH") << std::endl;
+}
+
+long long_key(long i) { return i; }
+int int_key(long i) { return static_cast<int>(i); }
+std::string string_key(long i) { return "key" + std::to_string(i); }
+
+int main(void) {
+  for (bool split : {false, true}) {
+    check<btree<int, 2>>("btree<int, 2>", split, int_key);
+    check<btree<int, 7>>("btree<int, 7>", split, int_key);
+    check<btree<long, btree_default_node_elems<long>()>>("btree<long, default>", split, long_key);
+    check<fixed_btree<int>>("fixed_btree<int>", split, int_key);
+    check<btree<std::string, 3>>("btree<string, 3>", split, string_key);
+  }
+
+  // the default node capacity fills whole cache lines and holds a few elements even for large types
+  struct big { char bytes[200]; };
+  std::cout << "default capacity for 200 byte elements: " << btree_default_node_elems<big>() << std::endl;
+
+  return 0;
+}
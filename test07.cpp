@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "btree.h"
+
+// compares btree_search with std::lower_bound on sorted arrays of every size up to 100,
+// searching for every element, the values between them and values outside the range
+template <typename T>
+bool check_search(const std::vector<T> &values) {
+  for (size_t size = 0; size <= values.size(); ++size) {
+    std::vector<T> probes(values.begin(), values.begin() + size);
+    for (size_t i = 0; i < size; ++i)
+      probes.push_back(values[i] + 1);
+    probes.push_back(std::numeric_limits<T>::lowest());
+    probes.push_back(std::numeric_limits<T>::max());
+    for (auto p : probes) {
+      size_t expected = std::lower_bound(values.begin(), values.begin() + size, p) - values.begin();
+      if (btree_search<T>::lower_bound(values.data(), size, p) != expected)
+        return false;
+    }
+  }
+  return true;
+}
+
+// sorted values spread over the whole range of T, including negative ones for signed types
+template <typename T>
+std::vector<T> spread(T low, T step) {
+  std::vector<T> values;
+  for (int i = 0; i < 100; ++i)
+    values.push_back(static_cast<T>(low + step * i));
+  return values;
+}
+
+// loads pseudo-random keys into a split mode tree and a set and compares them
+template <typename T>
+bool check_tree(T scale) {
+  btree<T> b(16, true);
+  std::set<T> s;
+  long x = 1;
+  for (int i = 0; i < 5000; ++i) {
+    x = (x * 48271) % 2147483647;
+    T k = static_cast<T>(static_cast<T>(x % 10000) * scale);
+    if (b.insert(k).second != s.insert(k).second)
+      return false;
+  }
+  for (auto k : s) {
+    T next = static_cast<T>(k + 1);
+    if (b.find(k) == b.end() || (b.find(next) != b.end()) != (s.count(next) == 1))
+      return false;
+  }
+  return std::equal(s.begin(), s.end(), b.begin(), b.end());
+}
+
+int main(void) {
+  std::cout << "int: " << check_search(spread<int>(-2000000000, 40000000)) << std::endl;
+  std::cout << "unsigned: " << check_search(spread<unsigned>(1, 42000000)) << std::endl;
+  std::cout << "long: " << check_search(spread<long>(-9000000000000000000L, 180000000000000000L)) << std::endl;
+  std::cout << "unsigned long: " << check_search(spread<unsigned long>(1, 180000000000000000UL)) << std::endl;
+  std::cout << "float: " << check_search(spread<float>(-1000.5f, 20.25f)) << std::endl;
+  std::cout << "double: " << check_search(spread<double>(-1e300, 2e298)) << std::endl;
+  std::cout << "short: " << check_search(spread<short>(-30000, 600)) << std::endl;
+
+  std::cout << "btree<int>: " << check_tree<int>(-3) << std::endl;
+  std::cout << "btree<unsigned long>: " << check_tree<unsigned long>(1UL << 50) << std::endl;
+  std::cout << "btree<double>: " << check_tree<double>(-0.5) << std::endl;
+
+  return 0;
+}
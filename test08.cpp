@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <list>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "btree.h"
+
+// checks that the tree holds exactly the values of the set, in both directions
+template <typename Tree, typename Set>
+bool same_contents(const Tree &b, const Set &s) {
+  return std::equal(s.begin(), s.end(), b.begin(), b.end()) &&
+         std::equal(s.rbegin(), s.rend(), b.rbegin(), b.rend());
+}
+
+// element whose copy constructor throws after a number of copies, and counts the elements alive
+struct Fragile {
+  Fragile(int v) : value(v) { ++alive; }
+  Fragile(const Fragile &other) : value(other.value) {
+    if (copies_left-- == 0)
+      throw std::string("copy failed");
+    ++alive;
+  }
+  ~Fragile() { --alive; }
+  Fragile &operator=(const Fragile &) = default;
+  bool operator<(const Fragile &other) const { return value < other.value; }
+  int value;
+  static int copies_left, alive;
+};
+int Fragile::copies_left = -1, Fragile::alive = 0;
+// counts copies in a global, so it must not be copied on several threads
+template <> struct btree_parallel_elems<Fragile> : std::false_type {};
+
+int main(void) {
+  // sorted input of every size up to 200, in both insert modes, then more elements inserted
+  bool ok = true;
+  for (size_t maxNodeElems : {1, 2, 3, 40}) {
+    for (bool split : {false, true}) {
+      for (int n = 0; n <= 200 && ok; ++n) {
+        std::vector<int> sorted;
+        for (int i = 0; i < n; ++i)
+          sorted.push_back(i * 2);
+        btree<int> b(sorted.begin(), sorted.end(), maxNodeElems, split);
+        std::set<int> s(sorted.begin(), sorted.end());
+        ok = same_contents(b, s);
+        for (int i = -1; i <= 2 * n + 1; i += 2)
+          ok = ok && b.insert(i).second && s.insert(i).second;
+        ok = ok && same_contents(b, s);
+      }
+    }
+  }
+  std::cout << "sorted input: " << (ok ? "ok" : "MISMATCH") << std::endl;
+
+  // packed nodes: 7 elements fill a root and two leaves of 3
+  std::vector<int> seven{1, 2, 3, 4, 5, 6, 7};
+  btree<int> packed(seven.begin(), seven.end(), 3, true);
+  std::cout << packed << std::endl;
+
+  // unsorted input with duplicates is sorted and deduplicated
+  std::list<int> unsorted{5, 3, 9, 3, 1, 5, 7, 9};
+  btree<int> dedup(unsorted.begin(), unsorted.end(), 2, true);
+  std::copy(dedup.begin(), dedup.end(), std::ostream_iterator<int>(std::cout, " "));
+  std::cout << std::endl;
+
+  // bulk_load replaces the contents
+  dedup.bulk_load(seven.begin(), seven.begin() + 3);
+  std::copy(dedup.begin(), dedup.end(), std::ostream_iterator<int>(std::cout, " "));
+  std::cout << std::endl;
+
+  // single pass input: the reverse-sorted word list, read straight from the file
+  std::ifstream wordFile("twl.txt");
+  if (!wordFile)
+    return 1;
+  btree<std::string> words(std::istream_iterator<std::string>(wordFile), std::istream_iterator<std::string>(), 40, true);
+  wordFile.close();
+  wordFile.open("twl.txt");
+  std::set<std::string> wordSet(std::istream_iterator<std::string>(wordFile), (std::istream_iterator<std::string>()));
+  std::cout << "twl.txt: " << wordSet.size() << " words, height " << words.height() << ", "
+            << (same_contents(words, wordSet) ? "ok" : "MISMATCH") << std::endl;
+  std::cout << *words.begin() << " " << *words.rbegin() << std::endl;
+
+  // a load that throws part way frees the nodes and elements it had made, from a constructor and from a
+  // batch insert into an empty tree
+  std::vector<Fragile> source;
+  for (int i = 0; i < 1000; ++i)
+    source.push_back(Fragile(i));
+  int thrown = 0;
+  bool freed = true;
+  for (bool split : {false, true}) {
+    for (int fail : {0, 1, 37, 300, 999}) {
+      Fragile::copies_left = fail;
+      try {
+        btree<Fragile> loaded(source.begin(), source.end(), 4, split);
+      } catch (const std::string &) {
+        ++thrown;
+      }
+      freed = freed && Fragile::alive == 1000;
+      btree<Fragile> batch(4, split);
+      Fragile::copies_left = fail;
+      try {
+        batch.insert(source.begin(), source.end());
+      } catch (const std::string &) {
+        ++thrown;
+      }
+      Fragile::copies_left = -1;
+      freed = freed && batch.size() == 0 && batch.begin() == batch.end() && Fragile::alive == 1000;
+    }
+  }
+  std::cout << "throwing loads " << thrown << ", freed " << freed << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <iostream>
+#include <list>
+#include <map>
+#include <new>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "btree.h"
+
+// checks that the tree holds exactly the values of the set, in both directions
+template <typename Tree, typename Set>
+bool same_contents(const Tree &b, const Set &s) {
+  return std::equal(s.begin(), s.end(), b.begin(), b.end()) &&
+         std::equal(s.rbegin(), s.rend(), b.rbegin(), b.rend());
+}
+
+// allocator that keeps the blocks it hands out, so an element can tell whether it is in a node,
+// and fails after a number of allocations
+static std::map<const char *, size_t> blocks;
+static long allocations_left = -1;
+template <typename T>
+struct Tracking {
+  typedef T value_type;
+  Tracking() = default;
+  template <typename U>
+  Tracking(const Tracking<U> &) {}
+  T *allocate(size_t n) {
+    if (allocations_left-- == 0)
+      throw std::bad_alloc();
+    T *p = std::allocator<T>().allocate(n);
+    blocks[reinterpret_cast<const char *>(p)] = n * sizeof(T);
+    return p;
+  }
+  void deallocate(T *p, size_t n) {
+    blocks.erase(reinterpret_cast<const char *>(p));
+    std::allocator<T>().deallocate(p, n);
+  }
+};
+template <typename T, typename U>
+bool operator==(const Tracking<T> &, const Tracking<U> &) { return true; }
+template <typename T, typename U>
+bool operator!=(const Tracking<T> &, const Tracking<U> &) { return false; }
+static bool in_node(const void *p) {
+  auto block = blocks.upper_bound(static_cast<const char *>(p));
+  return block != blocks.begin() && static_cast<const char *>(p) < std::prev(block)->first + std::prev(block)->second;
+}
+
+// element whose copy from outside the tree throws after a number of copies (moves inside the nodes never throw)
+struct Fragile {
+  Fragile(int v) : value(v) {}
+  Fragile(const Fragile &other) : value(other.value) {
+    if (!in_node(&other) && copies_left-- == 0)
+      throw std::string("copy failed");
+  }
+  Fragile &operator=(const Fragile &) = default;
+  bool operator<(const Fragile &other) const { return value < other.value; }
+  int value;
+  static long copies_left;
+};
+long Fragile::copies_left = -1;
+
+int main(void) {
+  // random batches, mixed with single inserts, compared with std::set
+  std::mt19937 gen(9);
+  bool ok = true;
+  for (size_t maxNodeElems : {1, 2, 3, 5, 40}) {
+    for (bool split : {false, true}) {
+      for (int range : {50, 1000, 100000}) {
+        btree<int> b(maxNodeElems, split);
+        std::set<int> s;
+        for (int round = 0; round < 10 && ok; ++round) {
+          std::vector<int> batch(gen() % 500);
+          for (auto &elem : batch)
+            elem = gen() % range;
+          size_t before = s.size();
+          s.insert(batch.begin(), batch.end());
+          auto counts = b.insert(batch.begin(), batch.end());
+          ok = counts.first == s.size() - before && counts.first + counts.second == batch.size();
+          for (int i = 0; i < 20; ++i) {
+            int elem = gen() % range;
+            ok = ok && b.insert(elem).second == s.insert(elem).second;
+          }
+          ok = ok && same_contents(b, s);
+        }
+      }
+    }
+  }
+  std::cout << "random batches: " << (ok ? "ok" : "MISMATCH") << std::endl;
+
+  // counts of new elements and duplicates, duplicates inside the batch included
+  btree<int> b(3);
+  int first[] = {5, 1, 9, 1, 5, 7};
+  auto counts = b.insert_batch(first, 6);
+  std::cout << counts.first << " new, " << counts.second << " duplicates" << std::endl;
+  int second[] = {7, 2, 8, 9, 0, 2};
+  counts = b.insert_batch(second, 6);
+  std::cout << counts.first << " new, " << counts.second << " duplicates" << std::endl;
+  counts = b.insert_batch(second, 0);
+  std::cout << counts.first << " new, " << counts.second << " duplicates" << std::endl;
+  for (auto elem : b)
+    std::cout << elem << " ";
+  std::cout << std::endl;
+
+  // input iterators of another container, and a batch in decreasing order
+  std::list<int> l{30, 20, 10};
+  counts = b.insert(l.begin(), l.end());
+  std::cout << counts.first << " new, " << counts.second << " duplicates" << std::endl;
+  std::vector<int> down;
+  for (int i = 100; i > 0; --i)
+    down.push_back(i);
+  btree<int> c(4, true);
+  c.insert(50);
+  counts = c.insert(down.begin(), down.end());
+  std::cout << counts.first << " new, " << counts.second << " duplicates, height " << c.height() << std::endl;
+  std::set<int> ds(down.begin(), down.end());
+  std::cout << "decreasing batch: " << (same_contents(c, ds) ? "ok" : "MISMATCH") << std::endl;
+
+  // a batch that throws part way (an element that cannot be copied in, or a node that cannot be allocated)
+  // keeps the elements that were in the tree, and loses no node
+  for (bool split : {false, true}) {
+    int thrown = 0;
+    bool intact = true;
+    for (int allocation : {0, 1}) {
+      for (long fail = 0; fail < 300; fail += 3) {
+        btree<Fragile, 0, std::less<Fragile>, Tracking<Fragile>> f(3, split);
+        std::vector<Fragile> batch;
+        for (int i = 0; i < 60; ++i) {
+          f.insert(Fragile(i * 4));
+          batch.push_back(Fragile(i * 4 + 1 + i % 3));
+        }
+        (allocation ? allocations_left : Fragile::copies_left) = fail;
+        try {
+          f.insert(batch.begin(), batch.end());
+        } catch (const std::string &) {
+          ++thrown;
+        } catch (const std::bad_alloc &) {
+          ++thrown;
+        }
+        allocations_left = Fragile::copies_left = -1;
+        std::vector<int> seen;
+        for (const auto &elem : f)
+          seen.push_back(elem.value);
+        intact = intact && std::is_sorted(seen.begin(), seen.end()) && seen.size() >= 60 && seen.size() == f.size() &&
+                 f.select(seen.size() - 1)->value == seen.back() &&
+                 std::count_if(seen.begin(), seen.end(), [](int v) { return v % 4 == 0; }) == 60;
+      }
+    }
+    std::cout << (split ? "split" : "default") << ": throwing batches " << thrown << ", intact " << intact
+              << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "btree.h"
+
+// checks that the tree holds exactly the values of the set, in both directions
+template <typename Tree, typename Set>
+bool same_contents(const Tree &b, const Set &s) {
+  return std::equal(s.begin(), s.end(), b.begin(), b.end()) &&
+         std::equal(s.rbegin(), s.rend(), b.rbegin(), b.rend());
+}
+
+int main(void) {
+  // erase from small trees, printed breadth-first after each step
+  for (bool split : {false, true}) {
+    btree<int> b(3, split);
+    for (int i : {50, 20, 80, 10, 30, 60, 90, 40, 70, 25, 35, 5})
+      b.insert(i);
+    std::cout << b << std::endl;
+    for (int i : {30, 50, 5, 99, 80, 20}) {
+      size_t erased = b.erase(i);
+      std::cout << "erase " << i << " (" << erased << "): " << b << std::endl;
+    }
+  }
+
+  // erase through iterators returns the element after the erased one
+  btree<int> c(4, true);
+  for (int i = 1; i <= 20; ++i)
+    c.insert(i);
+  auto it = c.erase(c.find(7));
+  std::cout << "after 7: " << *it << std::endl;
+  it = c.erase(c.begin());
+  std::cout << "after 1: " << *it << std::endl;
+  it = c.erase(c.find(20));
+  std::cout << "after 20: " << (it == c.end() ? "end" : "not end") << std::endl;
+  it = c.erase(c.find(5), c.find(15));
+  std::cout << "after [5, 15): " << *it << std::endl;
+  for (auto elem : c)
+    std::cout << elem << " ";
+  std::cout << std::endl;
+  it = c.erase(c.find(16), c.end());
+  std::cout << "after [16, end): " << (it == c.end() ? "end" : "not end") << ", " << c << std::endl;
+  c.erase(c.begin(), c.end());
+  std::cout << "empty: " << (c.begin() == c.end()) << ", height " << c.height() << std::endl;
+
+  // split mode: the tree gets lower as it empties, and all elements can be erased
+  btree<int> d(3, true);
+  for (int i = 0; i < 1000; ++i)
+    d.insert(i);
+  std::cout << "height " << d.height();
+  for (int i = 0; i < 1000; i += 2)
+    d.erase(i);
+  std::cout << ", after erasing half " << d.height();
+  for (int i = 1; i < 1000; i += 2)
+    d.erase(i);
+  std::cout << ", after erasing all " << d.height() << std::endl;
+
+  // random erases of single elements and ranges, mixed with inserts, compared with std::set
+  std::mt19937 gen(10);
+  bool ok = true;
+  for (size_t maxNodeElems : {1, 2, 3, 4, 7, 40}) {
+    for (bool split : {false, true}) {
+      for (int round = 0; round < 20 && ok; ++round) {
+        std::vector<int> elems(gen() % 1000);
+        for (auto &elem : elems)
+          elem = gen() % 2000;
+        btree<int> b(elems.begin(), elems.end(), maxNodeElems, split);
+        std::set<int> s(elems.begin(), elems.end());
+        for (int op = 0; op < 50 && ok; ++op) {
+          int elem = gen() % 2000;
+          switch (gen() % 4) {
+          case 0:
+            ok = b.erase(elem) == s.erase(elem);
+            break;
+          case 1:
+            b.insert(elem);
+            s.insert(elem);
+            break;
+          default:
+            // erase from the first element not less than 'elem' up to another one, or to the end
+            int upper = elem + gen() % 300;
+            auto first = std::find_if(b.begin(), b.end(), [elem] (int i) { return i >= elem; });
+            auto last = std::find_if(b.begin(), b.end(), [upper] (int i) { return i >= upper; });
+            auto next = b.erase(first, last);
+            auto s_next = s.erase(s.lower_bound(elem), s.lower_bound(upper));
+            ok = (next == b.end()) == (s_next == s.end()) && (s_next == s.end() || *next == *s_next);
+          }
+          ok = ok && same_contents(b, s);
+        }
+      }
+    }
+  }
+  std::cout << "random erases: " << (ok ? "ok" : "MISMATCH") << std::endl;
+
+  return 0;
+}
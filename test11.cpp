@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "btree.h"
+
+int main(void) {
+  // bounds on a small tree, for elements in the tree, between them and outside
+  btree<int> b(3);
+  for (int i : {40, 10, 70, 20, 60, 30, 50})
+    b.insert(i);
+  for (int i : {5, 10, 25, 40, 70, 75}) {
+    auto lower = b.lower_bound(i), upper = b.upper_bound(i);
+    auto range = b.equal_range(i);
+    std::cout << i << ": lower " << (lower == b.end() ? std::string("end") : std::to_string(*lower))
+              << ", upper " << (upper == b.end() ? std::string("end") : std::to_string(*upper))
+              << ", equal_range size " << std::distance(range.first, range.second) << std::endl;
+  }
+
+  // const tree and a walk from lower_bound to upper_bound
+  std::vector<std::string> fruit{"kiwi", "apple", "fig", "pear", "banana", "cherry", "lime"};
+  const btree<std::string> words(fruit.begin(), fruit.end(), 2, true);
+  auto first = words.lower_bound("b"), last = words.upper_bound("lime");
+  for (auto it = first; it != last; ++it)
+    std::cout << *it << " ";
+  std::cout << std::endl;
+
+  // scan visits [lo, hi) in order
+  size_t count = words.scan("c", "m", [] (const std::string &word) { std::cout << word << " "; });
+  std::cout << "(" << count << " words)" << std::endl;
+  count = words.scan("m", "c", [] (const std::string &word) { std::cout << word << " "; });
+  std::cout << "(" << count << " words)" << std::endl;
+
+  // random queries in both insert modes, compared with std::set
+  std::mt19937 gen(11);
+  bool ok = true;
+  for (size_t maxNodeElems : {1, 2, 3, 5, 40}) {
+    for (bool split : {false, true}) {
+      btree<int> t(maxNodeElems, split);
+      std::set<int> s;
+      for (int i = 0; i < 2000; ++i) {
+        int elem = gen() % 5000;
+        t.insert(elem);
+        s.insert(elem);
+      }
+      for (int i = 0; i < 2000 && ok; ++i) {
+        int elem = gen() % 5200 - 100;
+        auto lower = t.lower_bound(elem), upper = t.upper_bound(elem);
+        auto s_lower = s.lower_bound(elem), s_upper = s.upper_bound(elem);
+        ok = (lower == t.end() ? s_lower == s.end() : s_lower != s.end() && *lower == *s_lower) &&
+             (upper == t.end() ? s_upper == s.end() : s_upper != s.end() && *upper == *s_upper);
+        int hi = elem + gen() % 500;
+        std::vector<int> scanned;
+        t.scan(elem, hi, [&scanned] (int i) { scanned.push_back(i); });
+        ok = ok && std::equal(scanned.begin(), scanned.end(), s_lower, s.lower_bound(hi)) &&
+             scanned.size() == static_cast<size_t>(std::distance(s_lower, s.lower_bound(hi)));
+      }
+    }
+  }
+  std::cout << "random queries: " << (ok ? "ok" : "MISMATCH") << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "btree.h"
+
+int main(void) {
+  // size, rank, select and count on a small tree
+  btree<int> b(3);
+  std::cout << "empty: size " << b.size() << ", rank " << b.rank(5) << ", select(0) is end "
+            << (b.select(0) == b.end()) << std::endl;
+  for (int i : {50, 20, 80, 10, 30, 60, 90, 40, 70})
+    b.insert(i);
+  b.insert(50);
+  std::cout << "size " << b.size() << std::endl;
+  for (int i : {5, 10, 45, 50, 90, 95})
+    std::cout << "rank(" << i << ") = " << b.rank(i) << std::endl;
+  for (size_t i = 0; i <= b.size(); ++i) {
+    auto it = b.select(i);
+    std::cout << (it == b.end() ? "end" : std::to_string(*it)) << " ";
+  }
+  std::cout << std::endl;
+  std::cout << "count [20, 60) " << b.count(20, 60) << ", count [60, 20) " << b.count(60, 20) << std::endl;
+
+  // iterator arithmetic: median and pagination by offset
+  const btree<int> &cb = b;
+  auto median = cb.begin() + cb.size() / 2;
+  std::cout << "median " << *median << ", offset " << (median - cb.begin()) << ", to end " << (cb.end() - median)
+            << std::endl;
+  auto it = b.end();
+  it -= 3;
+  std::cout << "3 from the end " << *it << ", then back 2: " << *(it - 2) << std::endl;
+
+  // random inserts and erases in both modes, compared with std::set
+  std::mt19937 gen(12);
+  bool ok = true;
+  for (size_t maxNodeElems : {1, 2, 3, 5, 40}) {
+    for (bool split : {false, true}) {
+      btree<int> t(maxNodeElems, split);
+      std::set<int> s;
+      for (int round = 0; round < 40 && ok; ++round) {
+        for (int i = 0; i < 100; ++i) {
+          int elem = gen() % 3000;
+          if (gen() % 3 == 0) {
+            t.erase(elem);
+            s.erase(elem);
+          } else {
+            t.insert(elem);
+            s.insert(elem);
+          }
+        }
+        ok = t.size() == s.size();
+        for (int i = 0; i < 20 && ok; ++i) {
+          int elem = gen() % 3000, hi = elem + gen() % 500;
+          auto lower = s.lower_bound(elem);
+          size_t rank = std::distance(s.begin(), lower);
+          ok = t.rank(elem) == rank &&
+               t.count(elem, hi) == static_cast<size_t>(std::distance(lower, s.lower_bound(hi))) &&
+               (lower == s.end() ? t.select(rank) == t.end() : *t.select(rank) == *lower) &&
+               t.begin() + rank == t.lower_bound(elem) && t.lower_bound(elem) - t.begin() == static_cast<long>(rank);
+        }
+      }
+    }
+  }
+  std::cout << "random order statistics: " << (ok ? "ok" : "MISMATCH") << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "btree.h"
+#include "btree_allocator.h"
+
+// element whose copy constructor throws after a number of copies
+struct Fragile {
+  Fragile(int v) : value(v) {}
+  Fragile(const Fragile &other) : value(other.value) {
+    if (copies_left-- == 0)
+      throw std::string("copy failed");
+  }
+  Fragile &operator=(const Fragile &) = default;
+  bool operator<(const Fragile &other) const { return value < other.value; }
+  int value;
+  static int copies_left;
+};
+int Fragile::copies_left = -1;
+// counts copies in a global, so it must not be copied on several threads
+template <> struct btree_parallel_elems<Fragile> : std::false_type {};
+
+// allocator that throws after a number of allocations, and counts the blocks not freed yet
+static long allocations_left = -1, live_blocks = 0;
+template <typename T>
+struct Limited {
+  typedef T value_type;
+  Limited() = default;
+  template <typename U>
+  Limited(const Limited<U> &) {}
+  T *allocate(size_t n) {
+    if (allocations_left-- == 0)
+      throw std::bad_alloc();
+    ++live_blocks;
+    return std::allocator<T>().allocate(n);
+  }
+  void deallocate(T *p, size_t n) {
+    --live_blocks;
+    std::allocator<T>().deallocate(p, n);
+  }
+};
+template <typename T, typename U>
+bool operator==(const Limited<T> &, const Limited<U> &) { return true; }
+template <typename T, typename U>
+bool operator!=(const Limited<T> &, const Limited<U> &) { return false; }
+
+int main(void) {
+  // a chain of nodes one element wide: sorted elements added to a tree with one element per node
+  // in the default insert mode, each becomes the only child of the one before
+  btree<int> chain(1);
+  chain.insert(-1);
+  std::vector<int> sorted;
+  for (int i = 0; i < 20000; ++i)
+    sorted.push_back(i);
+  chain.insert(sorted.begin(), sorted.end());
+  btree<int> chain_copy(chain);
+  btree<int> chain_assigned;
+  chain_assigned = chain_copy;
+  std::cout << "chain height " << chain.height() << ", copies equal "
+            << (std::equal(chain.begin(), chain.end(), chain_copy.begin(), chain_copy.end()) &&
+                std::equal(chain.begin(), chain.end(), chain_assigned.begin(), chain_assigned.end()))
+            << std::endl;
+
+  // a tree large enough to be copied and freed on several threads (if there are several cores)
+  btree<std::string> big(16, true);
+  for (int i = 0; i < 200000; ++i)
+    big.insert(std::to_string(i * 7919 % 200000));
+  btree<std::string> big_copy(big);
+  std::cout << "big copy size " << big_copy.size() << ", equal "
+            << std::equal(big.begin(), big.end(), big_copy.begin(), big_copy.end()) << std::endl;
+  big_copy = btree<std::string>(4);
+  std::cout << "after assignment size " << big_copy.size() << std::endl;
+
+  // a copy that throws part way frees what it had copied, the original is unchanged
+  // (with the arena allocator a copy gets its own arena, so the nodes are copied instead of shared)
+  typedef btree<Fragile, 0, std::less<Fragile>, btree_arena_allocator<Fragile>> fragile_tree;
+  fragile_tree fragile(3, true);
+  for (int i = 0; i < 1000; ++i)
+    fragile.insert(Fragile(i));
+  Fragile::copies_left = 500;
+  try {
+    fragile_tree fragile_copy(fragile);
+    std::cout << "copy did not throw" << std::endl;
+  } catch (const std::string &error) {
+    std::cout << "caught: " << error << std::endl;
+  }
+  Fragile::copies_left = -1;
+  fragile_tree fragile_copy(fragile);
+  std::cout << "original size " << fragile.size() << ", copy size " << fragile_copy.size() << std::endl;
+
+  // an insert of the split mode whose split cannot allocate a node leaves the tree as it was before the insert
+  int failed = 0;
+  bool unchanged = true;
+  for (long fail = 0; fail < 40; ++fail) {
+    {
+      btree<long, 0, std::less<long>, Limited<long>> limited(3, true);
+      allocations_left = fail;
+      long inserted = 0;
+      for (long i = 0; i < 200; ++i) {
+        try {
+          limited.insert(i * 37 % 200);
+          ++inserted;
+        } catch (const std::bad_alloc &) {
+          ++failed;
+          allocations_left = -1;
+        }
+      }
+      long walked = std::distance(limited.begin(), limited.end());
+      unchanged = unchanged && walked == inserted && static_cast<long>(limited.size()) == inserted &&
+                  std::is_sorted(limited.begin(), limited.end()) && inserted == 199;
+    }
+    unchanged = unchanged && live_blocks == 0;
+  }
+  std::cout << "failed splits " << failed << ", unchanged " << unchanged << std::endl;
+
+  return 0;
+}
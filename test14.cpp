@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "btree_concurrent.h"
+
+int main(void) {
+  // one thread: same answers as std::set, with small nodes so that there are many splits
+  concurrent_btree<int, 4> small;
+  std::set<int> reference;
+  std::mt19937 gen(7);
+  bool same = true;
+  for (int i = 0; i < 50000; ++i) {
+    int value = gen() % 2000;
+    switch (gen() % 3) {
+    case 0:
+      same &= small.insert(value) == reference.insert(value).second;
+      break;
+    case 1:
+      same &= small.erase(value) == (reference.erase(value) == 1);
+      break;
+    default:
+      same &= small.contains(value) == (reference.count(value) == 1);
+    }
+  }
+  std::vector<int> scanned;
+  small.scan(500, 1500, [&scanned](int value) { scanned.push_back(value); });
+  same &= std::equal(scanned.begin(), scanned.end(), reference.lower_bound(500), reference.lower_bound(1500)) &&
+          scanned.size() == static_cast<size_t>(std::distance(reference.lower_bound(500), reference.lower_bound(1500)));
+  std::cout << "single thread matches std::set " << same << ", size " << (small.size() == reference.size())
+            << std::endl;
+
+  // writers on disjoint keys (thread w owns the keys equal to w modulo Writers), readers scanning
+  // at the same time: every scan must be in increasing order
+  const int Writers = 4, Readers = 2, Per_Writer = 20000;
+  concurrent_btree<long, 8> shared;
+  std::atomic<bool> done(false), ordered(true), writes_ok(true);
+  std::vector<std::thread> threads;
+  for (int w = 0; w < Writers; ++w) {
+    threads.emplace_back([&, w] {
+      std::vector<long> keys;
+      for (long i = 0; i < Per_Writer; ++i)
+        keys.push_back(i * Writers + w);
+      std::shuffle(keys.begin(), keys.end(), std::mt19937(w));
+      bool ok = true;
+      for (long key : keys)
+        ok &= shared.insert(key);
+      // erase the keys of odd rank
+      for (long key : keys)
+        if ((key / Writers) % 2 == 1)
+          ok &= shared.erase(key);
+      for (long key : keys)
+        ok &= shared.contains(key) == ((key / Writers) % 2 == 0);
+      if (!ok)
+        writes_ok = false;
+    });
+  }
+  for (int r = 0; r < Readers; ++r) {
+    threads.emplace_back([&] {
+      while (!done.load()) {
+        long previous = -1;
+        shared.scan(0, Writers * Per_Writer, [&](long key) {
+          if (key <= previous)
+            ordered = false;
+          previous = key;
+        });
+      }
+    });
+  }
+  for (int w = 0; w < Writers; ++w)
+    threads[w].join();
+  done = true;
+  for (size_t t = Writers; t < threads.size(); ++t)
+    threads[t].join();
+
+  std::vector<long> keys;
+  shared.scan(0, Writers * Per_Writer, [&keys](long key) { keys.push_back(key); });
+  bool expected = keys.size() == static_cast<size_t>(Writers * Per_Writer / 2);
+  for (size_t i = 0; expected && i < keys.size(); ++i)
+    expected = keys[i] == static_cast<long>(i / Writers * 2 * Writers + i % Writers);
+  std::cout << "threads: writes " << writes_ok.load() << ", scans ordered " << ordered.load() << std::endl;
+  std::cout << "final size " << shared.size() << ", contents " << expected << std::endl;
+
+  // readers while writers split the nodes: every key inserted before the readers start is found by each
+  // lookup, and by each scan of a range
+  const int Preloaded = 20000;
+  concurrent_btree<long, 4> splitting;
+  for (long i = 0; i < Preloaded; ++i)
+    splitting.insert(i * 4);
+  std::atomic<bool> inserting(true);
+  std::atomic<long> missed(0), lookups(0), short_scans(0);
+  std::vector<std::thread> workers;
+  for (int w = 0; w < 2; ++w) {
+    workers.emplace_back([&, w] {
+      std::vector<long> keys;
+      for (long i = 0; i < Preloaded; ++i)
+        keys.push_back(i * 4 + 1 + 2 * w);
+      std::shuffle(keys.begin(), keys.end(), std::mt19937(10 + w));
+      for (long key : keys)
+        splitting.insert(key);
+    });
+  }
+  for (int r = 0; r < 2; ++r) {
+    workers.emplace_back([&, r] {
+      std::mt19937 rng(20 + r);
+      do {
+        for (int i = 0; i < 1000; ++i) {
+          if (!splitting.contains(static_cast<long>(rng() % Preloaded) * 4))
+            ++missed;
+          ++lookups;
+        }
+        long lo = static_cast<long>(rng() % Preloaded) * 4;
+        long found = 0;
+        splitting.scan(lo, lo + 400, [&found](long key) { found += key % 4 == 0; });
+        if (found != std::min<long>(100, Preloaded - lo / 4))
+          ++short_scans;
+      } while (inserting.load());
+    });
+  }
+  for (int w = 0; w < 2; ++w)
+    workers[w].join();
+  inserting = false;
+  for (size_t t = 2; t < workers.size(); ++t)
+    workers[t].join();
+  std::cout << "readers during splits: lookups " << (lookups.load() > 0) << ", missed " << missed.load()
+            << ", short scans " << short_scans.load() << ", size " << splitting.size() << std::endl;
+  return 0;
+}
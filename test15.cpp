@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "btree.h"
+#include "btree_allocator.h"
+
+// element that counts its copies, and can be made to throw on a copy
+struct Counted {
+  Counted(long v) : value(v) {}
+  Counted(const Counted &other) : value(other.value) {
+    ++copies;
+    if (copies_left-- == 0)
+      throw std::string("copy failed");
+  }
+  Counted &operator=(const Counted &) = default;
+  bool operator<(const Counted &other) const { return value < other.value; }
+  long value;
+  static long copies, copies_left;
+};
+long Counted::copies = 0, Counted::copies_left = -1;
+template <> struct btree_parallel_elems<Counted> : std::false_type {};
+
+template <typename Tree>
+long sum(const Tree &tree) {
+  long total = 0;
+  for (const auto &elem : tree)
+    total += elem.value;
+  return total;
+}
+
+int main(void) {
+  // copies and snapshots share the nodes: no element is copied until one of the trees changes,
+  // and then only the nodes on the path of the change
+  for (bool split : {false, true}) {
+    btree<Counted> original(16, split);
+    for (long i = 0; i < 100000; ++i)
+      original.insert(Counted(i * 7919 % 100000));
+    Counted::copies = 0;
+    btree<Counted> copy(original);
+    btree<Counted> snapshot = original.snapshot();
+    btree<Counted> assigned;
+    assigned = original;
+    std::cout << (split ? "split" : "default") << ": copies made " << Counted::copies;
+    original.insert(Counted(-1));
+    original.erase(Counted(500));
+    copy.erase(Counted(600));
+    // each change copies at most the path and the siblings next to it (3 nodes of 17 elements a level)
+    long bound = static_cast<long>(3 * 3 * 17 * original.height());
+    std::cout << ", after three changes " << (Counted::copies > 0 && Counted::copies <= bound) << std::endl;
+    std::cout << "  sizes " << original.size() << " " << copy.size() << " " << snapshot.size() << " "
+              << assigned.size() << ", sums " << sum(original) << " " << sum(copy) << " " << sum(snapshot)
+              << " " << sum(assigned) << std::endl;
+    std::cout << "  finds " << (original.find(Counted(600)) != original.end())
+              << (copy.find(Counted(600)) != copy.end()) << (snapshot.find(Counted(500)) != snapshot.end())
+              << (copy.find(Counted(-1)) != copy.end()) << std::endl;
+
+    // a range erase on the original and a batch insert on the snapshot
+    original.erase(original.lower_bound(Counted(1000)), original.lower_bound(Counted(90000)));
+    std::vector<Counted> batch;
+    for (long i = 100000; i < 100100; ++i)
+      batch.push_back(Counted(i));
+    snapshot.insert(batch.begin(), batch.end());
+    std::cout << "  after range changes " << original.size() << " " << copy.size() << " " << snapshot.size() << " "
+              << assigned.size() << ", rank " << snapshot.rank(Counted(1000)) << " " << original.rank(Counted(95000))
+              << std::endl;
+
+    // a copy of a shared node that throws leaves both trees as they were
+    btree<Counted> shared(original);
+    Counted::copies_left = 3;
+    try {
+      shared.insert(Counted(50000));
+      std::cout << "  insert did not throw" << std::endl;
+    } catch (const std::string &error) {
+      std::cout << "  caught: " << error;
+    }
+    Counted::copies_left = 3;
+    try {
+      shared.erase(Counted(95000));
+      std::cout << "  erase did not throw" << std::endl;
+    } catch (const std::string &error) {
+      std::cout << ", " << error;
+    }
+    Counted::copies_left = -1;
+    std::cout << ", sizes " << shared.size() << " " << original.size() << ", equal "
+              << (sum(shared) == sum(original) && shared.find(Counted(95000)) != shared.end()) << std::endl;
+  }
+
+  // a snapshot read on another thread while the tree changes
+  btree<long> live(32, true);
+  for (long i = 0; i < 200000; ++i)
+    live.insert(i);
+  btree<long> view = live.snapshot();
+  long view_sum = 0;
+  std::thread reader([&view, &view_sum] { view_sum = std::accumulate(view.begin(), view.end(), 0L); });
+  for (long i = 0; i < 200000; i += 2)
+    live.erase(i);
+  reader.join();
+  std::cout << "snapshot sum " << view_sum << ", live size " << live.size() << ", snapshot size " << view.size()
+            << std::endl;
+
+  // with the arena allocator a snapshot shares the arena, a copy gets its own arena and copies the nodes
+  typedef btree<std::string, 0, std::less<std::string>, btree_arena_allocator<std::string>> arena_tree;
+  arena_tree words(8, true);
+  for (int i = 0; i < 1000; ++i)
+    words.insert(std::to_string(i));
+  arena_tree words_view = words.snapshot();
+  arena_tree words_copy(words);
+  words.erase(words.begin(), words.find("5"));
+  std::cout << "arena: same arena " << (words_view.get_allocator() == words.get_allocator()) << " "
+            << (words_copy.get_allocator() == words.get_allocator()) << ", sizes " << words.size() << " "
+            << words_view.size() << " " << words_copy.size() << std::endl;
+  return 0;
+}
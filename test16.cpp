@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "btree.h"
+
+int main(void) {
+  // numbers: every lookup of the mapped image agrees with the tree
+  btree<long> numbers(24, true);
+  for (long i = 0; i < 300000; ++i)
+    numbers.insert(i * 7919 % 600000);
+  numbers.save("test16_long.img");
+  {
+    auto mapped = btree<long>::open_mapped("test16_long.img");
+    bool same = mapped.size() == numbers.size() &&
+                std::equal(mapped.begin(), mapped.end(), numbers.begin(), numbers.end());
+    bool lookups = true;
+    for (long key = -3; key < 600010; key += 7) {
+      auto found = mapped.find(key);
+      lookups &= (found != mapped.end()) == (numbers.find(key) != numbers.end());
+      lookups &= mapped.rank(key) == numbers.rank(key);
+      auto upper = mapped.upper_bound(key);
+      lookups &= (upper == mapped.end()) == (numbers.upper_bound(key) == numbers.end());
+      if (upper != mapped.end())
+        lookups &= *upper == *numbers.upper_bound(key);
+    }
+    long scanned = 0;
+    size_t visited = mapped.scan(1000, 2000, [&scanned](long key) { scanned += key; });
+    long expected = 0;
+    numbers.scan(1000, 2000, [&expected](long key) { expected += key; });
+    std::cout << "long image: size " << mapped.size() << ", same " << same << ", lookups " << lookups
+              << ", scan " << visited << " " << (scanned == expected) << ", last " << *mapped.rbegin()
+              << ", middle " << mapped.begin()[150000] << std::endl;
+  }
+
+  // strings: the words of twl.txt, read back as references into the mapping
+  std::ifstream wordFile("twl.txt");
+  if (!wordFile)
+    return 1;
+  btree<std::string> words;
+  std::string word;
+  while (std::getline(wordFile, word))
+    words.insert(word);
+  words.save("test16_words.img");
+  {
+    btree_mapped<std::string> mapped = btree<std::string>::open_mapped("test16_words.img");
+    bool same = mapped.size() == words.size();
+    auto it = words.begin();
+    for (auto ref : mapped)
+      same &= ref.str() == *it++;
+    std::cout << "word image: size " << mapped.size() << ", same " << same << ", first " << *mapped.begin()
+              << ", found " << (mapped.find(*words.select(500)) != mapped.end()) << " "
+              << (mapped.find("notaword") != mapped.end()) << ", between ";
+    mapped.scan("YEAR", "YEB", [](btree_string_ref ref) { std::cout << ref << " "; });
+    std::cout << std::endl;
+    // members of the elements through the const_iterator
+    size_t letters = 0, expected = 0;
+    for (btree_mapped<std::string>::const_iterator ref = mapped.cbegin(); ref != mapped.cend(); ++ref)
+      letters += ref->size();
+    for (const auto& w : words)
+      expected += w.size();
+    std::cout << "word image letters: " << letters << ", same " << (letters == expected) << ", longest "
+              << std::max_element(mapped.begin(), mapped.end(), [](btree_string_ref a, btree_string_ref b) {
+                   return a.size() < b.size(); })->str() << std::endl;
+  }
+
+  // an empty tree, and images that cannot be opened
+  btree<long> none;
+  none.save("test16_empty.img");
+  auto empty = btree<long>::open_mapped("test16_empty.img");
+  std::cout << "empty image: size " << empty.size() << ", begin is end " << (empty.begin() == empty.end())
+            << ", find " << (empty.find(1) != empty.end()) << std::endl;
+  try {
+    btree<int>::open_mapped("test16_long.img");
+  } catch (const std::runtime_error &error) {
+    std::cout << "caught: " << error.what() << std::endl;
+  }
+  try {
+    btree<long>::open_mapped("twl.txt");
+  } catch (const std::runtime_error &error) {
+    std::cout << "caught: " << error.what() << std::endl;
+  }
+  try {
+    btree<long>::open_mapped("no_such_file.img");
+  } catch (const std::system_error &error) {
+    std::cout << "caught: " << (error.code() == std::errc::no_such_file_or_directory) << std::endl;
+  }
+  std::remove("test16_long.img");
+  std::remove("test16_words.img");
+  std::remove("test16_empty.img");
+  return 0;
+}
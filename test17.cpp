@@ -0,0 +1,148 @@
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "btree_durable.h"
+
+static void remove_files(const std::string &path) {
+  std::remove((path + ".img").c_str());
+  std::remove((path + ".log").c_str());
+}
+
+// element whose log record cannot be made for negative values
+struct Signed {
+  long value;
+  bool operator<(const Signed &other) const { return value < other.value; }
+};
+template <>
+struct btree_log_codec<Signed> {
+  static void encode(const Signed &elem, std::string &out) {
+    if (elem.value < 0)
+      throw std::runtime_error("cannot log");
+    btree_log_codec<long>::encode(elem.value, out);
+  }
+  static bool decode(const char *bytes, size_t size, Signed &elem) {
+    return btree_log_codec<long>::decode(bytes, size, elem.value);
+  }
+};
+
+int main(void) {
+  // changes are replayed from the log when the tree is opened again
+  const std::string path = "test17_db";
+  remove_files(path);
+  {
+    durable_btree<long> db(path);
+    for (long i = 0; i < 1000; ++i)
+      db.insert(i);
+    for (long i = 0; i < 100; i += 2)
+      db.erase(i);
+    std::cout << "first run: size " << db.size() << ", repeated insert " << db.insert(1) << std::endl;
+  }
+  {
+    durable_btree<long> db(path);
+    std::cout << "reopened: size " << db.size() << ", replayed " << db.recovered() << ", has 1 " << db.contains(1)
+              << ", has 2 " << db.contains(2) << std::endl;
+    // after a checkpoint the image holds the tree and the log starts again
+    db.checkpoint();
+    db.insert(-5);
+    db.erase(999);
+  }
+  {
+    durable_btree<long> db(path);
+    auto view = db.snapshot();
+    std::cout << "after checkpoint: size " << db.size() << ", replayed " << db.recovered() << ", first "
+              << *view.begin() << ", last " << *view.rbegin() << std::endl;
+  }
+  remove_files(path);
+
+  // a process killed while it inserts: every insert it reported done is there, and the tree holds the
+  // first inserts in order, up to where the log ends
+  const std::string crash_path = "test17_crash";
+  remove_files(crash_path);
+  int pipe_fds[2];
+  if (pipe(pipe_fds) != 0)
+    return 1;
+  pid_t child = fork();
+  if (child == 0) {
+    close(pipe_fds[0]);
+    durable_btree<std::string> db(crash_path);
+    for (long i = 0;; ++i) {
+      db.insert("key" + std::to_string(1000000 + i));
+      if (write(pipe_fds[1], &i, sizeof(i)) != sizeof(i))
+        _exit(1);
+    }
+  }
+  close(pipe_fds[1]);
+  long acknowledged = -1, i;
+  while (acknowledged < 2000 && read(pipe_fds[0], &i, sizeof(i)) == sizeof(i))
+    acknowledged = i;
+  kill(child, SIGKILL);
+  waitpid(child, nullptr, 0);
+  close(pipe_fds[0]);
+  {
+    // a torn record at the end of the log, as a crash in the middle of a write leaves
+    std::ofstream log(crash_path + ".log", std::ios::binary | std::ios::app);
+    log.write("\x20\x00\x00\x00Ikey", 8);
+  }
+  durable_btree<std::string> recovered(crash_path);
+  auto view = recovered.snapshot();
+  bool prefix = true;
+  long expected = 1000000;
+  for (const auto &key : view)
+    prefix &= key == "key" + std::to_string(expected++);
+  std::cout << "after kill: acknowledged inserts kept " << (static_cast<long>(view.size()) > acknowledged)
+            << ", inserts in order " << prefix << ", replayed all " << (recovered.recovered() == view.size())
+            << std::endl;
+  recovered.insert("key");
+  std::cout << "insert after recovery " << recovered.contains("key") << std::endl;
+  remove_files(crash_path);
+
+  // threads share the syncs of the log
+  const std::string shared_path = "test17_shared";
+  remove_files(shared_path);
+  {
+    durable_btree<int> db(shared_path);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+      threads.emplace_back([&db, t] {
+        for (int k = 0; k < 250; ++k)
+          db.insert(t * 1000 + k);
+      });
+    for (auto &thread : threads)
+      thread.join();
+    std::cout << "threads: size " << db.size() << ", at most one sync per insert " << (db.syncs() <= 1000)
+              << std::endl;
+  }
+  durable_btree<int> reopened(shared_path);
+  std::cout << "threads reopened: size " << reopened.size() << std::endl;
+  remove_files(shared_path);
+
+  // a change that cannot be logged is not made, neither in the tree nor in the image of a checkpoint
+  const std::string refused_path = "test17_refused";
+  remove_files(refused_path);
+  {
+    durable_btree<Signed> db(refused_path);
+    db.insert(Signed{1});
+    int refused = 0;
+    try {
+      db.insert(Signed{-1});
+    } catch (const std::runtime_error &) {
+      ++refused;
+    }
+    db.checkpoint();
+    std::cout << "refused " << refused << ": size " << db.size() << ", has -1 " << db.contains(Signed{-1})
+              << std::endl;
+  }
+  durable_btree<Signed> refused_reopened(refused_path);
+  std::cout << "refused reopened: size " << refused_reopened.size() << std::endl;
+  remove_files(refused_path);
+  return 0;
+}
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <cctype>
+#include <functional>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "btree.h"
+
+// orders strings without regard to case
+struct no_case {
+  bool operator()(const std::string& a, const std::string& b) const {
+    return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end(), [](char x, char y) {
+      return std::tolower(static_cast<unsigned char>(x)) < std::tolower(static_cast<unsigned char>(y));
+    });
+  }
+};
+
+// element that counts how often it is built from a string literal
+static int names_built = 0;
+struct Name {
+  std::string text;
+  Name(const char *s) : text(s) { ++names_built; }
+};
+struct name_less {
+  typedef void is_transparent;
+  bool operator()(const Name& a, const Name& b) const { return a.text < b.text; }
+  bool operator()(const Name& a, const char *b) const { return a.text.compare(b) < 0; }
+  bool operator()(const char *a, const Name& b) const { return b.text.compare(a) > 0; }
+};
+
+// element with a three-way compare, counting the calls of each kind of comparison
+static long three_way_calls = 0, less_calls = 0;
+struct Key {
+  long value;
+  Key(long v = 0) : value(v) {}
+  int compare(const Key& other) const {
+    ++three_way_calls;
+    return value < other.value ? -1 : value > other.value ? 1 : 0;
+  }
+  bool operator<(const Key& other) const {
+    ++less_calls;
+    return value < other.value;
+  }
+};
+template <>
+struct btree_three_way<Key> : std::true_type {};
+
+int main(void) {
+  // descending order, in both insert modes: every lookup agrees with std::set<long, std::greater<long>>
+  for (bool split : {false, true}) {
+    btree<long, 0, std::greater<long>> tree(5, split);
+    std::set<long, std::greater<long>> expected;
+    for (long i = 0; i < 2000; ++i) {
+      long value = i * 7919 % 3001;
+      tree.insert(value);
+      expected.insert(value);
+    }
+    std::vector<long> batch;
+    for (long i = 0; i < 500; ++i)
+      batch.push_back(i * 31 % 4000);
+    tree.insert(batch.begin(), batch.end());
+    expected.insert(batch.begin(), batch.end());
+    for (long i = 0; i < 4000; i += 3) {
+      tree.erase(i);
+      expected.erase(i);
+    }
+    bool same = std::equal(tree.begin(), tree.end(), expected.begin(), expected.end());
+    bool lookups = true;
+    for (long key = -2; key < 4002; ++key) {
+      lookups &= (tree.find(key) != tree.end()) == (expected.count(key) == 1);
+      auto lower = tree.lower_bound(key);
+      auto upper = tree.upper_bound(key);
+      lookups &= (lower == tree.end()) == (expected.lower_bound(key) == expected.end());
+      lookups &= (upper == tree.end()) == (expected.upper_bound(key) == expected.end());
+      if (lower != tree.end())
+        lookups &= *lower == *expected.lower_bound(key);
+      if (upper != tree.end())
+        lookups &= *upper == *expected.upper_bound(key);
+      lookups &= tree.rank(key) == static_cast<size_t>(std::distance(expected.begin(), expected.lower_bound(key)));
+    }
+    long scanned = 0;
+    size_t visited = tree.scan(2000, 1000, [&scanned](long value) { scanned += value; });
+    std::cout << (split ? "split" : "default") << " descending: size " << tree.size() << ", same " << same
+              << ", lookups " << lookups << ", first " << *tree.begin() << ", count " << tree.count(2000, 1000)
+              << ", scan " << visited << " " << scanned << std::endl;
+    btree<long, 0, std::greater<long>> loaded(expected.rbegin(), expected.rend(), 5, split);
+    std::cout << "  bulk load of ascending input: " << std::equal(loaded.begin(), loaded.end(), tree.begin(), tree.end())
+              << ", snapshot " << std::equal(tree.begin(), tree.end(), tree.snapshot().begin()) << std::endl;
+  }
+
+  // a comparator object: words that differ only in case are the same element
+  btree<std::string, 0, no_case> words(4, true, no_case());
+  for (const char *word : {"pear", "Apple", "banana", "APPLE", "Cherry", "apple", "PEAR"})
+    words.insert(word);
+  std::cout << "no case:";
+  for (const auto& word : words)
+    std::cout << " " << word;
+  auto found = words.find("BaNaNa");
+  std::cout << ", find BaNaNa " << (found != words.end() ? *found : "-") << std::endl;
+
+  // transparent comparator: lookups by string literal build no element
+  btree<Name, 0, name_less> names(3, true);
+  for (const char *name : {"delta", "alpha", "echo", "charlie", "bravo", "foxtrot"})
+    names.insert(Name(name));
+  names_built = 0;
+  bool has_charlie = names.find("charlie") != names.end();
+  bool has_golf = names.find("golf") != names.end();
+  auto range = names.equal_range("echo");
+  std::cout << "transparent: charlie " << has_charlie << ", golf " << has_golf << ", echo "
+            << std::distance(range.first, range.second) << ", rank of dog " << names.rank("dog")
+            << ", lower bound of b " << names.lower_bound("b")->text << ", upper bound of echo "
+            << names.upper_bound("echo")->text << ", names built " << names_built << std::endl;
+
+  // std::less<> on std::string: find with a C string compares it in place
+  btree<std::string, 0, std::less<>> strings(8, true);
+  for (int i = 0; i < 1000; ++i)
+    strings.insert(std::to_string(i * 37 % 1000));
+  std::cout << "std::less<>: find 999 " << (strings.find("999") != strings.end()) << ", find 1000 "
+            << (strings.find("1000") != strings.end()) << ", rank of 5 " << strings.rank("5") << std::endl;
+
+  // three-way compare: one call of 'compare' per probe, operator< is not used by lookups
+  btree<Key, 0> keys(16, true);
+  for (long i = 0; i < 10000; ++i)
+    keys.insert(Key(i * 2));
+  three_way_calls = less_calls = 0;
+  long hits = 0;
+  for (long i = 0; i < 20000; ++i)
+    hits += keys.find(Key(i)) != keys.end() ? 1 : 0;
+  // a node of at most 17 elements is searched in at most 5 probes
+  bool one_per_probe = three_way_calls <= static_cast<long>(20000 * keys.height() * 5);
+  std::cout << "three-way: hits " << hits << ", operator< calls " << less_calls << ", one compare per probe "
+            << one_per_probe << std::endl;
+  return 0;
+}
@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "btree.h"
+#include "btree_strings.h"
+
+// every lookup and both directions of iteration agree with std::set
+template <size_t B>
+bool same(const btree_string_set<B>& set, const std::set<std::string>& expected, const std::vector<std::string>& probes) {
+  bool ok = set.size() == expected.size() && std::equal(set.begin(), set.end(), expected.begin(), expected.end());
+  auto it = set.end();
+  for (auto rit = expected.rbegin(); ok && rit != expected.rend(); ++rit)
+    ok = *--it == *rit;
+  for (const auto& key : probes) {
+    auto lower = set.lower_bound(key);
+    auto expected_lower = expected.lower_bound(key);
+    ok &= set.contains(key) == (expected.count(key) == 1);
+    ok &= (set.find(key) != set.end()) == (expected.count(key) == 1);
+    ok &= (lower == set.end()) == (expected_lower == expected.end());
+    if (lower != set.end() && expected_lower != expected.end())
+      ok &= *lower == *expected_lower;
+  }
+  return ok;
+}
+
+int main(void) {
+  // the words of twl.txt, and lookups of words that are not in it
+  std::ifstream file("twl.txt");
+  std::vector<std::string> words;
+  std::string word;
+  while (file >> word)
+    words.push_back(word);
+  btree_string_set<64> dictionary(words.begin(), words.end());
+  std::set<std::string> expected(words.begin(), words.end());
+  std::vector<std::string> probes;
+  for (const auto& w : words) {
+    probes.push_back(w);
+    probes.push_back(w + "S");
+    probes.push_back(w.substr(0, w.size() - 1));
+  }
+  probes.push_back("");
+  probes.push_back("ZZZZ");
+  std::cout << "words: size " << dictionary.size() << ", height " << dictionary.height() << ", same "
+            << same(dictionary, expected, probes) << ", first " << *dictionary.begin() << ", last "
+            << *--dictionary.end() << std::endl;
+
+  // erase every other word, then copy
+  for (size_t i = 0; i < words.size(); i += 2) {
+    dictionary.erase(words[i]);
+    expected.erase(words[i]);
+  }
+  btree_string_set<64> copy(dictionary);
+  dictionary.insert("AARDVARK");
+  std::cout << "after erase: size " << copy.size() << ", same " << same(copy, expected, probes)
+            << ", copy unchanged " << !copy.contains("AARDVARK") << std::endl;
+
+  // paths that share long prefixes take a few bytes each
+  btree_string_set<> paths;
+  btree<std::string> tree(40, true);
+  std::set<std::string> expected_paths;
+  unsigned seed = 12345;
+  for (int i = 0; i < 50000; ++i) {
+    seed = seed * 1103515245 + 12345;
+    char path[80];
+    std::snprintf(path, sizeof(path), "/home/user/projects/btree/build/objects/%05u/part-%03u.o",
+                  (seed >> 8) % 5000, (seed >> 4) % 100);
+    paths.insert(path);
+    tree.insert(path);
+    expected_paths.insert(path);
+  }
+  std::vector<std::string> path_probes(expected_paths.begin(), expected_paths.end());
+  path_probes.push_back("/home/user/projects/btree/build/objects/99999");
+  path_probes.push_back("/home/user/projects/btree/build/objects/00000/part-");
+  size_t strings = 0;
+  for (const auto& p : tree)
+    strings += sizeof(std::string) + p.capacity() + 1;
+  std::cout << "paths: size " << paths.size() << ", same " << same(paths, expected_paths, path_probes)
+            << ", smaller than the strings alone 4 times over " << (paths.memory_usage() * 4 < strings) << std::endl;
+
+  // erase all of them
+  for (const auto& p : path_probes)
+    paths.erase(p);
+  std::cout << "erased: size " << paths.size() << ", height " << paths.height() << ", empty "
+            << (paths.begin() == paths.end()) << std::endl;
+  return 0;
+}
@@ -0,0 +1,121 @@
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "btree_allocator.h"
+#include "btree_map.h"
+
+// value that counts how often it is built
+static int values_built = 0;
+struct Counted {
+  int value;
+  Counted(int v = 0) : value(v) { ++values_built; }
+};
+
+// every element and lookup agrees with std::map
+template <typename Map>
+bool same(const Map& map, const std::map<long, std::string>& expected) {
+  bool ok = map.size() == expected.size();
+  auto it = map.begin();
+  for (auto e = expected.begin(); ok && e != expected.end(); ++e, ++it)
+    ok = it->first == e->first && it->second == e->second;
+  for (long key = -1; ok && key < 3001; key += 7) {
+    auto found = map.find(key);
+    auto e = expected.find(key);
+    ok = (found == map.end()) == (e == expected.end()) && (e == expected.end() || (*found).second == e->second);
+  }
+  return ok;
+}
+
+int main(void) {
+  // operator[], at, insert_or_assign and changes through iterators
+  btree_map<std::string, int> counts(4, true);
+  for (const char *word : {"pear", "apple", "fig", "apple", "kiwi", "pear", "apple"})
+    ++counts[word];
+  std::cout << "counts:";
+  for (const auto& entry : counts)
+    std::cout << " " << entry.first << "=" << entry.second;
+  std::cout << std::endl;
+  bool thrown = false;
+  try {
+    counts.at("plum");
+  } catch (const std::out_of_range&) {
+    thrown = true;
+  }
+  auto assigned = counts.insert_or_assign("fig", 10);
+  auto added = counts.insert_or_assign("plum", 5);
+  for (auto it = counts.begin(); it != counts.end(); ++it)
+    it->second *= 2;
+  std::cout << "at apple " << counts.at("apple") << ", at plum throws " << thrown << ", insert_or_assign fig "
+            << assigned.second << " " << counts.at("fig") << ", plum " << added.second << " " << counts["plum"]
+            << ", size " << counts.size() << ", contains kiwi " << counts.contains("kiwi") << std::endl;
+
+  // insert of a braced pair, of a pair of other types, and of a key that is in the map
+  auto braced = counts.insert({"cherry", 7});
+  auto made = counts.insert(std::make_pair("lime", 8));
+  auto again = counts.insert({"apple", 1});
+  std::cout << "insert cherry " << braced.second << " " << braced.first->second << ", lime " << made.second << " "
+            << counts.at("lime") << ", apple " << again.second << " " << again.first->second << std::endl;
+
+  // try_emplace builds no value for a key that is in the map
+  btree_map<int, Counted> counted(3, false);
+  for (int i = 0; i < 100; ++i)
+    counted.try_emplace(i % 10, i);
+  std::cout << "try_emplace: size " << counted.size() << ", values built " << values_built << ", value of 7 "
+            << counted.at(7).value << std::endl;
+
+  // both insert modes against std::map, with erases, a copy and assignment
+  for (bool split : {false, true}) {
+    btree_map<long, std::string> map(5, split);
+    std::map<long, std::string> expected;
+    for (long i = 0; i < 3000; ++i) {
+      long key = i * 7919 % 3001;
+      map.try_emplace(key, std::to_string(key * 3));
+      expected.emplace(key, std::to_string(key * 3));
+    }
+    for (long key = 0; key < 3001; key += 3) {
+      map.erase(key);
+      expected.erase(key);
+    }
+    map.erase(map.find(1), map.find(100));
+    expected.erase(expected.find(1), expected.find(100));
+    for (auto it = map.begin(); it != map.end(); ++it)
+      if (it->first % 5 == 0)
+        it->second += "!";
+    for (auto& entry : expected)
+      if (entry.first % 5 == 0)
+        entry.second += "!";
+    bool equal = same(map, expected);
+    btree_map<long, std::string> copy(map);
+    copy[2000] = "changed";
+    copy.erase(2001);
+    btree_map<long, std::string> assigned_copy;
+    assigned_copy = copy;
+    std::cout << (split ? "split" : "default") << ": size " << map.size() << ", same " << equal
+              << ", copy independent " << same(map, expected) << ", value in copy " << copy.at(2000)
+              << ", assigned copy has 2001 " << assigned_copy.contains(2001) << ", rank of 1500 " << map.rank(1500)
+              << ", select 10 " << map.select(10)->first << std::endl;
+  }
+
+  // move-only values
+  btree_map<int, std::unique_ptr<int>> owners(3, true);
+  for (int i = 0; i < 200; ++i)
+    owners.try_emplace(i * 37 % 200, new int(i));
+  for (int i = 0; i < 200; i += 2)
+    owners.erase(i);
+  long sum = 0;
+  for (auto it = owners.cbegin(); it != owners.cend(); ++it)
+    sum += *it->second;
+  std::cout << "unique_ptr: size " << owners.size() << ", sum " << sum << std::endl;
+
+  // values in an arena still have their destructors run (the strings are too long to be kept inline)
+  {
+    btree_map<int, std::string, 0, std::less<int>, btree_arena_allocator<int>> arena_map(8, false);
+    for (int i = 0; i < 1000; ++i)
+      arena_map[i] = std::string(100, static_cast<char>('a' + i % 26));
+    std::cout << "arena: size " << arena_map.size() << ", value of 27 " << arena_map.at(27).substr(0, 3) << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,88 @@
+#include <iostream>
+#include <string>
+#include <utility>
+
+#include "btree.h"
+#include "btree_map.h"
+
+// element that counts how often it is made and copied (moves within the nodes are not counted)
+static int made = 0, copied = 0;
+struct Tracked {
+  std::string text;
+  Tracked(const char *s) : text(s) { ++made; }
+  Tracked(size_t count, char c) : text(count, c) { ++made; }
+  Tracked(const Tracked& other) : text(other.text) { ++copied; }
+  Tracked(Tracked&& other) noexcept : text(std::move(other.text)) {}
+  Tracked& operator=(const Tracked& other) { text = other.text; ++copied; return *this; }
+  Tracked& operator=(Tracked&& other) noexcept { text = std::move(other.text); return *this; }
+};
+struct tracked_less {
+  typedef void is_transparent;
+  bool operator()(const Tracked& a, const Tracked& b) const { return a.text < b.text; }
+  bool operator()(const Tracked& a, const char *b) const { return a.text.compare(b) < 0; }
+  bool operator()(const char *a, const Tracked& b) const { return b.text.compare(a) > 0; }
+};
+struct plain_less {
+  bool operator()(const Tracked& a, const Tracked& b) const { return a.text < b.text; }
+};
+
+static void counts(const char *what) {
+  std::cout << what << ": made " << made << ", copied " << copied << std::endl;
+  made = copied = 0;
+}
+
+int main(void) {
+  const char *words[] = {"kiwi", "apple", "fig", "apple", "pear", "kiwi", "fig", "plum"};
+  for (bool split : {false, true}) {
+    std::cout << (split ? "split" : "default") << " mode" << std::endl;
+    // insert of an rvalue moves it in, and leaves a duplicate as it is
+    btree<Tracked, 0, plain_less> moves(2, split);
+    for (const char *word : words) {
+      Tracked t(word);
+      bool inserted = moves.insert(std::move(t)).second;
+      if (!inserted && t.text != word)
+        std::cout << "  duplicate moved from" << std::endl;
+    }
+    made = 0;
+    counts("  insert(T&&)");
+
+    // emplace with a transparent comparator makes an element of a new key only, in place
+    btree<Tracked, 0, tracked_less> in_place(2, split);
+    for (const char *word : words)
+      in_place.emplace(word);
+    std::cout << "  size " << in_place.size() << ", first " << in_place.begin()->text << std::endl;
+    counts("  emplace(const char*)");
+
+    // without one, the element is made first and moved in
+    btree<Tracked, 0, plain_less> made_first(2, split);
+    for (const char *word : words)
+      made_first.emplace(word);
+    made_first.emplace(3, 'z');
+    auto it = made_first.emplace_hint(made_first.end(), 3, 'z');
+    std::cout << "  size " << made_first.size() << ", last " << it->text << std::endl;
+    counts("  emplace(args)");
+  }
+
+  // std::string: an rvalue duplicate keeps its characters
+  btree<std::string> strings(4, true);
+  std::string key(40, 'k');
+  strings.insert(std::string(key));
+  std::string again(key);
+  bool inserted = strings.insert(std::move(again)).second;
+  std::cout << "string: inserted " << inserted << ", duplicate kept " << (again == key) << std::endl;
+
+  // btree_map: a key moved into try_emplace is not moved from if it is in the map
+  btree_map<std::string, int> map(3, true);
+  for (int i = 0; i < 20; ++i) {
+    std::string name = "key-" + std::to_string(i % 7);
+    map.try_emplace(std::move(name), i);
+    if (i >= 7 && name.empty())
+      std::cout << "map: present key moved from" << std::endl;
+  }
+  std::string name = "key-9";
+  map[std::move(name)] = 9;
+  map.insert(std::make_pair(std::string("key-8"), 8));
+  std::cout << "map: size " << map.size() << ", key-3 " << map.at("key-3") << ", key-9 " << map.at("key-9")
+            << std::endl;
+  return 0;
+}
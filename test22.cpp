@@ -0,0 +1,74 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "btree.h"
+
+// comparator that counts its calls
+static long compares = 0;
+struct counting_less {
+  template <typename T>
+  bool operator()(const T& a, const T& b) const {
+    ++compares;
+    return a < b;
+  }
+};
+
+int main(void) {
+  // increasing timestamps: after the first inserts, each one compares with a node or two only
+  for (bool split : {false, true}) {
+    btree<long, 0, counting_less> log(32, split);
+    compares = 0;
+    for (long t = 0; t < 100000; ++t)
+      log.insert(1000000 + t * 3);
+    double per_insert = static_cast<double>(compares) / 100000;
+    // a few out of order, then in order again from somewhere else
+    std::set<long> expected;
+    for (long t = 0; t < 100000; ++t)
+      expected.insert(1000000 + t * 3);
+    for (long t : {5L, 1000001L, 1150001L, 1150004L, 1150004L, 1299998L, 2000000L}) {
+      log.insert(t);
+      expected.insert(t);
+    }
+    std::cout << (split ? "split" : "default") << ": size " << log.size() << ", same "
+              << std::equal(log.begin(), log.end(), expected.begin(), expected.end()) << ", fewer than 4 compares per insert "
+              << (per_insert < 4) << ", rank of 1150004 " << log.rank(1150004) << std::endl;
+  }
+
+  // hinted insert: end() to append, and a wrong hint that still inserts in order
+  btree<long, 0, counting_less> hinted(16, true);
+  compares = 0;
+  for (long i = 0; i < 50000; ++i)
+    hinted.insert(hinted.end(), i * 2);
+  double per_insert = static_cast<double>(compares) / 50000;
+  long before = *--hinted.insert(hinted.begin(), 40001);
+  long dup = *hinted.insert(hinted.end(), 40001);
+  std::cout << "hinted: size " << hinted.size() << ", last " << *hinted.rbegin() << ", 40001 inserted after " << before
+            << ", duplicate " << dup << ", fewer than 4 compares per append " << (per_insert < 4) << std::endl;
+
+  // the words of twl.txt in reverse order, with a snapshot taken along the way that keeps its elements
+  std::ifstream file("twl.txt");
+  std::vector<std::string> words;
+  std::string word;
+  while (file >> word)
+    words.push_back(word);
+  std::sort(words.begin(), words.end());
+  for (bool split : {false, true}) {
+    btree<std::string> dictionary(20, split);
+    btree<std::string> snapshot;
+    size_t half = words.size() / 2;
+    for (size_t i = words.size(); i-- > 0; ) {
+      if (i == half)
+        snapshot = dictionary.snapshot();
+      dictionary.insert(words[i]);
+    }
+    std::cout << (split ? "split" : "default") << " reverse twl: size " << dictionary.size() << ", in order "
+              << std::equal(dictionary.begin(), dictionary.end(), words.begin(), words.end()) << ", snapshot "
+              << snapshot.size() << " " << std::equal(snapshot.begin(), snapshot.end(), words.begin() + half + 1, words.end())
+              << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,71 @@
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "btree.h"
+#include "btree_map.h"
+
+// one line for the shape and memory of a tree
+template <typename Tree>
+void print(const std::string& name, const Tree& tree) {
+  btree_stats stats = tree.stats();
+  size_t on_levels = 0;
+  for (size_t count : stats.level_nodes)
+    on_levels += count;
+  std::cout << name << ": height " << stats.height << " (" << tree.height() << "), nodes " << stats.nodes
+            << ", elements " << stats.elements << ", per level";
+  for (size_t i = 0; i < stats.level_nodes.size() && i < 4; ++i)
+    std::cout << " " << stats.level_nodes[i];
+  if (stats.level_nodes.size() > 4)
+    std::cout << " ...";
+  std::cout << ", fill";
+  for (size_t count : stats.fill_histogram)
+    std::cout << " " << count;
+  std::cout << ", shared " << stats.shared_nodes << ", levels add up " << (on_levels == stats.nodes)
+            << ", bytes add up " << (stats.element_bytes + stats.slack_bytes <= stats.node_bytes) << std::endl;
+}
+
+int main(void) {
+  btree<long> empty;
+  print("empty", empty);
+
+  // the same keys in order and at random, in both insert modes: the default mode makes chains of ordered input
+  std::vector<long> keys(2000);
+  for (size_t i = 0; i < keys.size(); ++i)
+    keys[i] = static_cast<long>(i);
+  std::vector<long> shuffled(keys);
+  std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(5));
+  for (bool split : {false, true}) {
+    btree<long> sorted(10, split), random(10, split);
+    for (long key : keys)
+      sorted.insert(key);
+    for (long key : shuffled)
+      random.insert(key);
+    print(std::string(split ? "split" : "default") + " sorted", sorted);
+    print(std::string(split ? "split" : "default") + " random", random);
+  }
+
+  // bulk load packs the nodes; a snapshot shares the root; a changed copy shares the nodes it did not change
+  btree<long> packed(keys.begin(), keys.end(), 10, true);
+  print("bulk load", packed);
+  btree<long> snapshot = packed.snapshot();
+  print("with snapshot", packed);
+  snapshot.insert(5000);
+  print("after a change of the snapshot", packed);
+
+  // memory of the elements and of the unused slots
+  btree<long, 0> small(4, true);
+  for (long i = 0; i < 9; ++i)
+    small.insert(i);
+  btree_stats stats = small.stats();
+  std::cout << "long, node of 4: nodes " << stats.nodes << ", element bytes " << stats.element_bytes << ", slack bytes "
+            << stats.slack_bytes << std::endl;
+  btree_map<int, double> map(4, true);
+  for (int i = 0; i < 9; ++i)
+    map[i] = i / 2.0;
+  stats = map.stats();
+  std::cout << "map of int to double: element bytes " << stats.element_bytes << ", slack bytes " << stats.slack_bytes
+            << std::endl;
+  return 0;
+}
@@ -0,0 +1,93 @@
+#define BTREE_INSTRUMENT
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "btree.h"
+#include "btree_map.h"
+
+// comparator that counts its calls
+static long compares = 0;
+struct counting_less {
+  bool operator()(long a, long b) const {
+    ++compares;
+    return a < b;
+  }
+};
+
+static void show(const char *what, btree_op op) {
+  const btree_op_stats& s = btree_instrument::stats(op);
+  std::cout << what << ": calls " << s.calls << ", comparisons " << s.comparisons << ", nodes " << s.nodes
+            << ", allocations " << s.allocations << ", p50 <= p99 <= p999 "
+            << (s.percentile(0.5) <= s.percentile(0.99) && s.percentile(0.99) <= s.percentile(0.999)) << std::endl;
+}
+
+int main(void) {
+  // percentiles of known latencies: within the bucket of the value
+  btree_op_stats known;
+  for (uint64_t ns = 1; ns <= 1000; ++ns)
+    known.record(ns);
+  std::cout << "histogram: p0 " << known.percentile(0) << ", p50 " << known.percentile(0.5) << ", p99 "
+            << known.percentile(0.99) << ", p999 " << known.percentile(0.999) << ", calls " << known.calls << std::endl;
+
+  for (bool split : {false, true}) {
+    std::cout << (split ? "split" : "default") << " mode" << std::endl;
+    btree<long, 0, counting_less> tree(16, split);
+    btree_instrument::reset();
+    compares = 0;
+    for (long i = 0; i < 20000; ++i)
+      tree.insert((i * 7919) % 20000);
+    const btree_op_stats& insert = btree_instrument::stats(btree_op::insert);
+    std::cout << "  insert: calls " << insert.calls << ", comparisons counted " << (insert.comparisons == static_cast<uint64_t>(compares))
+              << ", allocations " << (insert.allocations == tree.stats().nodes ? "the nodes" : insert.allocations > tree.stats().nodes
+                                      ? "more than the nodes (leaves made internal)" : "fewer than the nodes") << std::endl;
+
+    compares = 0;
+    for (long i = 0; i < 1000; ++i)
+      tree.find(i * 20 + 1);
+    const btree_op_stats& find = btree_instrument::stats(btree_op::find);
+    std::cout << "  find: calls " << find.calls << ", comparisons counted " << (find.comparisons == static_cast<uint64_t>(compares))
+              << ", at most height nodes each " << (find.nodes <= find.calls * tree.height())
+              << ", allocations " << find.allocations << std::endl;
+
+    compares = 0;
+    long sum = 0;
+    for (long x : tree)
+      sum += x;
+    for (auto it = tree.rbegin(); it != tree.rend(); ++it)
+      sum -= *it;
+    const btree_op_stats& iterate = btree_instrument::stats(btree_op::iterate);
+    std::cout << "  iterate: calls " << iterate.calls << ", comparisons counted "
+              << (iterate.comparisons == static_cast<uint64_t>(compares)) << ", sum " << sum << std::endl;
+  }
+
+  // a copy of a set shares the nodes, a copy of a map copies them (on several threads for this one)
+  btree_instrument::reset();
+  btree<long> numbers(8, true);
+  for (long i = 0; i < 1000; ++i)
+    numbers.insert(i);
+  btree<long> copy(numbers);
+  show("copy of a set", btree_op::copy);
+  btree_instrument::reset();
+  btree_map<long, std::string> names(8, true);
+  for (long i = 0; i < 100000; ++i)
+    names[i] = "n" + std::to_string(i);
+  btree_map<long, std::string> deep(names);
+  const btree_op_stats& copies = btree_instrument::stats(btree_op::copy);
+  std::cout << "copy of a map: calls " << copies.calls << ", allocations are the nodes "
+            << (copies.allocations == names.stats().nodes) << ", nodes visited " << (copies.nodes == names.stats().nodes)
+            << ", size " << deep.size() << std::endl;
+
+  // records of another thread are its own
+  btree_instrument::reset();
+  numbers.insert(-1);
+  btree_op_stats other;
+  std::thread([&other] {
+    btree<long> local;
+    local.insert(1);
+    other = btree_instrument::stats(btree_op::insert);
+  }).join();
+  other += btree_instrument::stats(btree_op::insert);
+  std::cout << "other thread: calls " << other.calls << ", enabled " << btree_instrument::enabled << std::endl;
+  return 0;
+}
@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <set>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "btree.h"
+
+// comparator that counts its calls
+static long compares = 0;
+struct counting_less {
+  bool operator()(int a, int b) const {
+    ++compares;
+    return a < b;
+  }
+};
+
+template <typename It>
+static bool bidirectional() {
+  return std::is_same<typename std::iterator_traits<It>::iterator_category, std::bidirectional_iterator_tag>::value;
+}
+
+int main(void) {
+  typedef btree<int, 0, counting_less> tree;
+  std::cout << "bidirectional: " << bidirectional<tree::iterator>() << bidirectional<tree::const_iterator>()
+            << bidirectional<tree::reverse_iterator>() << bidirectional<tree::const_reverse_iterator>() << std::endl;
+
+  std::mt19937 rng(11);
+  for (bool split : {false, true}) {
+    tree numbers(6, split);
+    std::set<int> expected;
+    for (int i = 0; i < 50000; ++i) {
+      int x = static_cast<int>(rng() % 1000000);
+      numbers.insert(x);
+      expected.insert(x);
+    }
+    // a scan climbs from each node to its parent, the only search is the one that finds the path
+    compares = 0;
+    bool same = std::equal(numbers.begin(), numbers.end(), expected.begin(), expected.end());
+    long forward = compares;
+    compares = 0;
+    bool same_reverse = std::equal(numbers.rbegin(), numbers.rend(), expected.rbegin(), expected.rend());
+    long backward = compares;
+    // the algorithms of bidirectional iterators
+    auto last = std::prev(numbers.end());
+    std::vector<int> tail(std::make_reverse_iterator(numbers.cend()), std::make_reverse_iterator(numbers.cbegin()));
+    std::cout << (split ? "split" : "default") << ": same " << same << same_reverse << ", comparisons of a scan "
+              << forward << " " << backward << ", last " << (*last == *expected.rbegin()) << ", reversed "
+              << std::equal(tail.begin(), tail.end(), expected.rbegin(), expected.rend()) << std::endl;
+
+    // random steps back and forth from a found element
+    auto it = numbers.find(*std::next(expected.begin(), 25000));
+    auto ex = expected.find(*it);
+    bool walk = true;
+    for (int step = 0; step < 100000 && walk; ++step) {
+      if (rng() % 2 == 0 && std::next(ex) != expected.end()) {
+        ++it;
+        ++ex;
+      } else if (ex != expected.begin()) {
+        --it;
+        --ex;
+      }
+      walk = *it == *ex;
+    }
+    std::cout << "  walk " << walk << std::endl;
+  }
+
+  // the default mode on sorted input hangs each node off the one before, deeper than the levels an iterator
+  // keeps in itself
+  btree<std::string> chain(2, false);
+  std::vector<std::string> words;
+  for (int i = 0; i < 200; ++i)
+    words.push_back("w" + std::to_string(1000 + i));
+  for (const auto& w : words)
+    chain.insert(w);
+  std::cout << "chain: height " << chain.height() << ", forward "
+            << std::equal(chain.begin(), chain.end(), words.begin(), words.end()) << ", backward "
+            << std::equal(chain.rbegin(), chain.rend(), words.rbegin(), words.rend()) << std::endl;
+  // a scan of a chain thousands of levels deep still climbs instead of searching: comparisons are only those
+  // of the one descent that finds the path, whatever the direction and the way the iterators are stepped
+  for (bool descending : {true, false}) {
+    tree deep(40, false);
+    for (int i = 0; i < 80000; ++i)
+      deep.insert(descending ? 80000 - i : i);
+    compares = 0;
+    long steps = 0;
+    for (auto it = deep.begin(); it != deep.end(); it++)
+      ++steps;
+    long forward = compares;
+    compares = 0;
+    for (auto it = deep.rbegin(); it != deep.rend(); ++it)
+      ++steps;
+    std::cout << (descending ? "descending" : "ascending") << " chain: height " << deep.height() << ", steps " << steps
+              << ", comparisons of one descent " << (forward <= static_cast<long>(deep.height()) * 8) << " "
+              << (compares <= static_cast<long>(deep.height()) * 8) << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,81 @@
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "btree.h"
+
+template <typename Tree>
+static void print(const char *what, const Tree& tree) {
+  std::cout << what << " (" << tree.size() << "):";
+  for (const auto& x : tree)
+    std::cout << " " << x;
+  std::cout << std::endl;
+}
+
+int main(void) {
+  // small trees of both insert modes, the result takes the node size and mode of the first one
+  btree<int> odd(3, true), squares(4, false);
+  for (int i = 1; i < 30; i += 2)
+    odd.insert(i);
+  for (int i = 0; i * i < 30; ++i)
+    squares.insert(i * i);
+  print("union", set_union(odd, squares));
+  print("intersection", set_intersection(odd, squares));
+  print("difference", set_difference(odd, squares));
+  print("difference of the other", set_difference(squares, odd));
+  btree<int> empty;
+  print("with an empty tree", set_union(empty, squares));
+  print("intersection with an empty tree", set_intersection(odd, empty));
+
+  // merge adds the elements of the other tree, a copy that shared the nodes keeps its elements
+  btree<int> before = odd;
+  odd.merge(squares);
+  odd.merge(odd);
+  print("merged", odd);
+  print("copy from before", before);
+  odd.insert(100);
+  odd.erase(1);
+  std::cout << "merged tree changes: size " << odd.size() << ", height " << odd.height() << std::endl;
+
+  // the comparator of the trees orders the result
+  btree<std::string, 0, std::greater<std::string>> words(4, true), more(4, true);
+  for (const char *w : {"pear", "fig", "apple", "kiwi"})
+    words.insert(w);
+  for (const char *w : {"plum", "fig", "date", "kiwi"})
+    more.insert(w);
+  print("descending union", set_union(words, more));
+  print("descending difference", set_difference(words, more));
+
+  // large trees, on one thread and with the key range split into parts
+  std::mt19937 rng(26);
+  btree<long> a(32, true), b(32, true);
+  std::set<long> sa, sb;
+  for (int i = 0; i < 200000; ++i) {
+    long x = static_cast<long>(rng() % 600000), y = static_cast<long>(rng() % 600000);
+    a.insert(x);
+    sa.insert(x);
+    b.insert(y);
+    sb.insert(y);
+  }
+  std::vector<long> u, in, d;
+  std::set_union(sa.begin(), sa.end(), sb.begin(), sb.end(), std::back_inserter(u));
+  std::set_intersection(sa.begin(), sa.end(), sb.begin(), sb.end(), std::back_inserter(in));
+  std::set_difference(sa.begin(), sa.end(), sb.begin(), sb.end(), std::back_inserter(d));
+  for (size_t threads : {1, 4}) {
+    auto tu = set_union(a, b, threads), ti = set_intersection(a, b, threads), td = set_difference(a, b, threads);
+    std::cout << threads << " thread(s): union " << tu.size() << " " << std::equal(tu.begin(), tu.end(), u.begin(), u.end())
+              << ", intersection " << ti.size() << " " << std::equal(ti.begin(), ti.end(), in.begin(), in.end())
+              << ", difference " << td.size() << " " << std::equal(td.begin(), td.end(), d.begin(), d.end())
+              << ", packed " << (tu.stats().nodes <= tu.size() / 31 + 2) << ", rank " << tu.rank(300000) << std::endl;
+    auto merged = a;
+    merged.merge(b, threads);
+    std::cout << "  merge " << std::equal(merged.begin(), merged.end(), u.begin(), u.end()) << ", original "
+              << std::equal(a.begin(), a.end(), sa.begin(), sa.end()) << std::endl;
+  }
+  return 0;
+}